@@ -26,6 +26,42 @@
 /**
  * Array of luna service paths that are required before the plugin can be instantiated.
  * A single plugin can have multiple services as a requirement.
+ * To avoid opening the plugin during discovery, install a manifest
+ * <plugin name>.json next to the plugin listing the same services:
+ * {"requiredServices": ["com.webos.notification"]}
+ *
+ * A plugin that only reacts to rare events can be loaded on demand by adding
+ * an "activation" section to the manifest. The event monitor then holds the
+ * listed subscriptions, signal matches and methods itself and instantiates
+ * the plugin when the first one fires. The plugin still subscribes on its own
+ * in startMonitoring, the triggering signal is delivered to its matching
+ * signal subscription. After being idle the plugin gets stopMonitoring with
+ * an empty service name and is unloaded.
+ * {"requiredServices": ["com.webos.service.battery"],
+ *  "activation": {"mode": "lazy", "idleTimeout": 300,
+ *                 "triggers": [{"signal": "/com/palm/power", "name": "batteryStatus"}],
+ *                 "methods": [{"category": "/myPlugin", "name": "action"}]}}
+ *
+ * A plugin can be run in its own event-monitor-host process by adding
+ * "isolation": "process" to the manifest, so that a crash or a busy loop
+ * does not take the event monitor down. The Manager API is the same, each
+ * call is a round trip to the event monitor and callbacks arrive from the
+ * host's own main loop. A method handler must reply within 5 seconds.
+ * {"requiredServices": ["com.webos.service.battery"], "isolation": "process"}
+ *
+ * "thread": "name" runs the plugin on a worker thread of that name instead
+ * of the main loop, plugins naming the same thread share it. Plugin methods
+ * and callbacks are called on the thread and Manager methods may only be
+ * called from it, they wait for the main loop. JSON values are copies, do
+ * not share them with other threads. Isolation takes precedence.
+ * {"requiredServices": ["com.webos.service.battery"], "thread": "power"}
+ *
+ * A plugin whose required service goes offline briefly gets servicePaused.
+ * When the service is back, the plugin gets stopMonitoring and
+ * startMonitoring so that it subscribes again. A plugin that renews its
+ * subscriptions itself can add "serviceResume": "notify" to the manifest to
+ * get serviceResumed instead.
+ * {"requiredServices": ["com.webos.service.battery"], "serviceResume": "notify"}
  */
 extern "C" const char *requiredServices[];
 
@@ -34,7 +70,9 @@ extern "C" const char *requiredServices[];
  *         The result must be an subclass of Plugin.
  *         This method wil be called only once.
  *         The plugin will be freed by the caller.
- *         After that the plugin shared library will be unloaded.
+ *         After that the plugin shared library will be unloaded. The library
+ *         may be kept mapped for a while and reused for the next instance,
+ *         so do not rely on static initializers running for every instance.
  *
  *
  * @param Version of the API to use, the current api version is available in
@@ -30,7 +30,7 @@ namespace EventMonitor
 	/**
 	 * Current plugin API version. Increment this if any changes are made in this file.
 	 */
-	const int API_VERSION = 3;
+	const int API_VERSION = 8;
 
 	class Manager;
 	class Plugin;
@@ -48,6 +48,12 @@ namespace EventMonitor
 
 	typedef std::function<void(const std::string &timeoutId)> TimeoutCallback;
 
+	typedef std::function<void()> BackgroundTask;
+
+	typedef std::function<void()> BackgroundCallback;
+
+	typedef std::function<void()> PostCallback;
+
 	/**
 	 * Subscribe callback function.
 	 * @param previousResponse - response from previous subscribe response.
@@ -165,6 +171,106 @@ namespace EventMonitor
 		 */
 		virtual bool cancelTimeout(const std::string &timeoutId) = 0;
 
+		/**
+		 * Call a function once no new debounce request with the same id has been
+		 * made for the specified time. Each call restarts the delay and replaces
+		 * the pending callback.
+		 * Debounce is implemented using timeouts. Timeout ids starting with
+		 * '@' are reserved and should not be used with setTimeout.
+		 * @param debounceId - string identifier.
+		 * @param delayMs - quiet time in milliseconds before the callback is called.
+		 * @param callback - the function to call, receives debounceId.
+		 */
+		virtual void debounce(const std::string &debounceId,
+		                      unsigned int delayMs,
+		                      TimeoutCallback callback) = 0;
+
+		/**
+		 * Cancel a pending debounced call.
+		 * @param debounceId - debounce identifier. Same as in debounce.
+		 * @returns - true if a call was pending.
+		 */
+		virtual bool cancelDebounce(const std::string &debounceId) = 0;
+
+		/**
+		 * Call a function at most once per interval for the same id.
+		 * If the interval has passed since the last call, the callback is called
+		 * immediately. Otherwise a single trailing call with the latest callback
+		 * is made when the interval expires.
+		 * @param throttleId - string identifier.
+		 * @param intervalMs - minimum time in milliseconds between the calls.
+		 * @param callback - the function to call, receives throttleId.
+		 */
+		virtual void throttle(const std::string &throttleId,
+		                      unsigned int intervalMs,
+		                      TimeoutCallback callback) = 0;
+
+		/**
+		 * Cancel a pending trailing throttled call and forget the throttle state.
+		 * @param throttleId - throttle identifier. Same as in throttle.
+		 * @returns - true if throttle was present.
+		 */
+		virtual bool cancelThrottle(const std::string &throttleId) = 0;
+
+		/**
+		 * Periodically call a luna method and report changed responses.
+		 * The first call is made immediately. The poll interval starts at
+		 * minIntervalMs and doubles, up to maxIntervalMs, every time the response
+		 * is unchanged. A changed response resets it back to minIntervalMs.
+		 * Each interval is randomly adjusted by up to 10% to avoid synchronized
+		 * polling between plugins.
+		 * @param pollId - poll identifier - use to stop or replace existing poll.
+		 * @param serviceUrl - luna service url to call, including the luna:// prefix.
+		 * @param params - call parameters.
+		 * @param minIntervalMs - shortest poll interval in milliseconds.
+		 * @param maxIntervalMs - longest poll interval in milliseconds.
+		 * @param callback - called only when the response differs from the
+		 *                   previous one. Previous response is null JValue
+		 *                   for the first response.
+		 */
+		virtual void startPolling(const std::string &pollId,
+		                          const std::string &serviceUrl,
+		                          pbnjson::JValue &params,
+		                          unsigned int minIntervalMs,
+		                          unsigned int maxIntervalMs,
+		                          SubscribeCallback callback) = 0;
+
+		/**
+		 * Stop polling.
+		 * @param pollId - poll identifier. Same as in startPolling.
+		 * @returns - true if there was a poll.
+		 */
+		virtual bool stopPolling(const std::string &pollId) = 0;
+
+		/**
+		 * Run a function on a worker thread, for CPU heavy work such as parsing
+		 * large payloads that would otherwise hold up all plugins' events.
+		 * The workers are shared by all plugins and take turns between them.
+		 * The task must not call the Manager and must lock any state it shares
+		 * with the plugin's callbacks. An exception thrown by the task unloads
+		 * the plugin.
+		 * Tasks that have not started are dropped when the plugin is unloaded,
+		 * unloading waits for a task that is already running.
+		 * @param task - the function to run on a worker thread.
+		 * @param completion - called like any other plugin callback once the
+		 *                     task has run. May be empty.
+		 * @returns - false if the plugin has too many tasks pending, the task
+		 *            is not run then.
+		 */
+		virtual bool runInBackground(BackgroundTask task,
+		                             BackgroundCallback completion) = 0;
+
+		/**
+		 * Run a function where the plugin's callbacks run. This is the only
+		 * method that may be called from threads the plugin started itself,
+		 * use it to hand their results over to the plugin.
+		 * Functions run in the order they were posted. Functions still queued
+		 * when the plugin is unloaded are dropped, the plugin must join its
+		 * threads in its destructor.
+		 * @param callback - the function to run.
+		 */
+		virtual void post(PostCallback callback) = 0;
+
 		/**
 		 * Registers a luna method on bus.
 		 * This method may be called multiple times for same methodName to update
@@ -227,7 +333,13 @@ namespace EventMonitor
 
 		/**
 		 * Called when required service goes offline.
-		 * @param service - name of the service that went offline.
+		 * Lazy plugins are also stopped after being idle, see
+		 * event-monitor-api.h. Plugins are also stopped when their
+		 * library is upgraded or removed, in that case the plugin is
+		 * unloaded even if it returns UNLOAD_CANCEL.
+		 * @param service - name of the service that went offline,
+		 *                  empty if the lazy plugin is idle or the
+		 *                  plugin is being upgraded or removed.
 		 * @return - UNLOAD_OK: active alerts are removed,
 		 *               the plugin instance is freed and plugin is unloaded.
 		 *         - UNLOAD_CANCEL: no action is taken, plugin continues to receive,
@@ -243,6 +355,29 @@ namespace EventMonitor
 		 */
 		virtual void uiLocaleChanged(const std::string &uiLocale) = 0;
 
+		/**
+		 * Called when required service goes offline and the event monitor
+		 * waits to see if it comes back before calling stopMonitoring.
+		 * Use to suspend work that needs the service.
+		 * @param service - name of the service that went offline.
+		 */
+		virtual void servicePaused(const std::string &service) {};
+
+		/**
+		 * Called when the paused service came back online, only for plugins
+		 * with "serviceResume": "notify" in their manifest. Subscriptions to
+		 * the service were cancelled when it went offline and must be renewed
+		 * here. Other plugins get stopMonitoring and startMonitoring instead.
+		 * @param service - name of the service that is online again.
+		 */
+		virtual void serviceResumed(const std::string &service) {};
+
+		/**
+		 * Called when the system is low on memory.
+		 * Drop caches and other state that can be rebuilt when needed.
+		 */
+		virtual void trimMemory() {};
+
 		virtual ~Plugin() {};
 	};
 
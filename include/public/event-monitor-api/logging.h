@@ -14,17 +14,41 @@
 //
 // SPDX-License-Identifier: Apache-2.0
 
+#include "loghelpers.hpp"
+
+// Arguments are only evaluated if the level is enabled for the plugin context.
+// Errors and warnings are rate limited per call site.
+
 #define LOG_CRITICAL(msgid, kvcount, ...) \
-    PmLogCritical(pluginLogContext, msgid, kvcount, ##__VA_ARGS__)
+    do { \
+        if (EventMonitor::isLogLevelEnabled(pluginLogContext, kPmLogLevel_Critical)) \
+            PmLogCritical(pluginLogContext, msgid, kvcount, ##__VA_ARGS__); \
+    } while (0)
 
 #define LOG_ERROR(msgid, kvcount, ...) \
-    PmLogError(pluginLogContext, msgid, kvcount,##__VA_ARGS__)
+    do { \
+        static EventMonitor::LogRateLimiter logRateLimiter; \
+        if (EventMonitor::isLogLevelEnabled(pluginLogContext, kPmLogLevel_Error) && \
+                logRateLimiter.allow(pluginLogContext, msgid)) \
+            PmLogError(pluginLogContext, msgid, kvcount, ##__VA_ARGS__); \
+    } while (0)
 
 #define LOG_WARNING(msgid, kvcount, ...) \
-    PmLogWarning(pluginLogContext, msgid, kvcount, ##__VA_ARGS__)
+    do { \
+        static EventMonitor::LogRateLimiter logRateLimiter; \
+        if (EventMonitor::isLogLevelEnabled(pluginLogContext, kPmLogLevel_Warning) && \
+                logRateLimiter.allow(pluginLogContext, msgid)) \
+            PmLogWarning(pluginLogContext, msgid, kvcount, ##__VA_ARGS__); \
+    } while (0)
 
 #define LOG_INFO(msgid, kvcount, ...) \
-    PmLogInfo(pluginLogContext, msgid, kvcount, ##__VA_ARGS__)
+    do { \
+        if (EventMonitor::isLogLevelEnabled(pluginLogContext, kPmLogLevel_Info)) \
+            PmLogInfo(pluginLogContext, msgid, kvcount, ##__VA_ARGS__); \
+    } while (0)
 
 #define LOG_DEBUG(fmt, ...) \
-    PmLogDebug(pluginLogContext, "%s:%s() " fmt, __FILE__, __FUNCTION__, ##__VA_ARGS__)
+    do { \
+        if (EventMonitor::isLogLevelEnabled(pluginLogContext, kPmLogLevel_Debug)) \
+            PmLogDebug(pluginLogContext, "%s:%s() " fmt, __FILE__, __FUNCTION__, ##__VA_ARGS__); \
+    } while (0)
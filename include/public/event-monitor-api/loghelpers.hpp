@@ -0,0 +1,100 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef EVENT_MONITOR_LOG_HELPERS_HPP
+#define EVENT_MONITOR_LOG_HELPERS_HPP
+
+#include <atomic>
+#include <glib.h>
+#include <PmLogLib.h>
+
+namespace EventMonitor {
+
+	/**
+	 * Returns true if messages with the given level are written to the context.
+	 * Used by logging macros to skip evaluating arguments of disabled messages.
+	 */
+	inline bool isLogLevelEnabled(PmLogContext context, int level)
+	{
+		int contextLevel = kPmLogLevel_Debug;
+
+		if (PmLogGetContextLevel(context, &contextLevel) != kPmLogErr_None)
+		{
+			return true;
+		}
+
+		return level <= contextLevel;
+	}
+
+	/**
+	 * Limits how often a single message can be logged.
+	 * At most BURST messages are allowed within WINDOW_US, the rest are
+	 * counted and the count is logged once messages are allowed again.
+	 * Can be used from any thread, plugins log from their own threads
+	 * and background tasks too.
+	 */
+	class LogRateLimiter
+	{
+	public:
+		static const unsigned int BURST = 10;
+		static const gint64 WINDOW_US = G_USEC_PER_SEC;
+
+		LogRateLimiter():
+			windowStart(0),
+			count(0),
+			suppressed(0)
+		{};
+
+		LogRateLimiter(const LogRateLimiter &) = delete;
+		LogRateLimiter &operator=(const LogRateLimiter &) = delete;
+
+		bool allow(PmLogContext context, const char *msgid)
+		{
+			gint64 now = g_get_monotonic_time();
+			gint64 start = this->windowStart.load(std::memory_order_relaxed);
+
+			// Only the thread that moves the window resets and reports it.
+			if (now - start >= WINDOW_US &&
+			        this->windowStart.compare_exchange_strong(start, now))
+			{
+				unsigned int dropped = this->suppressed.exchange(0);
+				this->count.store(0);
+
+				if (dropped > 0)
+				{
+					PmLogWarning(context, "LOG_RATE_LIMITED", 0,
+					             "%u %s messages suppressed", dropped, msgid);
+				}
+			}
+
+			if (this->count.fetch_add(1) < BURST)
+			{
+				return true;
+			}
+
+			this->suppressed.fetch_add(1);
+			return false;
+		}
+
+	private:
+		std::atomic<gint64> windowStart;
+		std::atomic<unsigned int> count;
+		std::atomic<unsigned int> suppressed;
+	};
+
+} //namespace EventMonitor;
+
+#endif // EVENT_MONITOR_LOG_HELPERS_HPP
@@ -48,12 +48,12 @@ public:
 
 
 	const std::string getLocString(const std::string& source){
-		return this->resourceBundle->getLocString(source);
+		return this->getResourceBundle()->getLocString(source);
 	}
 
 	const std::string getLocString(const std::string& key,
 	                               const std::string& source){
-		return this->resourceBundle->getLocString(key, source);
+		return this->getResourceBundle()->getLocString(key, source);
 	}
 
 	void uiLocaleChanged(const std::string &uiLocale){
@@ -63,6 +63,24 @@ public:
 				this->localizationPath));
 	}
 
+	/**
+	 * Resource bundle is reloaded on next getLocString.
+	 * Override to drop plugin's own caches, call the base method too.
+	 */
+	void trimMemory(){
+		this->resourceBundle.reset();
+	}
+
+protected:
+	ResBundle *getResourceBundle(){
+		if (!this->resourceBundle)
+		{
+			this->uiLocaleChanged(this->manager->getUILocale());
+		}
+
+		return this->resourceBundle.get();
+	}
+
 protected:
 	EventMonitor::Manager *manager;
 	std::unique_ptr<ResBundle> resourceBundle;
@@ -0,0 +1,787 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+#include <dlfcn.h>
+#include <poll.h>
+
+#include "config.h"
+#include "hostmanager.h"
+#include "logging.h"
+
+using namespace pbnjson;
+
+// Wait between attempts to send when the ring is full.
+static const gulong SEND_RETRY_US = 1000;
+
+static std::string stringOf(const JValue &value)
+{
+	std::string result;
+	(void) value.asString(result);
+	return result;
+}
+
+static int64_t numberOf(const JValue &value)
+{
+	int64_t result = 0;
+	(void) value.asNumber(result);
+	return result;
+}
+
+static bool boolOf(const JValue &value)
+{
+	bool result = false;
+	(void) value.asBool(result);
+	return result;
+}
+
+HostManager::HostManager(ShmChannel *_channel, GMainLoop *_mainLoop,
+                         const std::string &_pluginPath,
+                         const std::string &_pluginName):
+	channel(_channel),
+	mainLoop(_mainLoop),
+	pluginPath(_pluginPath),
+	pluginName(_pluginName),
+	dlHandle(nullptr),
+	plugin(nullptr),
+	nextSeq(0),
+	nextCallId(0),
+	currentOrigin(0),
+	dispatchSource(0),
+	background(std::max(1u, std::min(g_get_num_processors(), MAX_BACKGROUND_THREADS)),
+	           MAX_PLUGIN_BACKGROUND_TASKS),
+	posted(new TaskQueue(g_main_context_default()))
+{
+	// Same context as the plugin would have in the event monitor.
+	const std::string name = std::string(COMPONENT_NAME) + "-" + this->pluginName;
+	PmLogErr error = PmLogGetContext(name.c_str(), &this->pluginLogContext);
+
+	if (error != kPmLogErr_None)
+	{
+		LOG_WARNING(MSGID_PMLOG_GETCONTEXT_FAIL, 0,
+		            "Failed to setup up log context %s, error %d\n", name.c_str(), error);
+		this->pluginLogContext = ::logContext;
+	}
+}
+
+HostManager::~HostManager()
+{
+	if (this->dispatchSource)
+	{
+		g_source_remove(this->dispatchSource);
+	}
+
+	this->background.cancel(this);
+	delete this->plugin;
+	delete this->posted;
+
+	if (this->dlHandle)
+	{
+		dlclose(this->dlHandle);
+	}
+}
+
+void HostManager::setupLogging(PmLogContext *context)
+{
+	if (!context)
+	{
+		LOG_ERROR(MSGID_UNLOAD_BAD_PARAMS, 0, "Bad parameters");
+		return;
+	}
+
+	*context = this->pluginLogContext;
+}
+
+void HostManager::unloadPlugin()
+{
+	(void) this->request(JObject{{"op", "unloadPlugin"}});
+}
+
+const std::string HostManager::getUILocale()
+{
+	return this->uiLocale;
+}
+
+const JValue &HostManager::getLocaleInfo()
+{
+	return this->localeInfo;
+}
+
+JValue HostManager::lunaCall(const std::string &serviceUrl,
+                             JValue &params,
+                             unsigned long timeout)
+{
+	return this->request(JObject{{"op", "lunaCall"},
+	                             {"url", serviceUrl},
+	                             {"params", params},
+	                             {"timeout", JValue(static_cast<int64_t>(timeout))}});
+}
+
+void HostManager::lunaCallAsync(const std::string &serviceUrl,
+                                JValue &params,
+                                LunaCallback callback)
+{
+	JValue message = JObject{{"op", "lunaCallAsync"},
+	                         {"url", serviceUrl},
+	                         {"params", params}};
+	std::string callId;
+
+	if (callback)
+	{
+		callId = std::to_string(++this->nextCallId);
+		this->calls[callId] = callback;
+		message.put("id", callId);
+	}
+
+	try
+	{
+		(void) this->request(message);
+	}
+	catch (...)
+	{
+		this->calls.erase(callId);
+		throw;
+	}
+}
+
+void HostManager::subscribeToMethod(const std::string &subscriptionId,
+                                    const std::string &methodPath,
+                                    JValue &params,
+                                    SubscribeCallback callback,
+                                    const JSchema &schema)
+{
+	(void) this->request(JObject{{"op", "subscribeToMethod"},
+	                             {"id", subscriptionId},
+	                             {"url", methodPath},
+	                             {"params", params}});
+	this->subscriptions.erase(subscriptionId);
+	this->subscriptions.emplace(subscriptionId, SubscriptionState{callback, schema});
+}
+
+bool HostManager::unsubscribeFromMethod(const std::string &subscriptionId)
+{
+	this->subscriptions.erase(subscriptionId);
+	return boolOf(this->request(JObject{{"op", "unsubscribeFromMethod"},
+	                                    {"id", subscriptionId}}));
+}
+
+void HostManager::subscribeToSignal(const std::string &subscriptionId,
+                                    const std::string &category,
+                                    const std::string &method,
+                                    SubscribeCallback callback,
+                                    const JSchema &schema)
+{
+	(void) this->request(JObject{{"op", "subscribeToSignal"},
+	                             {"id", subscriptionId},
+	                             {"category", category},
+	                             {"method", method}});
+	this->subscriptions.erase(subscriptionId);
+	this->subscriptions.emplace(subscriptionId, SubscriptionState{callback, schema});
+}
+
+bool HostManager::unsubscribeFromSignal(const std::string &subscriptionId)
+{
+	this->subscriptions.erase(subscriptionId);
+	return boolOf(this->request(JObject{{"op", "unsubscribeFromSignal"},
+	                                    {"id", subscriptionId}}));
+}
+
+void HostManager::setTimeout(const std::string &timeoutId,
+                             unsigned int timeMs,
+                             bool repeat,
+                             TimeoutCallback callback)
+{
+	this->timeouts[timeoutId] = std::make_pair(callback, repeat);
+	(void) this->request(JObject{{"op", "setTimeout"},
+	                             {"id", timeoutId},
+	                             {"ms", JValue(static_cast<int64_t>(timeMs))},
+	                             {"repeat", repeat}});
+}
+
+bool HostManager::cancelTimeout(const std::string &timeoutId)
+{
+	this->timeouts.erase(timeoutId);
+	return boolOf(this->request(JObject{{"op", "cancelTimeout"}, {"id", timeoutId}}));
+}
+
+void HostManager::debounce(const std::string &debounceId,
+                           unsigned int delayMs,
+                           TimeoutCallback callback)
+{
+	this->debounces[debounceId] = callback;
+	(void) this->request(JObject{{"op", "debounce"},
+	                             {"id", debounceId},
+	                             {"ms", JValue(static_cast<int64_t>(delayMs))}});
+}
+
+bool HostManager::cancelDebounce(const std::string &debounceId)
+{
+	this->debounces.erase(debounceId);
+	return boolOf(this->request(JObject{{"op", "cancelDebounce"}, {"id", debounceId}}));
+}
+
+void HostManager::throttle(const std::string &throttleId,
+                           unsigned int intervalMs,
+                           TimeoutCallback callback)
+{
+	// Latest callback wins, same as a pending throttled call.
+	this->throttles[throttleId] = callback;
+	(void) this->request(JObject{{"op", "throttle"},
+	                             {"id", throttleId},
+	                             {"ms", JValue(static_cast<int64_t>(intervalMs))}});
+}
+
+bool HostManager::cancelThrottle(const std::string &throttleId)
+{
+	this->throttles.erase(throttleId);
+	return boolOf(this->request(JObject{{"op", "cancelThrottle"}, {"id", throttleId}}));
+}
+
+void HostManager::startPolling(const std::string &pollId,
+                               const std::string &serviceUrl,
+                               JValue &params,
+                               unsigned int minIntervalMs,
+                               unsigned int maxIntervalMs,
+                               SubscribeCallback callback)
+{
+	this->polls[pollId] = callback;
+	(void) this->request(JObject{{"op", "startPolling"},
+	                             {"id", pollId},
+	                             {"url", serviceUrl},
+	                             {"params", params},
+	                             {"minMs", JValue(static_cast<int64_t>(minIntervalMs))},
+	                             {"maxMs", JValue(static_cast<int64_t>(maxIntervalMs))}});
+}
+
+bool HostManager::stopPolling(const std::string &pollId)
+{
+	this->polls.erase(pollId);
+	return boolOf(this->request(JObject{{"op", "stopPolling"}, {"id", pollId}}));
+}
+
+bool HostManager::runInBackground(BackgroundTask task, BackgroundCallback completion)
+{
+	return this->background.submit(this, task, [this, completion](const std::string &error)
+	{
+		this->invoke("background task", [&error, &completion]()
+		{
+			if (!error.empty())
+			{
+				throw Error(error);
+			}
+
+			if (completion)
+			{
+				completion();
+			}
+		});
+	});
+}
+
+void HostManager::post(PostCallback callback)
+{
+	this->posted->post([this, callback]()
+	{
+		this->invoke("posted function", callback);
+	});
+}
+
+std::string HostManager::registerMethod(const std::string &categoryName,
+                                        const std::string &methodName,
+                                        LunaCallHandler handler,
+                                        const JSchema &schema)
+{
+	std::string url = stringOf(this->request(JObject{{"op", "registerMethod"},
+	                                                 {"category", categoryName},
+	                                                 {"method", methodName}}));
+	std::string key = categoryName + "/" + methodName;
+	this->methods.erase(key);
+	this->methods.emplace(key, MethodState{handler, schema});
+	return url;
+}
+
+void HostManager::createToast(const std::string &message,
+                              const std::string &iconUrl,
+                              const JValue &onClickAction)
+{
+	(void) this->request(JObject{{"op", "createToast"},
+	                             {"message", message},
+	                             {"iconUrl", iconUrl},
+	                             {"onClickAction", onClickAction}});
+}
+
+void HostManager::createAlert(const std::string &alertId,
+                              const std::string &title,
+                              const std::string &message,
+                              bool modal,
+                              const std::string &iconUrl,
+                              const JValue &buttons,
+                              const JValue &onClose)
+{
+	(void) this->request(JObject{{"op", "createAlert"},
+	                             {"id", alertId},
+	                             {"title", title},
+	                             {"message", message},
+	                             {"modal", modal},
+	                             {"iconUrl", iconUrl},
+	                             {"buttons", buttons},
+	                             {"onClose", onClose}});
+}
+
+bool HostManager::closeAlert(const std::string &alertId)
+{
+	return boolOf(this->request(JObject{{"op", "closeAlert"}, {"id", alertId}}));
+}
+
+bool HostManager::send(const JValue &message)
+{
+	std::string text = message.stringify("");
+
+	if (text.size() > this->channel->maxMessageSize())
+	{
+		LOG_ERROR(MSGID_PLUGIN_HOST, 0, "Dropping %zu byte message from plugin %s",
+		          text.size(), this->pluginName.c_str());
+		return false;
+	}
+
+	// The event monitor drains the ring even while it waits for us.
+	while (!this->channel->send(text))
+	{
+		g_usleep(SEND_RETRY_US);
+	}
+
+	return true;
+}
+
+JValue HostManager::request(JValue message)
+{
+	int64_t seq = ++this->nextSeq;
+	message.put("seq", JValue(seq));
+
+	if (this->currentOrigin)
+	{
+		message.put("origin", JValue(this->currentOrigin));
+	}
+
+	if (!this->send(message))
+	{
+		throw Error("Request too large");
+	}
+
+	JValue reply;
+
+	while (reply.isNull())
+	{
+		std::string text;
+		this->channel->clearSignal();
+
+		while (this->channel->receive(text))
+		{
+			JValue received = JDomParser::fromString(text, JSchema::AllSchema());
+
+			if (stringOf(received["op"]) == "reply" && numberOf(received["seq"]) == seq)
+			{
+				reply = received;
+			}
+			else
+			{
+				this->deferred.push_back(received);
+			}
+		}
+
+		if (reply.isNull())
+		{
+			struct pollfd fd = {this->channel->getReceiveFd(), POLLIN, 0};
+			(void) poll(&fd, 1, -1);
+		}
+	}
+
+	// The signal for the deferred messages is consumed.
+	if (!this->deferred.empty() && !this->dispatchSource)
+	{
+		this->dispatchSource = g_idle_add(HostManager::dispatchCallback, this);
+	}
+
+	if (reply.hasKey("error"))
+	{
+		throw Error(stringOf(reply["error"]));
+	}
+
+	return reply["result"];
+}
+
+gboolean HostManager::dispatchCallback(gpointer userData)
+{
+	auto manager = reinterpret_cast<HostManager *>(userData);
+	manager->dispatchSource = 0;
+	manager->dispatch();
+	return G_SOURCE_REMOVE;
+}
+
+void HostManager::dispatch()
+{
+	std::string text;
+	this->channel->clearSignal();
+
+	// Deferred messages were received before anything still in the ring.
+	for (;;)
+	{
+		JValue message;
+
+		if (!this->deferred.empty())
+		{
+			message = this->deferred.front();
+			this->deferred.pop_front();
+		}
+		else if (this->channel->receive(text))
+		{
+			message = JDomParser::fromString(text, JSchema::AllSchema());
+		}
+		else
+		{
+			break;
+		}
+
+		this->handleMessage(message);
+	}
+}
+
+void HostManager::handleMessage(const JValue &message)
+{
+	std::string op = stringOf(message["op"]);
+
+	if (op == "reply")
+	{
+		return;
+	}
+
+	if (!message.hasKey("seq"))
+	{
+		// Calls the plugin makes meanwhile are tagged with the event origin.
+		this->currentOrigin = numberOf(message["origin"]);
+		this->handleEvent(op, message);
+		this->currentOrigin = 0;
+		return;
+	}
+
+	JValue reply = JObject{{"op", "reply"}, {"seq", message["seq"]}};
+
+	try
+	{
+		reply.put("result", this->handleRequest(op, message));
+	}
+	catch (const std::exception &e)
+	{
+		reply.put("error", e.what());
+	}
+
+	(void) this->send(reply);
+}
+
+JValue HostManager::handleRequest(const std::string &op, const JValue &message)
+{
+	if (op == "init")
+	{
+		std::string error;
+		this->setLocale(message);
+
+		if (!this->instantiate(error))
+		{
+			// Exit once the reply is out.
+			g_main_loop_quit(this->mainLoop);
+			throw Error(error);
+		}
+
+		return JValue(true);
+	}
+	else if (op == "stopMonitoring")
+	{
+		if (!this->plugin)
+		{
+			return JValue(static_cast<int64_t>(UNLOAD_OK));
+		}
+
+		UnloadResult result = this->plugin->stopMonitoring(stringOf(message["service"]));
+		return JValue(static_cast<int64_t>(result));
+	}
+	else if (op == "method")
+	{
+		return this->callMethod(message);
+	}
+
+	throw Error("Unknown event monitor request: " + op);
+}
+
+void HostManager::handleEvent(const std::string &op, const JValue &message)
+{
+	std::string id = stringOf(message["id"]);
+
+	if (!this->plugin)
+	{
+		return;
+	}
+
+	if (op == "startMonitoring")
+	{
+		this->invoke("startMonitoring", [this]()
+		{
+			this->plugin->startMonitoring();
+		});
+	}
+	else if (op == "uiLocaleChanged")
+	{
+		this->setLocale(message);
+		this->invoke("uiLocaleChanged", [this]()
+		{
+			this->plugin->uiLocaleChanged(this->uiLocale);
+		});
+	}
+	else if (op == "servicePaused" || op == "serviceResumed")
+	{
+		std::string service = stringOf(message["service"]);
+		bool paused = op == "servicePaused";
+
+		this->invoke(op.c_str(), [this, service, paused]()
+		{
+			if (paused)
+			{
+				this->plugin->servicePaused(service);
+			}
+			else
+			{
+				this->plugin->serviceResumed(service);
+			}
+		});
+	}
+	else if (op == "trimMemory")
+	{
+		this->invoke("trimMemory", [this]()
+		{
+			this->plugin->trimMemory();
+		});
+	}
+	else if (op == "subscription" || op == "poll")
+	{
+		SubscribeCallback callback;
+		JValue previousValue = message["previous"].duplicate();
+		JValue value = message["value"].duplicate();
+
+		if (op == "poll")
+		{
+			auto iter = this->polls.find(id);
+			callback = iter != this->polls.end() ? iter->second : nullptr;
+		}
+		else
+		{
+			auto iter = this->subscriptions.find(id);
+
+			if (iter == this->subscriptions.end())
+			{
+				return;
+			}
+
+			JResult validation = iter->second.schema.validate(value);
+
+			if (validation.isError())
+			{
+				LOG_ERROR(MSGID_LS2_RESPONSE_SCHEMA_ERROR, 0,
+				          "Failed to validate against schema: %s, schema: %s",
+				          value.stringify("").c_str(), validation.errorString().c_str());
+				return;
+			}
+
+			callback = iter->second.callback;
+		}
+
+		if (callback)
+		{
+			this->invoke("subscription callback", [&]()
+			{
+				callback(previousValue, value);
+			});
+		}
+	}
+	else if (op == "callResult")
+	{
+		auto iter = this->calls.find(id);
+
+		if (iter == this->calls.end())
+		{
+			return;
+		}
+
+		LunaCallback callback = iter->second;
+		JValue value = message["value"].duplicate();
+		this->calls.erase(iter);
+
+		this->invoke("call callback", [&]()
+		{
+			callback(value);
+		});
+	}
+	else if (op == "timeout" || op == "debounce" || op == "throttle")
+	{
+		TimeoutCallback callback;
+
+		if (op == "timeout")
+		{
+			auto iter = this->timeouts.find(id);
+
+			if (iter == this->timeouts.end())
+			{
+				return;
+			}
+
+			callback = iter->second.first;
+
+			if (!iter->second.second)
+			{
+				this->timeouts.erase(iter);
+			}
+		}
+		else if (op == "debounce")
+		{
+			auto iter = this->debounces.find(id);
+
+			if (iter == this->debounces.end())
+			{
+				return;
+			}
+
+			callback = iter->second;
+			this->debounces.erase(iter);
+		}
+		else
+		{
+			auto iter = this->throttles.find(id);
+			callback = iter != this->throttles.end() ? iter->second : nullptr;
+		}
+
+		if (callback)
+		{
+			this->invoke("timeout callback", [&]()
+			{
+				callback(id);
+			});
+		}
+	}
+}
+
+JValue HostManager::callMethod(const JValue &message)
+{
+	std::string key = stringOf(message["category"]) + "/" + stringOf(message["method"]);
+	auto iter = this->methods.find(key);
+
+	if (!this->plugin || iter == this->methods.end())
+	{
+		return JObject{{"returnValue", false},
+		               {"errorCode", 1},
+		               {"errorMessage", "Method removed."}};
+	}
+
+	JValue params = message["params"];
+
+	if (iter->second.schema.validate(params).isError())
+	{
+		return JObject{{"returnValue", false},
+		               {"errorCode", 2},
+		               {"errorMessage", "Failed to validate request against schema"}};
+	}
+
+	LunaCallHandler handler = iter->second.handler;
+	JValue result = JObject{{"returnValue", false},
+		{"errorCode", 3},
+		{"errorMessage", "Plugin method failed."}};
+
+	this->invoke("method handler", [&]()
+	{
+		result = handler(params);
+	});
+
+	return result;
+}
+
+void HostManager::setLocale(const JValue &message)
+{
+	(void) message["locale"].asString(this->uiLocale);
+	this->localeInfo = message["localeInfo"].duplicate();
+}
+
+bool HostManager::instantiate(std::string &error)
+{
+	this->dlHandle = dlopen(this->pluginPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+	if (!this->dlHandle)
+	{
+		error = dlerror();
+		return false;
+	}
+
+	auto instantiateFunc = reinterpret_cast<Plugin* (*)(int, Manager *)>(dlsym(
+	                           this->dlHandle, "instantiatePlugin"));
+
+	if (!instantiateFunc)
+	{
+		error = "Failed to find plugin method instantiatePlugin.";
+		return false;
+	}
+
+	try
+	{
+		this->plugin = instantiateFunc(API_VERSION, this);
+	}
+	catch (const std::exception &e)
+	{
+		error = e.what();
+		return false;
+	}
+	catch (...)
+	{
+		error = "Exception while instantiating plugin.";
+		return false;
+	}
+
+	if (!this->plugin)
+	{
+		error = "instantiatePlugin returned NULL";
+		return false;
+	}
+
+	return true;
+}
+
+void HostManager::invoke(const char *what, const std::function<void()> &function)
+{
+	std::string message;
+
+	try
+	{
+		function();
+		return;
+	}
+	catch (const std::exception &e)
+	{
+		message = std::string(what) + ": " + e.what();
+	}
+	catch (...)
+	{
+		message = std::string(what) + ": unknown exception";
+	}
+
+	LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0, "Exception in plugin %s, %s",
+	          this->pluginName.c_str(), message.c_str());
+	(void) this->send(JObject{{"op", "exception"}, {"message", message}});
+}
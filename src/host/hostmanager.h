@@ -0,0 +1,211 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <glib.h>
+#include <pbnjson.hpp>
+
+#include <event-monitor-api/api.h>
+
+#include "backgroundpool.h"
+#include "shmring.h"
+#include "taskqueue.h"
+
+using namespace EventMonitor;
+
+class SubscriptionState
+{
+public:
+	SubscribeCallback callback;
+	pbnjson::JSchema schema;
+};
+
+class MethodState
+{
+public:
+	LunaCallHandler handler;
+	pbnjson::JSchema schema;
+};
+
+/**
+ * Manager of a plugin running in the host process.
+ * Every Manager call is sent to the event monitor, which executes it on
+ * the plugin's adapter and sends the callbacks back, see RemotePlugin.
+ * The plugin's callbacks and schemas stay here, keyed by their ids.
+ */
+class HostManager: public Manager
+{
+public:
+	HostManager(ShmChannel *channel, GMainLoop *mainLoop,
+	            const std::string &pluginPath, const std::string &pluginName);
+	virtual ~HostManager();
+
+	HostManager(const HostManager &) = delete;
+	HostManager &operator=(const HostManager &) = delete;
+
+	// Manager methods - called from plugin
+	void setupLogging(PmLogContext *context);
+	void unloadPlugin();
+
+	const std::string getUILocale();
+	const pbnjson::JValue &getLocaleInfo();
+
+	pbnjson::JValue lunaCall(const std::string &serviceUrl,
+	                         pbnjson::JValue &params,
+	                         unsigned long timeout = 1000);
+
+	void lunaCallAsync(const std::string &serviceUrl,
+	                   pbnjson::JValue &params,
+	                   LunaCallback callback);
+
+	void subscribeToMethod(const std::string &subscriptionId,
+	                       const std::string &methodPath,
+	                       pbnjson::JValue &params,
+	                       SubscribeCallback callback,
+	                       const pbnjson::JSchema &schema = pbnjson::JSchema::AllSchema());
+
+	bool unsubscribeFromMethod(const std::string &subscriptionId);
+
+	void subscribeToSignal(const std::string &subscriptionId,
+	                       const std::string &category,
+	                       const std::string &method,
+	                       SubscribeCallback callback,
+	                       const pbnjson::JSchema &schema = pbnjson::JSchema::AllSchema());
+
+	bool unsubscribeFromSignal(const std::string &subscriptionId);
+
+	void setTimeout(const std::string &timeoutId,
+	                unsigned int timeMs,
+	                bool repeat,
+	                TimeoutCallback callback);
+
+	bool cancelTimeout(const std::string &timeoutId);
+
+	void debounce(const std::string &debounceId,
+	              unsigned int delayMs,
+	              TimeoutCallback callback);
+
+	bool cancelDebounce(const std::string &debounceId);
+
+	void throttle(const std::string &throttleId,
+	              unsigned int intervalMs,
+	              TimeoutCallback callback);
+
+	bool cancelThrottle(const std::string &throttleId);
+
+	void startPolling(const std::string &pollId,
+	                  const std::string &serviceUrl,
+	                  pbnjson::JValue &params,
+	                  unsigned int minIntervalMs,
+	                  unsigned int maxIntervalMs,
+	                  SubscribeCallback callback);
+
+	bool stopPolling(const std::string &pollId);
+
+	/**
+	 * Runs on the host's own pool, the task cannot cross processes.
+	 */
+	bool runInBackground(BackgroundTask task, BackgroundCallback completion);
+
+	/**
+	 * Thread safe, the function runs on the host's main loop.
+	 */
+	void post(PostCallback callback);
+
+	std::string registerMethod(const std::string &categoryName,
+	                           const std::string &methodName,
+	                           LunaCallHandler handler,
+	                           const pbnjson::JSchema &schema = pbnjson::JSchema::AllSchema());
+
+	void createToast(const std::string &message,
+	                 const std::string &iconUrl = "",
+	                 const pbnjson::JValue &onClickAction = pbnjson::JValue());
+
+	void createAlert(const std::string &alertId,
+	                 const std::string &title,
+	                 const std::string &message,
+	                 bool modal,
+	                 const std::string &iconUrl,
+	                 const pbnjson::JValue &buttons,
+	                 const pbnjson::JValue &onClose);
+
+	bool closeAlert(const std::string &alertId);
+
+	/**
+	 * Handle everything the event monitor sent, called from the main loop.
+	 */
+	void dispatch();
+
+private:
+	bool send(const pbnjson::JValue &message);
+
+	/**
+	 * Send a Manager call and wait for its result. Other messages that
+	 * arrive meanwhile are handled later from the main loop.
+	 * @throws Error if the call failed in the event monitor.
+	 */
+	pbnjson::JValue request(pbnjson::JValue message);
+
+	void handleMessage(const pbnjson::JValue &message);
+	pbnjson::JValue handleRequest(const std::string &op, const pbnjson::JValue &message);
+	void handleEvent(const std::string &op, const pbnjson::JValue &message);
+	bool instantiate(std::string &error);
+	pbnjson::JValue callMethod(const pbnjson::JValue &message);
+	void setLocale(const pbnjson::JValue &message);
+
+	/**
+	 * Run plugin code. The event monitor unloads the plugin if it throws.
+	 */
+	void invoke(const char *what, const std::function<void()> &function);
+
+	static gboolean dispatchCallback(gpointer userData);
+
+private:
+	ShmChannel *channel;
+	GMainLoop *mainLoop;
+	std::string pluginPath;
+	std::string pluginName;
+	PmLogContext pluginLogContext;
+	void *dlHandle;
+	Plugin *plugin;
+
+	std::string uiLocale;
+	pbnjson::JValue localeInfo;
+
+	int64_t nextSeq;
+	int64_t nextCallId;
+	int64_t currentOrigin; // token of the event being handled, 0 if none
+	std::deque<pbnjson::JValue> deferred;
+	guint dispatchSource;
+
+	std::unordered_map<std::string, SubscriptionState> subscriptions;
+	std::unordered_map<std::string, SubscribeCallback> polls;
+	std::unordered_map<std::string, LunaCallback> calls;
+	std::unordered_map<std::string, std::pair<TimeoutCallback, bool>> timeouts;
+	std::unordered_map<std::string, TimeoutCallback> debounces;
+	std::unordered_map<std::string, TimeoutCallback> throttles;
+
+	// Key is category/method
+	std::unordered_map<std::string, MethodState> methods;
+
+	BackgroundPool background;
+	TaskQueue *posted; // deleted before the plugin library is closed
+};
@@ -0,0 +1,89 @@
+// Copyright (c) 2015-2022 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+// Plugin host, started by the event monitor for isolated plugins.
+// Usage: event-monitor-host PLUGIN_PATH PLUGIN_NAME, with the channel
+// descriptors inherited as HOST_MEMORY_FD, HOST_TO_HOST_FD and HOST_TO_DAEMON_FD.
+
+#include <iostream>
+#include <glib.h>
+
+#include "logging.h"
+#include "config.h"
+#include "hostmanager.h"
+#include "shmring.h"
+
+static const char *LOG_CONTEXT_NAME = COMPONENT_NAME "-host";
+
+PmLogContext logContext;
+
+static gboolean receive_handler(GIOChannel *channel, GIOCondition cond,
+        gpointer user_data) {
+    HostManager *manager = reinterpret_cast<HostManager *>(user_data);
+
+    if (cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)) {
+        return FALSE;
+    }
+
+    manager->dispatch();
+    return TRUE;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " PLUGIN_PATH PLUGIN_NAME" << std::endl;
+        exit (EXIT_FAILURE);
+    }
+
+    if (PmLogGetContext(LOG_CONTEXT_NAME, &logContext) != kPmLogErr_None) {
+        std::cerr << "Failed to setup up log context " << LOG_CONTEXT_NAME
+                << std::endl;
+        abort();
+    }
+
+    ShmChannel *channel = ShmChannel::attach(HOST_CHANNEL_CAPACITY);
+
+    if (!channel) {
+        LOG_CRITICAL(MSGID_PLUGIN_HOST, 0, "Failed to attach to event monitor channel");
+        exit (EXIT_FAILURE);
+    }
+
+    GMainLoop *mainLoop = g_main_loop_new(nullptr, FALSE);
+    HostManager *manager = new HostManager(channel, mainLoop, argv[1], argv[2]);
+
+    // The channel owns the descriptor.
+    GIOChannel *ioChannel = g_io_channel_unix_new(channel->getReceiveFd());
+    g_io_channel_set_encoding(ioChannel, NULL, NULL);
+    g_io_channel_set_buffered(ioChannel, FALSE);
+
+    guint source = g_io_add_watch(ioChannel,
+            static_cast<GIOCondition>(G_IO_IN | G_IO_HUP | G_IO_ERR
+                    | G_IO_NVAL), receive_handler, manager);
+    g_io_channel_unref(ioChannel);
+
+    // Messages may have arrived before the watch.
+    manager->dispatch();
+
+    // Runs until the event monitor stops the host, or init fails.
+    g_main_loop_run(mainLoop);
+
+    g_source_remove(source);
+    delete manager;
+    delete channel;
+    g_main_loop_unref(mainLoop);
+
+    return EXIT_FAILURE;
+}
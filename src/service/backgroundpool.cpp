@@ -0,0 +1,237 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+#include <exception>
+
+#include "backgroundpool.h"
+#include "logging.h"
+#include "utils.h"
+
+BackgroundPool::BackgroundPool(unsigned int maxThreads, unsigned int _maxOwnerTasks):
+	threads(nullptr),
+	maxOwnerTasks(_maxOwnerTasks),
+	completions(g_main_context_default())
+{
+	GError *error = nullptr;
+	this->threads = g_thread_pool_new(BackgroundPool::work, this, maxThreads, FALSE, &error);
+
+	if (error)
+	{
+		LOG_ERROR(MSGID_PLUGIN_BACKGROUND, 0, "Failed to create background pool: %s",
+		          error->message);
+		g_error_free(error);
+		this->threads = nullptr;
+	}
+}
+
+BackgroundPool::~BackgroundPool()
+{
+	if (this->threads)
+	{
+		// Drop queued turns, wait for the running tasks.
+		g_thread_pool_free(this->threads, TRUE, TRUE);
+		this->threads = nullptr;
+	}
+
+	for (auto &owner : this->owners)
+	{
+		for (Job *job : owner.second.jobs)
+		{
+			delete job;
+		}
+	}
+
+	this->owners.clear();
+	this->ready.clear();
+}
+
+bool BackgroundPool::submit(const void *owner, Task task, Completion completion)
+{
+	if (!this->threads)
+	{
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		OwnerState &state = this->owners[owner];
+
+		if (state.jobs.size() >= this->maxOwnerTasks)
+		{
+			return false;
+		}
+
+		Job *job = new Job();
+		job->owner = owner;
+		job->task = std::move(task);
+		job->completion = std::move(completion);
+		job->cancelled = false;
+
+		if (state.queued.empty())
+		{
+			this->ready.push_back(owner);
+		}
+
+		state.queued.push_back(job);
+		state.jobs.insert(job);
+	}
+
+	// One turn per job, the worker picks whose job it runs.
+	(void) g_thread_pool_push(this->threads, this, nullptr);
+	return true;
+}
+
+void BackgroundPool::cancel(const void *owner)
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+	auto found = this->owners.find(owner);
+
+	if (found == this->owners.end())
+	{
+		return;
+	}
+
+	OwnerState &state = found->second;
+
+	for (Job *job : state.queued)
+	{
+		state.jobs.erase(job);
+		delete job;
+	}
+
+	state.queued.clear();
+	this->ready.erase(std::remove(this->ready.begin(), this->ready.end(), owner),
+	                  this->ready.end());
+
+	// The task may be plugin code, the plugin library must stay until it returns.
+	this->finished.wait(lock, [&state]()
+	{
+		return state.running == 0;
+	});
+
+	// The rest are waiting to complete, drop the plugin's callbacks now.
+	for (Job *job : state.jobs)
+	{
+		job->cancelled = true;
+		job->completion = nullptr;
+	}
+
+	if (state.jobs.empty())
+	{
+		this->owners.erase(found);
+	}
+}
+
+unsigned int BackgroundPool::getPendingCount(const void *owner)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto found = this->owners.find(owner);
+
+	return found == this->owners.end() ? 0 : found->second.jobs.size();
+}
+
+void BackgroundPool::work(gpointer data UNUSED_VAR, gpointer userData)
+{
+	auto pool = reinterpret_cast<BackgroundPool *>(userData);
+	Job *job = nullptr;
+	Task task;
+
+	{
+		std::lock_guard<std::mutex> lock(pool->mutex);
+
+		if (pool->ready.empty())
+		{
+			// Turn of a cancelled job.
+			return;
+		}
+
+		const void *owner = pool->ready.front();
+		pool->ready.pop_front();
+
+		OwnerState &state = pool->owners.at(owner);
+		job = state.queued.front();
+		state.queued.pop_front();
+		state.running++;
+
+		if (!state.queued.empty())
+		{
+			pool->ready.push_back(owner);
+		}
+
+		task = std::move(job->task);
+	}
+
+	try
+	{
+		task();
+	}
+	catch (const std::exception &e)
+	{
+		job->error = *e.what() ? e.what() : "exception";
+	}
+	catch (...)
+	{
+		job->error = "unknown exception";
+	}
+
+	// Destroyed here while the plugin is still guaranteed to be loaded.
+	task = nullptr;
+
+	{
+		std::lock_guard<std::mutex> lock(pool->mutex);
+		pool->owners.at(job->owner).running--;
+		pool->finished.notify_all();
+	}
+
+	pool->completions.post([pool, job]()
+	{
+		pool->complete(job);
+	});
+}
+
+void BackgroundPool::complete(Job *job)
+{
+	Completion completion;
+
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto found = this->owners.find(job->owner);
+
+		if (found != this->owners.end())
+		{
+			found->second.jobs.erase(job);
+
+			if (found->second.jobs.empty() && found->second.running == 0)
+			{
+				this->owners.erase(found);
+			}
+		}
+
+		if (!job->cancelled)
+		{
+			completion = std::move(job->completion);
+		}
+	}
+
+	std::string error = job->error;
+	delete job;
+
+	if (completion)
+	{
+		completion(error);
+	}
+}
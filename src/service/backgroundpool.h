@@ -0,0 +1,116 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <glib.h>
+
+#include "taskqueue.h"
+
+// Limits for Manager::runInBackground.
+const unsigned int MAX_BACKGROUND_THREADS = 4;
+const unsigned int MAX_PLUGIN_BACKGROUND_TASKS = 16;
+
+/**
+ * Bounded pool of worker threads for plugin background tasks, see
+ * Manager::runInBackground.
+ * Each owner, normally a plugin adapter, has its own queue and the workers
+ * take turns between the owners, so a plugin queueing many tasks does not
+ * hold up the others. Everything but the tasks runs on the main loop.
+ */
+class BackgroundPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	/**
+	 * Called on the main loop once the task has run.
+	 * @param error - empty if the task returned, otherwise what it threw.
+	 */
+	typedef std::function<void(const std::string &error)> Completion;
+
+	/**
+	 * @param maxThreads - number of worker threads.
+	 * @param maxOwnerTasks - limit of pending tasks per owner.
+	 */
+	BackgroundPool(unsigned int maxThreads, unsigned int maxOwnerTasks);
+
+	/**
+	 * Drops queued tasks and waits for the running ones.
+	 */
+	~BackgroundPool();
+
+	BackgroundPool(const BackgroundPool &) = delete;
+	BackgroundPool &operator=(const BackgroundPool &) = delete;
+
+	/**
+	 * @return false if the owner already has maxOwnerTasks tasks pending.
+	 */
+	bool submit(const void *owner, Task task, Completion completion);
+
+	/**
+	 * Drop the owner's queued tasks and pending completions.
+	 * Waits for the owner's tasks that are already running.
+	 */
+	void cancel(const void *owner);
+
+	/**
+	 * Tasks of the owner that are queued, running or waiting to complete.
+	 */
+	unsigned int getPendingCount(const void *owner);
+
+private:
+	struct Job
+	{
+		const void *owner;
+		Task task;
+		Completion completion;
+		std::string error;
+		bool cancelled; // main thread only
+	};
+
+	struct OwnerState
+	{
+		OwnerState():
+			running(0)
+		{};
+
+		std::deque<Job *> queued;
+		std::unordered_set<Job *> jobs; // all pending jobs
+		unsigned int running;
+	};
+
+	static void work(gpointer data, gpointer userData);
+	void complete(Job *job);
+
+private:
+	GThreadPool *threads;
+	unsigned int maxOwnerTasks;
+	TaskQueue completions;
+
+	// Guards owners and ready, tasks run without it.
+	std::mutex mutex;
+	std::condition_variable finished;
+	std::unordered_map<const void *, OwnerState> owners;
+	std::deque<const void *> ready; // owners with queued jobs, in turn order
+};
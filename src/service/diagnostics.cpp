@@ -0,0 +1,341 @@
+// Copyright (c) 2015-2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+
+#include "diagnostics.h"
+#include "logging.h"
+#include "config.h"
+
+using namespace pbnjson;
+
+static const char *METRICS_SUBSCRIPTION = "getMetrics";
+static const unsigned int DEFAULT_METRICS_INTERVAL = 10; // seconds
+static const unsigned int MAX_METRICS_INTERVAL = 3600; // seconds
+static const int DEFAULT_SYNC_CALL_LIMIT = 20;
+static const char *FLIGHT_DUMP_PATH = WEBOS_EVENT_MONITOR_RUNTIME_PATH "/flightrecorder.dump";
+static const char *TRACE_PATH = WEBOS_EVENT_MONITOR_RUNTIME_PATH "/trace.json";
+
+static const struct
+{
+	const char *name;
+	int level;
+} LOG_LEVELS[] =
+{
+	{"none", kPmLogLevel_None},
+	{"emerg", kPmLogLevel_Emergency},
+	{"alert", kPmLogLevel_Alert},
+	{"crit", kPmLogLevel_Critical},
+	{"err", kPmLogLevel_Error},
+	{"warning", kPmLogLevel_Warning},
+	{"notice", kPmLogLevel_Notice},
+	{"info", kPmLogLevel_Info},
+	{"debug", kPmLogLevel_Debug},
+};
+
+static JValue errorResponse(int errorCode, const std::string &errorMessage)
+{
+	return JObject{{"returnValue", false},
+	               {"errorCode", errorCode},
+	               {"errorMessage", errorMessage}};
+}
+
+Diagnostics::Diagnostics(LunaService &_service, PluginLoader &_loader,
+                         PluginManager &_manager, ServiceMonitor &_monitor,
+                         MemoryPressure &_pressure, StallWatchdog &_watchdog,
+                         FlightRecorder &_recorder, Tracer &_tracer):
+	service(_service),
+	loader(_loader),
+	manager(_manager),
+	monitor(_monitor),
+	pressure(_pressure),
+	watchdog(_watchdog),
+	recorder(_recorder),
+	tracer(_tracer),
+	metricsTimer(0),
+	metricsInterval(0)
+{
+	this->service.registerServiceMethod(
+	    "/",
+	    "getDiagnostics",
+	    std::bind(&Diagnostics::getDiagnostics, this,
+	              std::placeholders::_1, std::placeholders::_2));
+
+	this->service.registerServiceMethod(
+	    "/",
+	    "setLogLevel",
+	    std::bind(&Diagnostics::setLogLevel, this,
+	              std::placeholders::_1, std::placeholders::_2));
+
+	this->service.registerServiceMethod(
+	    "/",
+	    "getMetrics",
+	    std::bind(&Diagnostics::getMetrics, this,
+	              std::placeholders::_1, std::placeholders::_2));
+
+	this->service.registerServiceMethod(
+	    "/",
+	    "getSyncCalls",
+	    std::bind(&Diagnostics::getSyncCalls, this,
+	              std::placeholders::_1, std::placeholders::_2));
+
+	this->service.registerServiceMethod(
+	    "/",
+	    "dumpFlightRecorder",
+	    std::bind(&Diagnostics::dumpFlightRecorder, this,
+	              std::placeholders::_1, std::placeholders::_2));
+
+	this->service.registerServiceMethod(
+	    "/",
+	    "setTracing",
+	    std::bind(&Diagnostics::setTracing, this,
+	              std::placeholders::_1, std::placeholders::_2));
+}
+
+Diagnostics::~Diagnostics()
+{
+	if (this->metricsTimer)
+	{
+		g_source_remove(this->metricsTimer);
+	}
+}
+
+/**
+ * Returns internal state and statistics of the service.
+ */
+JValue Diagnostics::getDiagnostics(LS::Message &request, const JValue &params)
+{
+	return JObject{{"returnValue", true},
+	               {"moduleCache", this->loader.getModuleCacheStats()},
+	               {"serviceStatus", this->monitor.getServiceStats()},
+	               {"startup", this->monitor.getStartupTimeline()},
+	               {"startupScheduler", this->monitor.getSchedulerStats()},
+	               {"memoryPressure", this->pressure.getStats()},
+	               {"pluginQueues", this->manager.getQueueStats()},
+	               {"mainLoopStalls", this->watchdog.getStats()},
+	               {"flightRecorder", this->recorder.getStats()},
+	               {"notificationLatency", this->manager.getNotificationLatency()}};
+}
+
+/**
+ * Changes log level of the service or of a single plugin.
+ * Params: {"level": "debug", "plugin": "name"}. Omit plugin to change
+ * the level of the service itself.
+ */
+JValue Diagnostics::setLogLevel(LS::Message &request, const JValue &params)
+{
+	std::string levelStr;
+	std::string pluginName;
+
+	if (params["level"].asString(levelStr))
+	{
+		return errorResponse(1, "Missing level");
+	}
+
+	int level = kPmLogLevel_None;
+	bool levelFound = false;
+
+	for (const auto &entry : LOG_LEVELS)
+	{
+		if (levelStr == entry.name)
+		{
+			level = entry.level;
+			levelFound = true;
+			break;
+		}
+	}
+
+	if (!levelFound)
+	{
+		return errorResponse(2, "Unknown level " + levelStr);
+	}
+
+	PmLogContext context = ::logContext;
+
+	if (!params["plugin"].asString(pluginName))
+	{
+		bool pluginFound = false;
+
+		for (const PluginInfo &info : *this->loader.getPlugins())
+		{
+			if (info.name == pluginName && !info.removed)
+			{
+				pluginFound = true;
+				break;
+			}
+		}
+
+		if (!pluginFound)
+		{
+			return errorResponse(3, "Unknown plugin " + pluginName);
+		}
+
+		// Same context the plugin adapter gets for the plugin.
+		const std::string name = std::string(COMPONENT_NAME) + "-" + pluginName;
+
+		if (PmLogGetContext(name.c_str(), &context) != kPmLogErr_None)
+		{
+			return errorResponse(4, "Failed to get log context " + name);
+		}
+	}
+
+	if (PmLogSetContextLevel(context, level) != kPmLogErr_None)
+	{
+		return errorResponse(5, "Failed to set log level");
+	}
+
+	LOG_INFO(MSGID_LOG_LEVEL_CHANGED, 0, "Log level of %s set to %s",
+	         pluginName.empty() ? COMPONENT_NAME : pluginName.c_str(),
+	         levelStr.c_str());
+
+	return JObject{{"returnValue", true}};
+}
+
+/**
+ * Returns callback latencies, bus usage and active resources of each plugin.
+ * Params: {"subscribe": true, "interval": 10}. Subscribers get the metrics
+ * again every interval seconds, the shortest interval asked for is used.
+ */
+JValue Diagnostics::getMetrics(LS::Message &request, const JValue &params)
+{
+	JValue response = JObject{{"returnValue", true},
+	                          {"plugins", this->manager.getMetrics()}};
+
+	if (!request.isSubscription())
+	{
+		return response;
+	}
+
+	int interval = DEFAULT_METRICS_INTERVAL;
+
+	if (params.hasKey("interval") && params["interval"].asNumber(interval))
+	{
+		return errorResponse(1, "Invalid interval");
+	}
+
+	interval = std::max(1, std::min(interval, static_cast<int>(MAX_METRICS_INTERVAL)));
+
+	if (!this->service.addSubscriber(METRICS_SUBSCRIPTION, request))
+	{
+		return errorResponse(2, "Failed to subscribe");
+	}
+
+	if (!this->metricsTimer || static_cast<unsigned int>(interval) < this->metricsInterval)
+	{
+		if (this->metricsTimer)
+		{
+			g_source_remove(this->metricsTimer);
+		}
+
+		this->metricsInterval = interval;
+		this->metricsTimer = g_timeout_add_seconds(interval,
+		                                           Diagnostics::metricsCallback, this);
+	}
+
+	response.put("subscribed", true);
+	return response;
+}
+
+gboolean Diagnostics::metricsCallback(gpointer userData)
+{
+	auto diagnostics = reinterpret_cast<Diagnostics *>(userData);
+	JValue payload = JObject{{"returnValue", true},
+	                         {"subscribed", true},
+	                         {"plugins", diagnostics->manager.getMetrics()}};
+
+	if (diagnostics->service.postToSubscribers(METRICS_SUBSCRIPTION, payload) > 0)
+	{
+		return G_SOURCE_CONTINUE;
+	}
+
+	diagnostics->metricsTimer = 0;
+	diagnostics->metricsInterval = 0;
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * Returns time the main loop was blocked in synchronous luna calls, callers
+ * and call targets with the longest total first.
+ * Params: {"limit": 20} - maximum number of call targets.
+ */
+JValue Diagnostics::getSyncCalls(LS::Message &request, const JValue &params)
+{
+	int limit = DEFAULT_SYNC_CALL_LIMIT;
+
+	if (params.hasKey("limit") && (params["limit"].asNumber(limit) || limit < 0))
+	{
+		return errorResponse(1, "Invalid limit");
+	}
+
+	JValue response = this->service.getSyncCallReport(limit);
+	response.put("returnValue", true);
+	return response;
+}
+
+/**
+ * Writes the flight recorder ring to a file, decode it with
+ * event-monitor-flightdecode.
+ */
+JValue Diagnostics::dumpFlightRecorder(LS::Message &request, const JValue &params)
+{
+	if (!FlightRecorder::isRecording())
+	{
+		return errorResponse(1, "Flight recorder not running");
+	}
+
+	if (!this->recorder.dump(FLIGHT_DUMP_PATH))
+	{
+		return errorResponse(2, "Failed to write flight recorder dump");
+	}
+
+	return JObject{{"returnValue", true},
+	               {"path", FLIGHT_DUMP_PATH}};
+}
+
+/**
+ * Starts or stops writing a trace of event handling in Chrome trace event
+ * format, see Tracer.
+ * Params: {"enabled": true, "maxEvents": 1000000}. Starting again
+ * replaces the previous trace.
+ */
+JValue Diagnostics::setTracing(LS::Message &request, const JValue &params)
+{
+	bool enabled = false;
+	int maxEvents = DEFAULT_TRACE_EVENTS;
+
+	if (params["enabled"].asBool(enabled))
+	{
+		return errorResponse(1, "Missing enabled");
+	}
+
+	if (params.hasKey("maxEvents") && (params["maxEvents"].asNumber(maxEvents) || maxEvents < 0))
+	{
+		return errorResponse(2, "Invalid maxEvents");
+	}
+
+	if (!enabled)
+	{
+		(void) this->tracer.stopTrace();
+	}
+	else if (!this->tracer.startTrace(TRACE_PATH, maxEvents))
+	{
+		return errorResponse(3, "Failed to create trace file");
+	}
+
+	JValue response = this->tracer.getStatus();
+	response.put("returnValue", true);
+	return response;
+}
@@ -0,0 +1,75 @@
+// Copyright (c) 2015-2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <pbnjson.hpp>
+
+#include "flightrecorder.h"
+#include "lunaservice.h"
+#include "memorypressure.h"
+#include "pluginloader.h"
+#include "pluginmanager.h"
+#include "servicemonitor.h"
+#include "stallwatchdog.h"
+#include "tracer.h"
+
+/**
+ * Luna methods of the event monitor itself, used to inspect and tune
+ * the running service.
+ */
+class Diagnostics
+{
+public:
+	Diagnostics(LunaService &service, PluginLoader &loader,
+	            PluginManager &manager, ServiceMonitor &monitor,
+	            MemoryPressure &pressure, StallWatchdog &watchdog,
+	            FlightRecorder &recorder, Tracer &tracer);
+
+	~Diagnostics();
+
+	Diagnostics(const Diagnostics &) = delete;
+	Diagnostics &operator=(const Diagnostics &) = delete;
+
+private:
+	pbnjson::JValue getDiagnostics(LS::Message &request,
+	                               const pbnjson::JValue &params);
+	pbnjson::JValue setLogLevel(LS::Message &request,
+	                            const pbnjson::JValue &params);
+	pbnjson::JValue getMetrics(LS::Message &request,
+	                           const pbnjson::JValue &params);
+	pbnjson::JValue getSyncCalls(LS::Message &request,
+	                             const pbnjson::JValue &params);
+	pbnjson::JValue dumpFlightRecorder(LS::Message &request,
+	                                   const pbnjson::JValue &params);
+	pbnjson::JValue setTracing(LS::Message &request,
+	                           const pbnjson::JValue &params);
+	static gboolean metricsCallback(gpointer userData);
+
+private:
+	LunaService &service;
+	PluginLoader &loader;
+	PluginManager &manager;
+	ServiceMonitor &monitor;
+	MemoryPressure &pressure;
+	StallWatchdog &watchdog;
+	FlightRecorder &recorder;
+	Tracer &tracer;
+
+	// Pushes metrics to getMetrics subscribers.
+	guint metricsTimer;
+	unsigned int metricsInterval; // seconds
+};
@@ -0,0 +1,98 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "eventlatency.h"
+
+using namespace pbnjson;
+
+static const std::string LUNA_PREFIX = "luna://";
+static const EventOrigin NO_ORIGIN;
+static thread_local const EventOrigin *currentOrigin = nullptr;
+
+EventOrigin::EventOrigin(gint64 _receivedAt, const std::string &serviceUrl,
+                         unsigned long long _flow):
+	receivedAt(_receivedAt),
+	flow(_flow)
+{
+	// luna://com.webos.service.foo/method -> com.webos.service.foo
+	size_t start = serviceUrl.compare(0, LUNA_PREFIX.size(), LUNA_PREFIX) == 0 ?
+	               LUNA_PREFIX.size() : 0;
+	size_t end = serviceUrl.find('/', start);
+	this->source = serviceUrl.substr(start, end == std::string::npos ? end : end - start);
+}
+
+EventOrigin::Scope::Scope(const EventOrigin &origin):
+	previous(currentOrigin),
+	flowScope(origin.flow)
+{
+	currentOrigin = &origin;
+}
+
+EventOrigin::Scope::~Scope()
+{
+	currentOrigin = this->previous;
+}
+
+const EventOrigin &EventOrigin::current()
+{
+	return currentOrigin ? *currentOrigin : NO_ORIGIN;
+}
+
+EventOrigin EventOrigin::capture()
+{
+	EventOrigin origin = EventOrigin::current();
+	// A method call has a flow but no origin.
+	origin.flow = Tracer::currentFlow();
+	return origin;
+}
+
+void NotificationLatency::record(const std::string &plugin, const char *kind,
+                                 const EventOrigin &origin)
+{
+	gint64 latencyUs = g_get_monotonic_time() - origin.receivedAt;
+
+	this->all.record(latencyUs);
+	this->kinds[kind].record(latencyUs);
+	this->plugins[plugin].record(latencyUs);
+	this->sources[origin.source].record(latencyUs);
+}
+
+JValue NotificationLatency::toJson() const
+{
+	JValue kindStats = JObject();
+	JValue pluginStats = JObject();
+	JValue sourceStats = JObject();
+
+	for (const auto &entry : this->kinds)
+	{
+		kindStats.put(entry.first, entry.second.toJson());
+	}
+
+	for (const auto &entry : this->plugins)
+	{
+		pluginStats.put(entry.first, entry.second.toJson());
+	}
+
+	for (const auto &entry : this->sources)
+	{
+		sourceStats.put(entry.first, entry.second.toJson());
+	}
+
+	return JObject{{"all", this->all.toJson()},
+	               {"kinds", kindStats},
+	               {"plugins", pluginStats},
+	               {"sources", sourceStats}};
+}
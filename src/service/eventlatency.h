@@ -0,0 +1,102 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <glib.h>
+#include <pbnjson.hpp>
+
+#include "pluginmetrics.h"
+#include "tracer.h"
+
+/**
+ * Bus reply that started the plugin callbacks running on this thread.
+ * Carried along to one-shot timers, background completions, plugin
+ * threads and plugin hosts, so notifications can be traced back to the
+ * service event. Also carries the trace flow of the callbacks.
+ */
+class EventOrigin
+{
+public:
+	EventOrigin():
+		receivedAt(0),
+		flow(0)
+	{};
+
+	EventOrigin(gint64 _receivedAt, const std::string &serviceUrl,
+	            unsigned long long _flow = 0);
+
+	/**
+	 * Makes origin the current one on this thread for the life of the
+	 * object, and its flow the current trace flow. Origin must outlive it.
+	 */
+	class Scope
+	{
+	public:
+		Scope(const EventOrigin &origin);
+		~Scope();
+
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+
+	private:
+		const EventOrigin *previous;
+		Tracer::FlowScope flowScope;
+	};
+
+	inline bool isSet() const
+	{
+		return this->receivedAt != 0;
+	}
+
+	/**
+	 * Origin of the callback running on this thread, unset if none.
+	 */
+	static const EventOrigin &current();
+
+	/**
+	 * Copy of the current origin with the current trace flow, to run
+	 * callbacks later or on another thread under.
+	 */
+	static EventOrigin capture();
+
+	gint64 receivedAt; // monotonic, us
+	std::string source; // service name
+	unsigned long long flow; // trace flow, 0 for none
+};
+
+/**
+ * Time from a bus reply arriving to the toast or alert a plugin created
+ * because of it. Main thread only.
+ */
+class NotificationLatency
+{
+public:
+	/**
+	 * @param kind - "toast" or "alert".
+	 */
+	void record(const std::string &plugin, const char *kind, const EventOrigin &origin);
+
+	pbnjson::JValue toJson() const;
+
+private:
+	PercentileHistogram all;
+	std::unordered_map<std::string, PercentileHistogram> kinds;
+	std::unordered_map<std::string, PercentileHistogram> plugins;
+	std::unordered_map<std::string, PercentileHistogram> sources;
+};
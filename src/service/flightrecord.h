@@ -0,0 +1,70 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// Flight recorder dump format, shared by the event monitor and the decoder.
+// A dump is a FlightDumpHeader, stringBytes of interned strings and
+// capacity FlightRecords, all in host byte order.
+
+#include <cstdint>
+
+const char FLIGHT_DUMP_MAGIC[8] = {'E', 'M', 'F', 'L', 'I', 'G', 'H', 'T'};
+const uint32_t FLIGHT_DUMP_VERSION = 2;
+
+// Interned string ids. Strings are stored as uint16_t length and the bytes,
+// the id is the offset of the length.
+const uint32_t FLIGHT_NO_STRING = 0xFFFFFFFF;
+// Set in ids of dynamic strings, such as timeout ids, which are not stored.
+// The low bits are a hash of the string.
+const uint32_t FLIGHT_HASHED_STRING = 0x80000000;
+
+enum FlightEvent
+{
+	FLIGHT_REPLY = 1, // detail: service url, value: payload bytes
+	FLIGHT_CALLBACK_START, // detail: callback, value: callback kind
+	FLIGHT_CALLBACK_END, // value: duration in us
+	FLIGHT_TIMER, // detail: hashed timeout id
+	FLIGHT_PLUGIN_LOAD,
+	FLIGHT_PLUGIN_UNLOAD,
+};
+
+struct FlightRecord
+{
+	uint64_t time; // monotonic, us
+	// Low bits of the record number plus one, 0 while being written.
+	uint32_t sequence;
+	uint16_t event;
+	uint16_t reserved;
+	uint32_t plugin; // interned name
+	uint32_t detail; // interned or hashed
+	uint64_t value;
+};
+
+struct FlightDumpHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t recordSize;
+	uint32_t capacity;
+	uint32_t stringBytes;
+	uint64_t head; // number of records written so far
+	// Clocks when dumped, to convert record times to wall clock time.
+	uint64_t monotonicTime; // us
+	uint64_t realTime; // us since the epoch
+	int32_t signal; // fatal signal, 0 if dumped on request
+	uint32_t reserved;
+};
@@ -0,0 +1,357 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <glib.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "flightrecorder.h"
+#include "logging.h"
+
+using namespace pbnjson;
+
+static const int FATAL_SIGNALS[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+FlightRecorder *FlightRecorder::instance = nullptr;
+
+// Only async-signal-safe calls below, these also run in the signal handler.
+
+static uint64_t clockUs(clockid_t clock)
+{
+	struct timespec now;
+	clock_gettime(clock, &now);
+	return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+static bool writeAll(int fd, const void *data, size_t size)
+{
+	const char *position = static_cast<const char *>(data);
+
+	while (size > 0)
+	{
+		ssize_t written = write(fd, position, size);
+
+		if (written < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (written <= 0)
+		{
+			return false;
+		}
+
+		position += written;
+		size -= written;
+	}
+
+	return true;
+}
+
+bool FlightRecorder::writeDump(int fd, int signal)
+{
+	FlightDumpHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, FLIGHT_DUMP_MAGIC, sizeof(header.magic));
+	header.version = FLIGHT_DUMP_VERSION;
+	header.recordSize = sizeof(FlightRecord);
+	header.capacity = this->capacity;
+	header.stringBytes = this->stringBytes.load(std::memory_order_acquire);
+	header.head = this->head.load(std::memory_order_acquire);
+	header.monotonicTime = clockUs(CLOCK_MONOTONIC);
+	header.realTime = clockUs(CLOCK_REALTIME);
+	header.signal = signal;
+
+	return writeAll(fd, &header, sizeof(header)) &&
+	       writeAll(fd, this->strings, header.stringBytes) &&
+	       writeAll(fd, this->records, sizeof(FlightRecord) * this->capacity);
+}
+
+void FlightRecorder::fatalSignal(int signal)
+{
+	FlightRecorder *recorder = FlightRecorder::instance;
+
+	if (recorder)
+	{
+		int fd = open(recorder->crashPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+		if (fd >= 0)
+		{
+			(void) recorder->writeDump(fd, signal);
+			close(fd);
+		}
+	}
+
+	// The handler was reset, this terminates with the default action.
+	raise(signal);
+}
+
+FlightRecorder::FlightRecorder():
+	records(nullptr),
+	capacity(0),
+	head(0),
+	strings(nullptr),
+	stringBytes(0),
+	stringCount(0),
+	stringSlots(nullptr)
+{
+}
+
+FlightRecorder::~FlightRecorder()
+{
+	if (FlightRecorder::instance == this)
+	{
+		for (int fatal : FATAL_SIGNALS)
+		{
+			(void) signal(fatal, SIG_DFL);
+		}
+
+		FlightRecorder::instance = nullptr;
+	}
+
+	delete[] this->records;
+	delete[] this->strings;
+	delete[] this->stringSlots;
+}
+
+bool FlightRecorder::start(unsigned int _capacity, const std::string &_crashPath)
+{
+	if (this->records || FlightRecorder::instance || _capacity == 0)
+	{
+		return false;
+	}
+
+	uint32_t rounded = 1;
+
+	while (rounded < _capacity && rounded < (1u << 31))
+	{
+		rounded <<= 1;
+	}
+
+	this->capacity = rounded;
+	this->records = new FlightRecord[rounded]();
+	this->strings = new char[FLIGHT_STRING_BYTES];
+	this->stringSlots = new std::atomic<uint32_t>[FLIGHT_STRING_SLOTS]();
+	this->crashPath = _crashPath;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = FlightRecorder::fatalSignal;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESETHAND | SA_NODEFER;
+
+	for (int fatal : FATAL_SIGNALS)
+	{
+		if (sigaction(fatal, &action, nullptr) != 0)
+		{
+			LOG_WARNING(MSGID_FLIGHT_RECORDER, 0, "Failed to set handler for signal %d", fatal);
+		}
+	}
+
+	FlightRecorder::instance = this;
+
+	LOG_INFO(MSGID_FLIGHT_RECORDER, 0, "Recording last %u events, crash dump %s",
+	         this->capacity, this->crashPath.c_str());
+	return true;
+}
+
+void FlightRecorder::record(FlightEvent event, uint32_t plugin, uint32_t detail,
+                            uint64_t value)
+{
+	FlightRecorder *recorder = FlightRecorder::instance;
+
+	if (!recorder)
+	{
+		return;
+	}
+
+	uint64_t number = recorder->head.fetch_add(1, std::memory_order_relaxed);
+	FlightRecord &record = recorder->records[number & (recorder->capacity - 1)];
+
+	// A dump skips records whose sequence does not match their slot.
+	__atomic_store_n(&record.sequence, 0, __ATOMIC_RELAXED);
+	std::atomic_thread_fence(std::memory_order_release);
+	record.time = g_get_monotonic_time();
+	record.event = event;
+	record.plugin = plugin;
+	record.detail = detail;
+	record.value = value;
+	__atomic_store_n(&record.sequence, static_cast<uint32_t>(number + 1), __ATOMIC_RELEASE);
+}
+
+void FlightRecorder::record(FlightEvent event, const std::string &plugin,
+                            const std::string &detail, uint64_t value)
+{
+	if (!FlightRecorder::instance)
+	{
+		return;
+	}
+
+	FlightRecorder::record(event, FlightRecorder::intern(plugin),
+	                       FlightRecorder::intern(detail), value);
+}
+
+static uint32_t hashString(const char *text, size_t length)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		hash = (hash ^ static_cast<unsigned char>(text[i])) * 16777619u;
+	}
+
+	return hash;
+}
+
+/**
+ * @return id of text, FLIGHT_NO_STRING if not interned.
+ */
+uint32_t FlightRecorder::findString(const std::string &text, uint32_t textHash)
+{
+	size_t length = std::min(text.size(), FLIGHT_MAX_STRING);
+
+	for (uint32_t slot = textHash & (FLIGHT_STRING_SLOTS - 1);;
+	        slot = (slot + 1) & (FLIGHT_STRING_SLOTS - 1))
+	{
+		uint32_t entry = this->stringSlots[slot].load(std::memory_order_acquire);
+
+		if (entry == 0)
+		{
+			return FLIGHT_NO_STRING;
+		}
+
+		uint32_t offset = entry - 1;
+		uint16_t storedLength;
+		memcpy(&storedLength, this->strings + offset, sizeof(storedLength));
+
+		if (storedLength == length &&
+		        memcmp(this->strings + offset + sizeof(storedLength), text.data(), length) == 0)
+		{
+			return offset;
+		}
+	}
+}
+
+uint32_t FlightRecorder::intern(const std::string &text)
+{
+	FlightRecorder *recorder = FlightRecorder::instance;
+
+	if (!recorder || text.empty())
+	{
+		return FLIGHT_NO_STRING;
+	}
+
+	// Longer strings are stored truncated, look them up the same way.
+	uint16_t length = static_cast<uint16_t>(std::min(text.size(), FLIGHT_MAX_STRING));
+	uint32_t textHash = hashString(text.data(), length);
+	uint32_t found = recorder->findString(text, textHash);
+
+	if (found != FLIGHT_NO_STRING)
+	{
+		return found;
+	}
+
+	std::lock_guard<std::mutex> lock(recorder->internMutex);
+
+	// Another thread could have added it meanwhile.
+	found = recorder->findString(text, textHash);
+
+	if (found != FLIGHT_NO_STRING)
+	{
+		return found;
+	}
+
+	uint32_t offset = recorder->stringBytes.load(std::memory_order_relaxed);
+
+	if (offset + sizeof(length) + length > FLIGHT_STRING_BYTES)
+	{
+		return FLIGHT_NO_STRING;
+	}
+
+	memcpy(recorder->strings + offset, &length, sizeof(length));
+	memcpy(recorder->strings + offset + sizeof(length), text.data(), length);
+	recorder->stringBytes.store(offset + sizeof(length) + length, std::memory_order_release);
+	recorder->stringCount.fetch_add(1, std::memory_order_relaxed);
+
+	uint32_t slot = textHash & (FLIGHT_STRING_SLOTS - 1);
+
+	while (recorder->stringSlots[slot].load(std::memory_order_relaxed) != 0)
+	{
+		slot = (slot + 1) & (FLIGHT_STRING_SLOTS - 1);
+	}
+
+	recorder->stringSlots[slot].store(offset + 1, std::memory_order_release);
+	return offset;
+}
+
+uint32_t FlightRecorder::hash(const std::string &text)
+{
+	if (!FlightRecorder::instance || text.empty())
+	{
+		return FLIGHT_NO_STRING;
+	}
+
+	uint32_t id = FLIGHT_HASHED_STRING | hashString(text.data(), text.size());
+	// Keep clear of FLIGHT_NO_STRING.
+	return id == FLIGHT_NO_STRING ? FLIGHT_HASHED_STRING : id;
+}
+
+bool FlightRecorder::dump(const std::string &path)
+{
+	if (!this->records)
+	{
+		return false;
+	}
+
+	std::string tempPath = path + ".tmp";
+	int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+	if (fd < 0)
+	{
+		LOG_ERROR(MSGID_FLIGHT_RECORDER, 0, "Failed to create %s: %s", tempPath.c_str(),
+		          strerror(errno));
+		return false;
+	}
+
+	bool written = this->writeDump(fd, 0);
+	written = close(fd) == 0 && written;
+
+	if (!written || rename(tempPath.c_str(), path.c_str()) != 0)
+	{
+		LOG_ERROR(MSGID_FLIGHT_RECORDER, 0, "Failed to write %s: %s", path.c_str(),
+		          strerror(errno));
+		(void) unlink(tempPath.c_str());
+		return false;
+	}
+
+	LOG_INFO(MSGID_FLIGHT_RECORDER, 0, "Flight recorder dumped to %s", path.c_str());
+	return true;
+}
+
+JValue FlightRecorder::getStats()
+{
+	return JObject{{"capacity", JValue(static_cast<int64_t>(this->capacity))},
+	               {"recorded", JValue(static_cast<int64_t>(this->head.load()))},
+	               {"strings", JValue(static_cast<int64_t>(this->stringCount.load()))},
+	               {"stringBytes", JValue(static_cast<int64_t>(this->stringBytes.load()))}};
+}
@@ -0,0 +1,116 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <pbnjson.hpp>
+
+#include "flightrecord.h"
+
+// Space for interned strings, strings that do not fit are recorded as none.
+const uint32_t FLIGHT_STRING_BYTES = 64 * 1024;
+const size_t FLIGHT_MAX_STRING = 255;
+// Lookup slots, more than the strings that fit, so the table never fills.
+const uint32_t FLIGHT_STRING_SLOTS = 32 * 1024;
+
+/**
+ * Fixed size ring of compact event records, kept in memory at all times
+ * and written to a file on fatal signals or on request.
+ * Any thread can record, claiming a slot is a single atomic increment.
+ * Decode dumps with event-monitor-flightdecode.
+ * Only one recorder can run at a time.
+ */
+class FlightRecorder
+{
+public:
+	FlightRecorder();
+
+	/**
+	 * Removes the fatal signal handlers.
+	 */
+	~FlightRecorder();
+
+	FlightRecorder(const FlightRecorder &) = delete;
+	FlightRecorder &operator=(const FlightRecorder &) = delete;
+
+	/**
+	 * Start recording and dump to crashPath on fatal signals.
+	 * @param capacity - records kept, rounded up to a power of two.
+	 */
+	bool start(unsigned int capacity, const std::string &crashPath);
+
+	/**
+	 * Write the ring to path.
+	 */
+	bool dump(const std::string &path);
+
+	pbnjson::JValue getStats();
+
+	static inline bool isRecording()
+	{
+		return FlightRecorder::instance != nullptr;
+	}
+
+	/**
+	 * Does nothing unless a recorder is running.
+	 * @param plugin, detail - interned ids, see intern.
+	 */
+	static void record(FlightEvent event, uint32_t plugin,
+	                   uint32_t detail = FLIGHT_NO_STRING, uint64_t value = 0);
+
+	static void record(FlightEvent event, const std::string &plugin,
+	                   const std::string &detail = std::string(), uint64_t value = 0);
+
+	/**
+	 * For static names only, such as plugin names and service urls, the
+	 * space is never reclaimed. Lookup of known strings takes no lock.
+	 * @return id of the string in the dump, FLIGHT_NO_STRING for empty
+	 * strings or when out of space.
+	 */
+	static uint32_t intern(const std::string &text);
+
+	/**
+	 * For dynamic ids, such as timeout ids. Only a hash of the string
+	 * is recorded.
+	 */
+	static uint32_t hash(const std::string &text);
+
+private:
+	static void fatalSignal(int signal);
+	bool writeDump(int fd, int signal);
+	uint32_t findString(const std::string &text, uint32_t textHash);
+
+private:
+	static FlightRecorder *instance;
+
+	FlightRecord *records;
+	uint32_t capacity;
+	std::atomic<uint64_t> head;
+
+	// Strings are appended, never changed, so a dump needs no lock.
+	char *strings;
+	std::atomic<uint32_t> stringBytes;
+	std::atomic<uint32_t> stringCount;
+	// Open addressing by string hash, string id plus one, 0 if free.
+	// Slots are only set, under internMutex.
+	std::atomic<uint32_t> *stringSlots;
+	std::mutex internMutex;
+
+	std::string crashPath;
+};
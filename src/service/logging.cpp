@@ -0,0 +1,33 @@
+// Copyright (c) 2015-2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "logging.h"
+
+using namespace EventMonitor;
+
+static std::unordered_map<std::string, LogRateLimiter> rateLimiters;
+// Plugin loader logs from worker threads.
+static std::mutex rateLimitersMutex;
+
+bool isLogAllowed(const char *msgid)
+{
+	std::lock_guard<std::mutex> lock(rateLimitersMutex);
+	return rateLimiters[msgid].allow(::logContext, msgid);
+}
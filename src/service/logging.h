@@ -18,23 +18,50 @@
 #pragma once
 
 #include <PmLogLib.h>
+#include <event-monitor-api/loghelpers.hpp>
 
 extern PmLogContext logContext;
 
+/**
+ * Returns true if message with the given id may be logged now.
+ * Errors and warnings are rate limited per message id, the number of
+ * suppressed messages is logged once the message id is allowed again.
+ */
+bool isLogAllowed(const char *msgid);
+
+// Arguments are only evaluated if the level is enabled for the context.
+
 #define LOG_CRITICAL(msgid, kvcount, ...) \
-    PmLogCritical(::logContext, msgid, kvcount, ##__VA_ARGS__)
+    do { \
+        if (EventMonitor::isLogLevelEnabled(::logContext, kPmLogLevel_Critical)) \
+            PmLogCritical(::logContext, msgid, kvcount, ##__VA_ARGS__); \
+    } while (0)
 
 #define LOG_ERROR(msgid, kvcount, ...) \
-    PmLogError(::logContext, msgid, kvcount,##__VA_ARGS__)
+    do { \
+        if (EventMonitor::isLogLevelEnabled(::logContext, kPmLogLevel_Error) && \
+                isLogAllowed(msgid)) \
+            PmLogError(::logContext, msgid, kvcount, ##__VA_ARGS__); \
+    } while (0)
 
 #define LOG_WARNING(msgid, kvcount, ...) \
-    PmLogWarning(::logContext, msgid, kvcount, ##__VA_ARGS__)
+    do { \
+        if (EventMonitor::isLogLevelEnabled(::logContext, kPmLogLevel_Warning) && \
+                isLogAllowed(msgid)) \
+            PmLogWarning(::logContext, msgid, kvcount, ##__VA_ARGS__); \
+    } while (0)
 
 #define LOG_INFO(msgid, kvcount, ...) \
-    PmLogInfo(::logContext, msgid, kvcount, ##__VA_ARGS__)
+    do { \
+        if (EventMonitor::isLogLevelEnabled(::logContext, kPmLogLevel_Info)) \
+            PmLogInfo(::logContext, msgid, kvcount, ##__VA_ARGS__); \
+    } while (0)
 
 #define LOG_DEBUG(fmt, ...) \
-    PmLogDebug(::logContext, "%s:%s() " fmt, __FILE__, __FUNCTION__, ##__VA_ARGS__)
+    do { \
+        if (EventMonitor::isLogLevelEnabled(::logContext, kPmLogLevel_Debug)) \
+            PmLogDebug(::logContext, "%s:%s() " fmt, __FILE__, __FUNCTION__, ##__VA_ARGS__); \
+    } while (0)
 
 
 #define MSGID_ERROR_INTERNAL                        "INTERNAL_ERROR"
@@ -52,6 +79,8 @@ extern PmLogContext logContext;
 #define MSGID_LS2_RESPONSE_NOT_AN_OBJECT            "LS2_RESPONSE_NOT_AN_OBJECT"
 #define MSGID_LS2_FIRST_RESPONSE_ERROR              "LS2_FIRST_RESPONSE_ERROR"
 #define MSGID_LS2_CALL_NO_REPLY                     "LS2_CALL_NO_REPLY"
+#define MSGID_LS2_REPLY_PARSER                      "LS2_REPLY_PARSER"
+#define MSGID_LS2_SYNC_CALL                         "LS2_SYNC_CALL"
 
 #define MSGID_SETTINGS_LOCALE_MISSING               "SETTINGS_LOCALE_MISSING"
 
@@ -59,13 +88,26 @@ extern PmLogContext logContext;
 #define MSGID_UNLOAD_BAD_PARAMS                     "UNLOAD_BAD_PARAMS"
 
 #define MSGID_PLUGIN_LOADER                         "PLUGIN_LOADER"
+#define MSGID_PLUGIN_CACHE                          "PLUGIN_CACHE"
 #define MSGID_PLUGIN_LOAD_FAILED                    "LOAD_PLUGIN_FAILED"
+#define MSGID_PLUGIN_LAZY_ACTIVATION                "PLUGIN_LAZY_ACTIVATION"
 #define MSGID_PLUGIN_ADDED                          "PLUGIN_ADDED"
 #define MSGID_PLUGIN_LOADED                         "PLUGIN_LOADED"
 #define MSGID_PLUGIN_UNLOADED                       "PLUGIN_UNLOADED"
+#define MSGID_PLUGIN_HOST                           "PLUGIN_HOST"
+#define MSGID_PLUGIN_THREAD                         "PLUGIN_THREAD"
+#define MSGID_PLUGIN_BACKGROUND                     "PLUGIN_BACKGROUND"
+#define MSGID_PLUGIN_POLL_FAILED                    "PLUGIN_POLL_FAILED"
 
 #define MSGID_SERVICE_STATUS_ERROR                  "SERVICE_STATUS_ERROR"
 #define MSGID_SERVICE_STATUS                        "SERVICE_STATUS"
+#define MSGID_SERVICE_FLAPPING                      "SERVICE_FLAPPING"
+#define MSGID_STARTUP_TIMELINE                      "STARTUP_TIMELINE"
+#define MSGID_STATUS_SNAPSHOT                       "STATUS_SNAPSHOT"
+#define MSGID_MEMORY_PRESSURE                       "MEMORY_PRESSURE"
+#define MSGID_MAIN_LOOP_STALL                       "MAIN_LOOP_STALL"
+#define MSGID_FLIGHT_RECORDER                       "FLIGHT_RECORDER"
+#define MSGID_TRACE                                 "TRACE"
 
 #define MSGID_PLUGIN_INVALID_SUBSCRIBE              "PLUGIN_INVALID_SUBSCRIBE"
 
@@ -74,3 +116,5 @@ extern PmLogContext logContext;
 #define MSGID_LOCALE_ERROR                          "LOCALE_ERROR"
 
 #define MSGID_CREATE_ALERT_FAILED                   "CREATE_ALERT_FAILED"
+
+#define MSGID_LOG_LEVEL_CHANGED                     "LOG_LEVEL_CHANGED"
@@ -20,6 +20,10 @@
 #include "pluginadapter.h"
 #include "pluginmanager.h"
 #include "logging.h"
+#include "flightrecorder.h"
+#include "tracer.h"
+#include "stallwatchdog.h"
+#include "eventlatency.h"
 
 using namespace pbnjson;
 using namespace EventMonitor;
@@ -27,7 +31,9 @@ using namespace EventMonitor;
 LunaService::LunaService(std::string _servicePath, GMainLoop *mainLoop,
                          const char *identifier):
 	LS::Handle(_servicePath.c_str(), identifier),
-	servicePath(_servicePath)
+	servicePath(_servicePath),
+	nextSerial(1),
+	replyParser(nullptr)
 {
 	this->setDisconnectHandler(LunaService::onLunaDisconnect, this);
 	this->attachToLoop(mainLoop);
@@ -35,6 +41,10 @@ LunaService::LunaService(std::string _servicePath, GMainLoop *mainLoop,
 
 LunaService::~LunaService()
 {
+	// No more parsed replies after this.
+	delete this->replyParser;
+	this->replyParser = nullptr;
+
 	//Cleanup the subscriptions
 	for (auto i : this->subscriptions)
 	{
@@ -57,6 +67,7 @@ LunaService::~LunaService()
 
 JValue LunaService::call(const std::string &serviceUrl,
                          JValue &params,
+                         PluginAdapter *plugin,
                          unsigned long timeout)
 {
 	std::string paramsStr;
@@ -72,11 +83,17 @@ JValue LunaService::call(const std::string &serviceUrl,
 
 	LOG_DEBUG("Luna call %s params %s", serviceUrl.c_str(), paramsStr.c_str());
 
+	std::string caller = plugin ? plugin->getInfo()->name : "";
+	timeout = this->syncCalls.limitTimeout(timeout);
+	gint64 start = g_get_monotonic_time();
+
 	try
 	{
 		LS::Call call = this->callOneReply(serviceUrl.c_str(), paramsStr.c_str());
 		LS::Message reply = call.get(timeout);
 
+		this->syncCalls.record(caller, serviceUrl, g_get_monotonic_time() - start, !reply);
+
 		if (!reply)
 		{
 			LOG_ERROR(MSGID_LS2_CALL_NO_REPLY, 0, "Luna call %s has no reply within timeout %lu", serviceUrl.c_str(), timeout);
@@ -102,6 +119,7 @@ JValue LunaService::call(const std::string &serviceUrl,
 	}
 	catch (const LS::Error &error)
 	{
+		this->syncCalls.record(caller, serviceUrl, g_get_monotonic_time() - start, false);
 		LOG_ERROR(MSGID_LS2_FAILED_TO_SUBSCRIBE, 0, "Failed to call %s, params %s" ,
 		          serviceUrl.c_str(), paramsStr.c_str());
 		throw;
@@ -111,7 +129,8 @@ JValue LunaService::call(const std::string &serviceUrl,
 CallHandle LunaService::callAsync(const std::string &serviceUrl,
                                   pbnjson::JValue &params,
                                   LunaCallback callback,
-                                  PluginAdapter *plugin)
+                                  PluginAdapter *plugin,
+                                  std::function<void()> errorCallback)
 {
 	std::string paramsStr;
 
@@ -138,13 +157,14 @@ CallHandle LunaService::callAsync(const std::string &serviceUrl,
 		}
 		else
 		{
-			info = new SubscriptionInfo(JSchema::AllSchema());
+			info = this->newSubscription(JSchema::AllSchema());
 			this->subscriptions[info] = info;
 
 			info->service = this;
 			info->call = this->callMultiReply(serviceUrl.c_str(),
 			                                  paramsStr.c_str());
 			info->simpleCallback = callback;
+			info->errorCallback = errorCallback;
 			info->counter = 0;
 			info->plugin = plugin;
 			info->serviceUrl = serviceUrl;
@@ -157,6 +177,7 @@ CallHandle LunaService::callAsync(const std::string &serviceUrl,
 	{
 		LOG_ERROR(MSGID_LS2_FAILED_TO_SUBSCRIBE, 0, "Failed to call %s, params %s" ,
 		          serviceUrl.c_str(), paramsStr.c_str());
+		this->subscriptions.erase(info);
 		delete info;
 		throw;
 	}
@@ -175,6 +196,11 @@ MethodInfo* LunaService::registerMethod(PluginAdapter *plugin,
 
 	MethodInfo *info = this->findMethod(category, methodName);
 
+	if (info && info->serviceHandler)
+	{
+		throw Error("Method reserved by event monitor.");
+	}
+
 	if (info && info->plugin && info->plugin != plugin)
 	{
 		throw Error("Method already registered for different plugin. Cross-plugin method override not allowed.");
@@ -182,22 +208,7 @@ MethodInfo* LunaService::registerMethod(PluginAdapter *plugin,
 
 	if (info == nullptr)
 	{
-		/* Register new method */
-		LSMethod methods[] =
-				{
-						{
-								methodName.c_str(),
-								&LS::Handle::methodWraper<LunaService, &LunaService::methodHandler>,
-								LUNA_METHOD_FLAGS_NONE
-						},
-						nullptr
-				};
-		this->registerCategoryAppend(category.c_str(), methods, nullptr);
-		this->setCategoryData(category.c_str(), this);
-
-		info = new MethodInfo();
-		this->categoryMethods[category][methodName] = info;
-		info->url = "luna://" + this->servicePath + category + "/" + methodName;
+		info = this->addMethod(category, methodName);
 	}
 
 	info->plugin = plugin;
@@ -206,6 +217,63 @@ MethodInfo* LunaService::registerMethod(PluginAdapter *plugin,
 	return info;
 }
 
+void LunaService::registerServiceMethod(const std::string &category,
+                                        const std::string &methodName,
+                                        ServiceMethodHandler handler,
+                                        const pbnjson::JSchema &schema)
+{
+	MethodInfo *info = this->findMethod(category, methodName);
+
+	if (info == nullptr)
+	{
+		info = this->addMethod(category, methodName);
+	}
+
+	info->serviceHandler = handler;
+	info->schema = schema;
+}
+
+void LunaService::registerLazyMethod(const std::string &category,
+                                     const std::string &methodName,
+                                     std::function<void()> activator)
+{
+	MethodInfo *info = this->findMethod(category, methodName);
+
+	if (info && info->serviceHandler)
+	{
+		throw Error("Method reserved by event monitor.");
+	}
+
+	if (info == nullptr)
+	{
+		info = this->addMethod(category, methodName);
+	}
+
+	info->activator = activator;
+}
+
+MethodInfo *LunaService::addMethod(const std::string &category,
+                                   const std::string &methodName)
+{
+	/* Register new method */
+	LSMethod methods[] =
+			{
+					{
+							methodName.c_str(),
+							&LS::Handle::methodWraper<LunaService, &LunaService::methodHandler>,
+							LUNA_METHOD_FLAGS_NONE
+					},
+					nullptr
+			};
+	this->registerCategoryAppend(category.c_str(), methods, nullptr);
+	this->setCategoryData(category.c_str(), this);
+
+	MethodInfo *info = new MethodInfo();
+	this->categoryMethods[category][methodName] = info;
+	info->url = "luna://" + this->servicePath + category + "/" + methodName;
+	return info;
+}
+
 bool LunaService::methodHandler(LSMessage &msg)
 {
 	LS::Message request{&msg};
@@ -217,7 +285,15 @@ bool LunaService::methodHandler(LSMessage &msg)
 
 	MethodInfo* method = this->findMethod(categoryName, methodName);
 
-	if (!method || method->plugin == nullptr || method->handler == nullptr)
+	if (method && !method->serviceHandler && method->plugin == nullptr &&
+	        method->activator)
+	{
+		LOG_DEBUG("Activating lazy plugin for method call");
+		method->activator();
+	}
+
+	if (!method || (!method->serviceHandler &&
+	                (method->plugin == nullptr || method->handler == nullptr)))
 	{
 		/** Most likely plugin unloaded. */
 		LOG_DEBUG("No handler for method call");
@@ -238,10 +314,29 @@ bool LunaService::methodHandler(LSMessage &msg)
 		    R"({"returnValue":false, "errorCode":2, "errorMessage":"Failed to validate request against schema"})");
 		return true;
 	}
+	else if (method->serviceHandler)
+	{
+		LOG_DEBUG("Calling service method handler");
+		JValue result = method->serviceHandler(request, value);
+		request.respond(result.stringify("").c_str());
+		return true;
+	}
 	else
 	{
 		LOG_DEBUG("Calling method handler");
-		JValue result = method->handler(value);
+		method->plugin->markActive();
+		JValue result;
+
+		{
+			ScopedLatency latency(&method->plugin->getMetrics()->methods);
+			StallWatchdog::Activity activity(method->plugin->getInfo()->name, "method",
+			                                 method->url);
+			unsigned long long flow = Tracer::newFlow();
+			Tracer::FlowScope flowScope(flow);
+			Tracer::Span span("plugin", "method", method->url, flow, true);
+			result = method->handler(value);
+		}
+
 		request.respond(result.stringify("").c_str());
 
 		//FIXME: plugin unloading should be decoupled from luna service.
@@ -271,7 +366,7 @@ SubscribeHandle LunaService::subscribeToMethod(const std::string &serviceUrl,
 
 	LOG_DEBUG("Subscribing to %s params %s", serviceUrl.c_str(), paramsStr.c_str());
 
-	SubscriptionInfo *info = new SubscriptionInfo(schema);
+	SubscriptionInfo *info = this->newSubscription(schema);
 
 	try
 	{
@@ -412,46 +507,135 @@ bool LunaService::callResultHandler(LSHandle *handle UNUSED_VAR,
 bool LunaService::callResult(SubscriptionInfo *info, LSMessage *message)
 {
 	LS::Message reply{message};
+	unsigned long long flow = Tracer::newFlow();
+	Tracer::Span span("bus", "reply", info->serviceUrl, flow, true);
+
+	ParsedReply local;
+	ParsedReply *parsed = this->replyParser ? new ParsedReply() : &local;
+	parsed->owner = info;
+	parsed->serial = info->serial;
+	parsed->flow = flow;
+	parsed->receivedAt = g_get_monotonic_time();
+	parsed->status = reply.isHubError() ? REPLY_HUB_ERROR : REPLY_OK;
+	parsed->payload = reply.getPayload();
+	parsed->schema = info->schema;
+
+	if (FlightRecorder::isRecording())
+	{
+		FlightRecorder::record(FLIGHT_REPLY, info->plugin ? info->plugin->getInfo()->name : "",
+		                       info->serviceUrl, parsed->payload.size());
+	}
 
-	if (reply.isHubError())
+	if (this->replyParser)
+	{
+		// Keeps the order of the subscription's replies.
+		this->replyParser->submit(parsed, info->serial);
+		return true;
+	}
+
+	parsed->parse();
+	return this->deliverResult(info, *parsed);
+}
+
+void LunaService::parsedResult(ParsedReply &reply)
+{
+	auto info = reinterpret_cast<SubscriptionInfo *>(const_cast<void *>(reply.owner));
+
+	// Cancelled while the reply was parsed.
+	if (this->subscriptions.count(info) == 0 || info->serial != reply.serial)
+	{
+		return;
+	}
+
+	(void) this->deliverResult(info, reply);
+}
+
+bool LunaService::deliverResult(SubscriptionInfo *info, ParsedReply &reply)
+{
+	if (reply.status == REPLY_HUB_ERROR)
 	{
 		LOG_INFO(MSGID_LS2_HUB_ERROR, 0, "Luna hub error, service %s",
 		         info->serviceUrl.c_str());
-		this->cancelSubscribe(info);
+
+		if (info->simpleCallback)
+		{
+			this->callFailed(info);
+		}
+		else
+		{
+			this->cancelSubscribe(info);
+		}
+
 		return false;
 	}
 
 	LOG_DEBUG("Subscribe callback %s: %s", info->serviceUrl.c_str(),
-	          reply.getPayload());
+	          reply.payload.c_str());
 
-	JValue value = JDomParser::fromString(reply.getPayload(), JSchema::AllSchema());
-	JResult validation = info->schema.validate(value);
+	JValue &value = reply.value;
+	PluginMetrics *metrics = info->plugin ? info->plugin->getMetrics() : nullptr;
 
-	if (!value.isValid())
+	if (metrics)
+	{
+		metrics->payloadBytes += reply.payload.size();
+	}
+
+	if (reply.status == REPLY_PARSE_ERROR)
 	{
 		LOG_ERROR(MSGID_LS2_RESPONSE_PARSE_ERROR, 0, "Failed to parse luna reply: %s",
-		          reply.getPayload());
+		          reply.payload.c_str());
+
+		if (info->simpleCallback)
+		{
+			this->callFailed(info);
+			return false;
+		}
 	}
-	else if (!value.isObject())
+	else if (reply.status == REPLY_NOT_OBJECT)
 	{
 		LOG_ERROR(MSGID_LS2_RESPONSE_NOT_AN_OBJECT, 0,
-		          "Luna reply not an JSON object: %s", reply.getPayload());
+		          "Luna reply not an JSON object: %s", reply.payload.c_str());
+
+		if (info->simpleCallback)
+		{
+			this->callFailed(info);
+			return false;
+		}
 	}
-	else if (validation.isError())
+	else if (reply.status == REPLY_SCHEMA_ERROR)
 	{
 		LOG_ERROR(MSGID_LS2_RESPONSE_SCHEMA_ERROR, 0,
-		          "Failed to validate against schema: %s, schema: %s", reply.getPayload(), validation.errorString().c_str());
+		          "Failed to validate against schema: %s, schema: %s", reply.payload.c_str(),
+		          reply.schemaError.c_str());
+
+		if (metrics)
+		{
+			metrics->schemaFailures++;
+		}
+
 		return false;
 	}
 	else
 	{
 		PluginAdapter *plugin = info->plugin;
+		// Before the callbacks, they can delete info.
+		EventOrigin origin(reply.receivedAt, info->serviceUrl, reply.flow);
+
+		if (plugin)
+		{
+			plugin->markActive();
+		}
 
 		if (info->simpleCallback)
 		{
 			LunaCallback callback = info->simpleCallback;
+			StallWatchdog::Activity activity(plugin ? plugin->getInfo()->name : "",
+			                                 "call", info->serviceUrl);
+			EventOrigin::Scope originScope(origin);
+			Tracer::Span span("plugin", "call callback", info->serviceUrl, reply.flow);
 			this->cancelSubscribe(info);
 			//Callback always last as it can change the state or even delete everyting
+			ScopedLatency latency(metrics ? &metrics->subscriptions : nullptr);
 			callback(value);
 		}
 		else if (info->subscribeCallback)
@@ -460,6 +644,11 @@ bool LunaService::callResult(SubscriptionInfo *info, LSMessage *message)
 			JValue previousValue = info->previousValue;
 			info->previousValue = value;
 			//Callback always last as it can change the state or even delete info
+			ScopedLatency latency(metrics ? &metrics->subscriptions : nullptr);
+			StallWatchdog::Activity activity(plugin ? plugin->getInfo()->name : "",
+			                                 "subscription", info->serviceUrl);
+			EventOrigin::Scope originScope(origin);
+			Tracer::Span span("plugin", "subscription callback", info->serviceUrl, reply.flow);
 			info->subscribeCallback(previousValue, value);
 		}
 
@@ -474,6 +663,84 @@ bool LunaService::callResult(SubscriptionInfo *info, LSMessage *message)
 	return true;
 }
 
+/**
+ * One-shot call will not get a usable reply, drop it and tell the caller.
+ */
+void LunaService::callFailed(SubscriptionInfo *info)
+{
+	std::function<void()> errorCallback = info->errorCallback;
+	this->cancelSubscribe(info);
+
+	if (errorCallback)
+	{
+		errorCallback();
+	}
+}
+
+bool LunaService::addSubscriber(const std::string &key, LS::Message &request)
+{
+	LS::Error error;
+
+	if (!LSSubscriptionAdd(this->get(), key.c_str(), request.get(), error.get()))
+	{
+		LOG_ERROR(MSGID_LS2_FAILED_TO_SUBSCRIBE, 0, "Failed to add subscriber to %s: %s",
+		          key.c_str(), error.what());
+		return false;
+	}
+
+	return true;
+}
+
+unsigned int LunaService::postToSubscribers(const std::string &key,
+                                            const JValue &payload)
+{
+	if (LSSubscriptionGetHandleSubscribersCount(this->get(), key.c_str()) == 0)
+	{
+		return 0;
+	}
+
+	LS::Error error;
+	std::string payloadStr = payload.stringify("");
+
+	if (!LSSubscriptionReply(this->get(), key.c_str(), payloadStr.c_str(), error.get()))
+	{
+		LOG_ERROR(MSGID_LS2_FAILED_TO_SEND, 0, "Failed to post to subscribers of %s: %s",
+		          key.c_str(), error.what());
+	}
+
+	return LSSubscriptionGetHandleSubscribersCount(this->get(), key.c_str());
+}
+
+void LunaService::setSyncCallBudget(unsigned int budgetMs, bool reject)
+{
+	this->syncCalls.setBudget(budgetMs, reject);
+}
+
+JValue LunaService::getSyncCallReport(unsigned int limit)
+{
+	return this->syncCalls.getReport(limit);
+}
+
+void LunaService::setParseThreads(unsigned int threads)
+{
+	delete this->replyParser;
+	this->replyParser = nullptr;
+
+	if (threads > 0)
+	{
+		this->replyParser = new ReplyParser(threads, [this](ParsedReply &reply)
+		{
+			this->parsedResult(reply);
+		});
+	}
+}
+
+SubscriptionInfo *LunaService::newSubscription(const JSchema &schema)
+{
+	SubscriptionInfo *info = new SubscriptionInfo(schema);
+	info->serial = this->nextSerial++;
+	return info;
+}
 
 void LunaService::onLunaDisconnect(LSHandle *handle UNUSED_VAR, void *data)
 {
@@ -22,9 +22,20 @@
 
 #include <event-monitor-api/api.h>
 
+#include "replyparser.h"
+#include "synccallprofiler.h"
+
 class LunaService;
 class PluginAdapter;
 
+/**
+ * Handler for methods provided by the event monitor itself.
+ * Gets the request message to allow adding subscriptions.
+ */
+typedef std::function<pbnjson::JValue(LS::Message &request,
+                                      const pbnjson::JValue &params)>
+ServiceMethodHandler;
+
 class MethodInfo
 {
 public:
@@ -35,6 +46,9 @@ public:
 
 	PluginAdapter *plugin; // Null if plugin unloaded
 	EventMonitor::LunaCallHandler handler;
+	ServiceMethodHandler serviceHandler; // Set for event monitor own methods
+	// Set for methods of lazy plugins, loads the plugin on first call.
+	std::function<void()> activator;
 	pbnjson::JSchema schema;
 	std::string url;
 };
@@ -46,18 +60,22 @@ public:
 			service(nullptr),
 			plugin(nullptr),
 			schema(_schema),
-	        counter(0)
+	        counter(0),
+	        serial(0)
 	{};
 
 	LunaService *service;
 	PluginAdapter *plugin;
 	EventMonitor::SubscribeCallback subscribeCallback;
 	EventMonitor::LunaCallback simpleCallback;
+	// Called instead of simpleCallback if the call fails without a reply.
+	std::function<void()> errorCallback;
 	std::string serviceUrl;
 	pbnjson::JValue previousValue;
 	pbnjson::JSchema schema;
 	LS::Call call;
 	unsigned long long counter;
+	unsigned long long serial; // unique, tells replies of a reused address apart
 };
 
 typedef SubscriptionInfo *SubscribeHandle;
@@ -80,13 +98,25 @@ public:
 	LunaService(const LunaService &) = delete;
 	LunaService &operator=(const LunaService &) = delete;
 
+	/**
+	 * Blocks the main loop until the reply arrives or timeout, see
+	 * setSyncCallBudget.
+	 * @param plugin - caller, null for the event monitor itself.
+	 * @return null value on timeout.
+	 */
 	pbnjson::JValue call(const std::string &serviceUrl,
 	                     pbnjson::JValue &params,
+	                     PluginAdapter *plugin,
 	                     unsigned long timeout = 1000);
+	/**
+	 * @param errorCallback - called if the call fails with a hub error or
+	 * the reply can't be parsed, callback is not called then.
+	 */
 	CallHandle callAsync(const std::string &serviceUrl,
 	                     pbnjson::JValue &params,
 	                     EventMonitor::LunaCallback callback,
-	                     PluginAdapter *plugin);
+	                     PluginAdapter *plugin,
+	                     std::function<void()> errorCallback = nullptr);
 
 	/**
 	 * Subscribe to luna method
@@ -116,12 +146,69 @@ public:
 	                           EventMonitor::LunaCallHandler handler,
 	                           const pbnjson::JSchema &schema);
 
+	/**
+	 * Registers a method of the event monitor itself.
+	 * Plugins are not allowed to override these methods.
+	 */
+	void registerServiceMethod(const std::string &category,
+	                           const std::string &methodName,
+	                           ServiceMethodHandler handler,
+	                           const pbnjson::JSchema &schema = pbnjson::JSchema::AllSchema());
+
+	/**
+	 * Registers a placeholder for a method of a lazy plugin that is not
+	 * loaded. On call, activator is expected to load the plugin, which then
+	 * registers the actual handler with registerMethod.
+	 */
+	void registerLazyMethod(const std::string &category,
+	                        const std::string &methodName,
+	                        std::function<void()> activator);
+
+	/**
+	 * Adds the sender of a subscription request to the subscribers of key.
+	 * Subscribers are dropped by the bus when they cancel or disconnect.
+	 */
+	bool addSubscriber(const std::string &key, LS::Message &request);
+
+	/**
+	 * Sends payload to all subscribers of key.
+	 * @return number of subscribers left.
+	 */
+	unsigned int postToSubscribers(const std::string &key,
+	                               const pbnjson::JValue &payload);
+
+	/**
+	 * Parse and validate replies to calls and subscriptions on worker
+	 * threads, only the parsed replies are delivered on the main loop.
+	 * Replies of the same call keep their order.
+	 * @param threads - 0 to parse on the main loop.
+	 */
+	void setParseThreads(unsigned int threads);
+
+	/**
+	 * Log synchronous calls that block longer than budgetMs.
+	 * @param reject - also cut the call timeout to the budget, so that
+	 * slower calls fail as if they timed out.
+	 */
+	void setSyncCallBudget(unsigned int budgetMs, bool reject);
+
+	/**
+	 * Time blocked in synchronous calls, worst callers and targets first.
+	 */
+	pbnjson::JValue getSyncCallReport(unsigned int limit);
+
 private:
+	MethodInfo *addMethod(const std::string &category,
+	                      const std::string &methodName);
 	static bool callResultHandler(LSHandle *handle, LSMessage *message,
 	                              void *context);
 	static void onLunaDisconnect(LSHandle *sh, void *user_data);
 	bool methodHandler(LSMessage &msg);
 	bool callResult(SubscriptionInfo *info, LSMessage *message);
+	bool deliverResult(SubscriptionInfo *info, ParsedReply &reply);
+	void callFailed(SubscriptionInfo *info);
+	void parsedResult(ParsedReply &reply);
+	SubscriptionInfo *newSubscription(const pbnjson::JSchema &schema);
 
 	inline MethodInfo* findMethod(const std::string& category, const std::string& name)
 	{
@@ -140,6 +227,9 @@ public:
 
 private:
 	std::unordered_map<SubscriptionInfo *, SubscriptionInfo *> subscriptions;
+	unsigned long long nextSerial;
+	ReplyParser *replyParser;
+	SyncCallProfiler syncCalls;
 	std::unordered_map<std::string, std::unordered_map<std::string, MethodInfo*> > categoryMethods;
 };
 
@@ -15,14 +15,20 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include <iostream>
+#include <algorithm>
 #include <glib.h>
 #include <sys/signalfd.h>
 
 #include "logging.h"
 #include "config.h"
+#include "diagnostics.h"
+#include "flightrecorder.h"
+#include "memorypressure.h"
 #include "pluginloader.h"
 #include "pluginmanager.h"
 #include "servicemonitor.h"
+#include "stallwatchdog.h"
+#include "tracer.h"
 
 static const char *LOG_CONTEXT_NAME = COMPONENT_NAME;
 
@@ -32,9 +38,70 @@ static GMainLoop *mainLoop = nullptr;
 
 //Option variables
 static gboolean option_version = FALSE;
+static gint option_module_grace = 60;
+static gint option_module_budget = 4096;
+static gint option_status_window = 0;
+static gint option_unload_delay = 2000;
+static gint option_flap_threshold = 3;
+static gint option_flap_window = 60000;
+static gboolean option_cold_start = FALSE;
+static gboolean option_hot_reload = TRUE;
+static gint option_start_budget = 5;
+static gint option_idle_timeout = 300;
+static gint option_psi_moderate = 150;
+static gint option_psi_critical = 100;
+static gchar *option_memory_signal = nullptr;
+static gboolean option_isolate_plugins = FALSE;
+static gint option_parse_threads = 0;
+static gint option_stall_threshold = 1000;
+static gboolean option_stall_stacks = FALSE;
+static gint option_sync_budget = 0;
+static gboolean option_sync_reject = FALSE;
+static gint option_flight_records = 8192;
 
 static GOptionEntry options[] = { { "version", 'v', 0, G_OPTION_ARG_NONE,
-        &option_version, "Show version information and exit" }, { nullptr }, };
+        &option_version, "Show version information and exit" },
+        { "module-grace", 0, 0, G_OPTION_ARG_INT, &option_module_grace,
+        "Seconds to keep unloaded plugin libraries mapped, 0 to disable", "SECONDS" },
+        { "module-budget", 0, 0, G_OPTION_ARG_INT, &option_module_budget,
+        "Maximum size of unloaded plugin libraries kept mapped", "KB" },
+        { "status-window", 0, 0, G_OPTION_ARG_INT, &option_status_window,
+        "Collect service status changes for this long before updating plugins", "MS" },
+        { "unload-delay", 0, 0, G_OPTION_ARG_INT, &option_unload_delay,
+        "Time a required service must stay offline before plugin is unloaded", "MS" },
+        { "flap-threshold", 0, 0, G_OPTION_ARG_INT, &option_flap_threshold,
+        "Outages within flap window after which plugins are no longer unloaded, 0 to disable", "COUNT" },
+        { "flap-window", 0, 0, G_OPTION_ARG_INT, &option_flap_window,
+        "Time window for counting service outages", "MS" },
+        { "cold-start", 0, 0, G_OPTION_ARG_NONE, &option_cold_start,
+        "Do not start plugins from the last known service status" },
+        { "no-hot-reload", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &option_hot_reload,
+        "Do not watch the plugin directory for added, changed and removed plugins" },
+        { "start-budget", 0, 0, G_OPTION_ARG_INT, &option_start_budget,
+        "Time spent starting non-critical plugins per main loop iteration, 0 to start all at once", "MS" },
+        { "idle-timeout", 0, 0, G_OPTION_ARG_INT, &option_idle_timeout,
+        "Unload lazy plugins after being idle this long, 0 to disable", "SECONDS" },
+        { "psi-moderate", 0, 0, G_OPTION_ARG_INT, &option_psi_moderate,
+        "Memory stall per second for moderate memory pressure, 0 to disable", "MS" },
+        { "psi-critical", 0, 0, G_OPTION_ARG_INT, &option_psi_critical,
+        "Full memory stall per second for critical memory pressure, 0 to disable", "MS" },
+        { "memory-signal", 0, 0, G_OPTION_ARG_STRING, &option_memory_signal,
+        "Luna signal reporting memory pressure level", "CATEGORY/METHOD" },
+        { "isolate-plugins", 0, 0, G_OPTION_ARG_NONE, &option_isolate_plugins,
+        "Run every plugin in its own host process, not only plugins that ask for it" },
+        { "parse-threads", 0, 0, G_OPTION_ARG_INT, &option_parse_threads,
+        "Parse and validate bus replies on this many threads, 0 to parse on the main loop", "COUNT" },
+        { "stall-threshold", 0, 0, G_OPTION_ARG_INT, &option_stall_threshold,
+        "Report main loop iterations taking longer than this, 0 to disable", "MS" },
+        { "stall-stacks", 0, 0, G_OPTION_ARG_NONE, &option_stall_stacks,
+        "Log the main thread stack of main loop stalls" },
+        { "sync-call-budget", 0, 0, G_OPTION_ARG_INT, &option_sync_budget,
+        "Log synchronous luna calls blocking longer than this, 0 to disable", "MS" },
+        { "reject-slow-sync-calls", 0, 0, G_OPTION_ARG_NONE, &option_sync_reject,
+        "Fail synchronous luna calls not answered within the sync call budget" },
+        { "flight-records", 0, 0, G_OPTION_ARG_INT, &option_flight_records,
+        "Events kept in memory and dumped on crash, 0 to disable", "COUNT" },
+        { nullptr }, };
 
 void processOptions(int argc, char **argv) {
     GOptionContext *context;
@@ -165,14 +232,54 @@ int main(int argc, char **argv) {
     setupLogging();
 
     try {
+        FlightRecorder recorder;
+        (void) recorder.start(std::max(option_flight_records, 0),
+                WEBOS_EVENT_MONITOR_RUNTIME_PATH "/flightrecorder.crash");
+
+        Tracer tracer;
+
+        StallWatchdog watchdog;
+        (void) watchdog.start(std::max(option_stall_threshold, 0),
+                option_stall_stacks == TRUE);
+
         //setup the service
         LunaService service { SERVICE_BUS_NAME, mainLoop, nullptr };
-        PluginLoader loader { WEBOS_EVENT_MONITOR_PLUGIN_PATH };
+        service.setParseThreads(std::max(option_parse_threads, 0));
+        service.setSyncCallBudget(std::max(option_sync_budget, 0),
+                option_sync_reject == TRUE);
+        PluginLoader loader { WEBOS_EVENT_MONITOR_PLUGIN_PATH,
+                             WEBOS_EVENT_MONITOR_CACHE_PATH "/plugins.json" };
+        loader.setModuleCachePolicy(std::max(option_module_grace, 0),
+                static_cast<size_t>(std::max(option_module_budget, 0)) * 1024);
         PluginManager manager { loader, service, mainLoop };
+        manager.setIdleTimeout(std::max(option_idle_timeout, 0));
+        manager.setIsolation(option_isolate_plugins == TRUE);
 
+        StatusSnapshot snapshot { WEBOS_EVENT_MONITOR_RUNTIME_PATH "/status.snapshot" };
         ServiceMonitor monitor { manager, service };
+        monitor.setSnapshot(&snapshot, option_cold_start == FALSE);
+        monitor.setReconcileWindow(std::max(option_status_window, 0));
+        monitor.setStartBudget(std::max(option_start_budget, 0));
+        monitor.setFlapDamping(std::max(option_unload_delay, 0),
+                std::max(option_flap_threshold, 0),
+                std::max(option_flap_window, 0));
+        MemoryPressure pressure { loader, manager, service };
+        (void) pressure.watchPsi("/proc/pressure/memory",
+                std::max(option_psi_moderate, 0),
+                std::max(option_psi_critical, 0));
+        if (option_memory_signal) {
+            pressure.watchSignal(option_memory_signal);
+        }
+        Diagnostics diagnostics { service, loader, manager, monitor, pressure, watchdog,
+                recorder, tracer };
         monitor.startMonitor(loader.getPlugins());
 
+        if (option_hot_reload) {
+            (void) loader.watchPluginPath([&monitor](size_t pluginIndex, PluginChange change) {
+                monitor.pluginChanged(pluginIndex, change);
+            });
+        }
+
         g_main_loop_run(mainLoop);
     } catch (...) {
         LOG_ERROR(MSGID_SERVICE_STATUS_ERROR, 0, "startMonitor failure :");
@@ -0,0 +1,307 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include "memorypressure.h"
+#include "logging.h"
+#include "utils.h"
+
+using namespace pbnjson;
+
+static const unsigned int PSI_WINDOW_MS = 1000;
+// Lazy plugins unused for this long are released on critical pressure.
+static const unsigned int RELEASE_IDLE_SECONDS = 10;
+// Same or lower level is not handled again within this time.
+static const gint64 RESPONSE_INTERVAL_US = 10 * G_USEC_PER_SEC;
+
+static const char *levelName(PressureLevel level)
+{
+	switch (level)
+	{
+		case PRESSURE_MODERATE:
+			return "moderate";
+
+		case PRESSURE_CRITICAL:
+			return "critical";
+
+		default:
+			return "none";
+	}
+}
+
+/**
+ * Resident set size of this process in KB, -1 if not available.
+ */
+static long readResidentKb()
+{
+	long size = 0;
+	long resident = -1;
+	FILE *statm = fopen("/proc/self/statm", "r");
+
+	if (!statm)
+	{
+		return -1;
+	}
+
+	if (fscanf(statm, "%ld %ld", &size, &resident) != 2)
+	{
+		resident = -1;
+	}
+
+	fclose(statm);
+	return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+MemoryPressure::MemoryPressure(PluginLoader &_loader,
+                               PluginManager &_manager,
+                               LunaService &_service):
+	loader(_loader),
+	manager(_manager),
+	service(_service),
+	signalSubscription(nullptr),
+	lastResponseAt(0),
+	lastLevel(PRESSURE_NONE),
+	moderateEvents(0),
+	criticalEvents(0),
+	freedModuleBytes(0),
+	releasedPlugins(0)
+{
+}
+
+MemoryPressure::~MemoryPressure()
+{
+	for (PsiTrigger *trigger : this->psiTriggers)
+	{
+		if (trigger->source)
+		{
+			g_source_remove(trigger->source);
+		}
+
+		delete trigger;
+	}
+
+	this->psiTriggers.clear();
+
+	if (this->signalSubscription)
+	{
+		this->service.cancelSubscribe(this->signalSubscription);
+		this->signalSubscription = nullptr;
+	}
+}
+
+bool MemoryPressure::watchPsi(const std::string &psiPath,
+                              unsigned int moderateStallMs,
+                              unsigned int criticalStallMs)
+{
+	bool success = true;
+
+	if (moderateStallMs > 0)
+	{
+		success &= this->addPsiTrigger(psiPath, PRESSURE_MODERATE, "some", moderateStallMs);
+	}
+
+	if (criticalStallMs > 0)
+	{
+		success &= this->addPsiTrigger(psiPath, PRESSURE_CRITICAL, "full", criticalStallMs);
+	}
+
+	return success;
+}
+
+bool MemoryPressure::addPsiTrigger(const std::string &psiPath,
+                                   PressureLevel level,
+                                   const char *type,
+                                   unsigned int stallMs)
+{
+	int fd = open(psiPath.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+
+	if (fd < 0)
+	{
+		LOG_WARNING(MSGID_MEMORY_PRESSURE, 0, "Failed to open %s: %s",
+		            psiPath.c_str(), strerror(errno));
+		return false;
+	}
+
+	// Trigger is "<some|full> <stall us> <window us>", including the terminator.
+	char trigger[64];
+	int length = snprintf(trigger, sizeof(trigger), "%s %u %u", type,
+	                      std::min(stallMs, PSI_WINDOW_MS) * 1000,
+	                      PSI_WINDOW_MS * 1000);
+
+	if (write(fd, trigger, length + 1) < 0)
+	{
+		LOG_WARNING(MSGID_MEMORY_PRESSURE, 0, "Failed to set PSI trigger %s: %s",
+		            trigger, strerror(errno));
+		close(fd);
+		return false;
+	}
+
+	GIOChannel *channel = g_io_channel_unix_new(fd);
+	g_io_channel_set_close_on_unref(channel, TRUE);
+	g_io_channel_set_encoding(channel, NULL, NULL);
+	g_io_channel_set_buffered(channel, FALSE);
+
+	PsiTrigger *state = new PsiTrigger();
+	state->monitor = this;
+	state->level = level;
+	state->source = g_io_add_watch(channel,
+	                               static_cast<GIOCondition>(G_IO_PRI | G_IO_ERR
+	                                       | G_IO_HUP | G_IO_NVAL),
+	                               MemoryPressure::psiCallback,
+	                               state);
+	g_io_channel_unref(channel);
+	this->psiTriggers.push_back(state);
+
+	LOG_INFO(MSGID_MEMORY_PRESSURE, 0, "Watching %s for %s pressure: %s",
+	         psiPath.c_str(), levelName(level), trigger);
+	return true;
+}
+
+gboolean MemoryPressure::psiCallback(GIOChannel *channel UNUSED_VAR,
+                                     GIOCondition cond,
+                                     gpointer userData)
+{
+	PsiTrigger *trigger = reinterpret_cast<PsiTrigger *>(userData);
+
+	if (cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP))
+	{
+		LOG_WARNING(MSGID_MEMORY_PRESSURE, 0, "PSI trigger for %s pressure closed",
+		            levelName(trigger->level));
+		trigger->source = 0;
+		return FALSE;
+	}
+
+	trigger->monitor->respond(trigger->level);
+	return TRUE;
+}
+
+void MemoryPressure::watchSignal(const std::string &signal)
+{
+	size_t separator = signal.rfind('/');
+
+	if (separator == std::string::npos || separator == 0)
+	{
+		LOG_WARNING(MSGID_MEMORY_PRESSURE, 0, "Invalid memory pressure signal: %s",
+		            signal.c_str());
+		return;
+	}
+
+	JValue params = JObject{{"category", signal.substr(0, separator)},
+	                        {"method", signal.substr(separator + 1)}};
+
+	try
+	{
+		this->signalSubscription = this->service.subscribeToMethod(
+		                               "luna://com.webos.service.bus/signal/addmatch",
+		                               params,
+		                               [this](JValue & previousValue, JValue & value)
+		{
+			this->signalCallback(value);
+		},
+		JSchema::AllSchema(),
+		nullptr,
+		true);
+	}
+	catch (const std::exception &e)
+	{
+		LOG_WARNING(MSGID_MEMORY_PRESSURE, 0, "Failed to subscribe to %s: %s",
+		            signal.c_str(), e.what());
+	}
+}
+
+void MemoryPressure::signalCallback(JValue &value)
+{
+	std::string level;
+	(void) value["level"].asString(level);
+
+	if (level == "normal")
+	{
+		this->lastLevel = PRESSURE_NONE;
+	}
+	else
+	{
+		this->respond(level == "critical" ? PRESSURE_CRITICAL : PRESSURE_MODERATE);
+	}
+}
+
+void MemoryPressure::respond(PressureLevel level)
+{
+	gint64 now = g_get_monotonic_time();
+
+	if (level <= this->lastLevel && now - this->lastResponseAt < RESPONSE_INTERVAL_US)
+	{
+		return;
+	}
+
+	this->lastResponseAt = now;
+	this->lastLevel = level;
+
+	long residentBefore = readResidentKb();
+	unsigned int plugins = 0;
+
+	if (level >= PRESSURE_CRITICAL)
+	{
+		this->criticalEvents += 1;
+
+		// Plugins first, so that released libraries are closed below.
+		this->manager.trimMemory();
+		plugins = this->manager.releaseIdlePlugins(RELEASE_IDLE_SECONDS);
+	}
+	else
+	{
+		this->moderateEvents += 1;
+	}
+
+	size_t moduleBytes = this->loader.releaseResidentModules();
+	bool trimmed = malloc_trim(0) != 0;
+	long residentAfter = readResidentKb();
+
+	this->freedModuleBytes += moduleBytes;
+	this->releasedPlugins += plugins;
+
+	LOG_WARNING(MSGID_MEMORY_PRESSURE, 0,
+	            "%s memory pressure: released %u plugins, %zu KB of modules, heap trimmed: %s, RSS %ld KB -> %ld KB",
+	            levelName(level), plugins, moduleBytes / 1024,
+	            trimmed ? "yes" : "no", residentBefore, residentAfter);
+
+	this->lastReport = JObject{
+		{"level", levelName(level)},
+		{"releasedPlugins", JValue(static_cast<int64_t>(plugins))},
+		{"moduleBytes", JValue(static_cast<int64_t>(moduleBytes))},
+		{"heapTrimmed", trimmed},
+		{"residentKbBefore", JValue(static_cast<int64_t>(residentBefore))},
+		{"residentKbAfter", JValue(static_cast<int64_t>(residentAfter))}};
+}
+
+JValue MemoryPressure::getStats()
+{
+	return JObject{
+		{"sources", JValue(static_cast<int64_t>(this->psiTriggers.size() +
+		                                        (this->signalSubscription ? 1 : 0)))},
+		{"moderateEvents", JValue(static_cast<int64_t>(this->moderateEvents))},
+		{"criticalEvents", JValue(static_cast<int64_t>(this->criticalEvents))},
+		{"freedModuleBytes", JValue(static_cast<int64_t>(this->freedModuleBytes))},
+		{"releasedPlugins", JValue(static_cast<int64_t>(this->releasedPlugins))},
+		{"residentKb", JValue(static_cast<int64_t>(readResidentKb()))},
+		{"lastResponse", this->lastReport}};
+}
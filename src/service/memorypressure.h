@@ -0,0 +1,110 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <glib.h>
+#include <pbnjson.hpp>
+
+#include "lunaservice.h"
+#include "pluginloader.h"
+#include "pluginmanager.h"
+
+enum PressureLevel
+{
+	PRESSURE_NONE = 0,
+	PRESSURE_MODERATE,
+	PRESSURE_CRITICAL
+};
+
+class MemoryPressure;
+
+class PsiTrigger
+{
+public:
+	MemoryPressure *monitor;
+	PressureLevel level;
+	guint source;
+};
+
+/**
+ * Listens for memory pressure and frees what the service can spare.
+ * Moderate pressure closes kept plugin libraries and trims the allocator.
+ * Critical pressure also asks plugins to drop their caches and unloads
+ * idle lazy plugins.
+ */
+class MemoryPressure
+{
+public:
+	MemoryPressure(PluginLoader &loader, PluginManager &manager,
+	               LunaService &service);
+	~MemoryPressure();
+
+	MemoryPressure(const MemoryPressure &) = delete;
+	MemoryPressure &operator=(const MemoryPressure &) = delete;
+
+	/**
+	 * Register Linux PSI triggers, see Documentation/accounting/psi.rst.
+	 * Pressure is reported when tasks stall on memory for the given time
+	 * within a one second window.
+	 * @param moderateStallMs - "some" stall for moderate pressure, 0 to disable.
+	 * @param criticalStallMs - "full" stall for critical pressure, 0 to disable.
+	 * @return false if PSI is not available.
+	 */
+	bool watchPsi(const std::string &psiPath,
+	              unsigned int moderateStallMs,
+	              unsigned int criticalStallMs);
+
+	/**
+	 * Subscribe to a bus signal reporting memory pressure.
+	 * Payload {"level": "normal" | "critical" | other} maps to none,
+	 * critical and moderate pressure.
+	 * @param signal - signal category and method, eg: /com/webos/memory/pressure
+	 */
+	void watchSignal(const std::string &signal);
+
+	/**
+	 * Run the responses for the given level and log what was freed.
+	 */
+	void respond(PressureLevel level);
+
+	pbnjson::JValue getStats();
+
+private:
+	bool addPsiTrigger(const std::string &psiPath, PressureLevel level,
+	                   const char *type, unsigned int stallMs);
+	static gboolean psiCallback(GIOChannel *channel, GIOCondition cond,
+	                            gpointer userData);
+	void signalCallback(pbnjson::JValue &value);
+
+private:
+	PluginLoader &loader;
+	PluginManager &manager;
+	LunaService &service;
+
+	std::vector<PsiTrigger *> psiTriggers;
+	SubscribeHandle signalSubscription;
+
+	gint64 lastResponseAt;
+	PressureLevel lastLevel;
+	unsigned long long moderateEvents;
+	unsigned long long criticalEvents;
+	unsigned long long freedModuleBytes;
+	unsigned long long releasedPlugins;
+	pbnjson::JValue lastReport;
+};
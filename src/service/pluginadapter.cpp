@@ -14,21 +14,42 @@
 //
 // SPDX-License-Identifier: Apache-2.0
 
+#include <algorithm>
+#include <limits>
+
 #include "pluginadapter.h"
 #include "pluginmanager.h"
 #include "logging.h"
+#include "flightrecorder.h"
+#include "tracer.h"
+#include "stallwatchdog.h"
 #include "utils.h"
 #include "config.h"
 
 using namespace pbnjson;
 
+// Timeout ids for the timers backing debounce, throttle and polling.
+// Starting with '@' keeps them apart from plugin's own timeouts.
+#define DEBOUNCE_TIMEOUT_PREFIX "@debounce/"
+#define THROTTLE_TIMEOUT_PREFIX "@throttle/"
+#define POLL_TIMEOUT_PREFIX     "@poll/"
+
+// Maximum random adjustment of the poll interval, in percent.
+static const unsigned int POLL_JITTER_PERCENT = 10;
+
 PluginAdapter::PluginAdapter(PluginManager *_manager, const PluginInfo *_info):
 	needUnload(false),
 	manager(_manager),
 	info(_info),
 	plugin(nullptr),
-	unloadNotified(false)
+	unloadNotified(false),
+	lastActivity(g_get_monotonic_time()),
+	postQueue(g_main_context_default()),
+	unloadSource(0),
+	metrics(_manager->getPluginMetrics(_info))
 {
+	this->metrics->loads++;
+
 	//Prepare logging context
 	const std::string name = std::string(COMPONENT_NAME) + "-" + this->info->name;
 	PmLogErr error = PmLogGetContext(name.c_str(), &this->logContext);
@@ -52,10 +73,22 @@ void PluginAdapter::unloadPlugin()
 	}
 
 	LOG_DEBUG("Preparing to unload plugin %s", this->info->name.c_str());
+	this->cancelAll();
+
+	//Cannot delete the plugin here, it might still be in our call stack.
+	//Instead set a flag and process later.
+	//Need to call manager->processUnload(adapter) when scope out of adapter.
+	this->needUnload = true;
+}
 
+void PluginAdapter::cancelAll()
+{
 	// cleanup pending luna calls
 	this->manager->lunaService.cleanupPlugin(this);
 
+	// drop background tasks, waits for a running one
+	this->manager->backgroundPool.cancel(this);
+
 	// close alerts
 	while (!this->alerts.empty())
 	{
@@ -68,14 +101,21 @@ void PluginAdapter::unloadPlugin()
 		(void) this->cancelTimeout(this->timeouts.cbegin()->first);
 	}
 
-	//Cannot delete the plugin here, it might still be in our call stack.
-	//Instead set a flag and process later.
-	//Need to call manager->processUnload(adapter) when scope out of adapter.
-	this->needUnload = true;
+	// Timers and calls are already gone, just forget the state.
+	this->throttles.clear();
+	this->polls.clear();
+	this->subscriptions.clear();
+	this->signals.clear();
 }
 
 PluginAdapter::~PluginAdapter()
 {
+	if (this->unloadSource)
+	{
+		g_source_remove(this->unloadSource);
+		this->unloadSource = 0;
+	}
+
 	if (this->plugin)
 	{
 		delete this->plugin;
@@ -207,6 +247,93 @@ void PluginAdapter::notifyPluginShouldUnload(const std::string &service)
 	LOG_DEBUG("Done stopMonitoring on plugin %s", this->info->path.c_str());
 }
 
+void PluginAdapter::notifyServicePaused(const std::string &service)
+{
+	if (!this->plugin)
+	{
+		return;
+	}
+
+	LOG_DEBUG("Calling servicePaused on plugin %s", this->info->path.c_str());
+
+	try
+	{
+		this->plugin->servicePaused(service);
+	}
+	catch (const std::exception &e)
+	{
+		LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0,
+		          "Exception while executing servicePaused in plugin %s, message: %s",
+		          this->info->path.c_str(), e.what());
+		this->unloadPlugin();
+	}
+	catch (...)
+	{
+		LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0,
+		          "Exception while executing servicePaused in plugin %s",
+		          this->info->path.c_str());
+		this->unloadPlugin();
+	}
+}
+
+void PluginAdapter::notifyServiceResumed(const std::string &service)
+{
+	if (!this->plugin)
+	{
+		return;
+	}
+
+	LOG_DEBUG("Calling serviceResumed on plugin %s", this->info->path.c_str());
+
+	try
+	{
+		this->plugin->serviceResumed(service);
+	}
+	catch (const std::exception &e)
+	{
+		LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0,
+		          "Exception while executing serviceResumed in plugin %s, message: %s",
+		          this->info->path.c_str(), e.what());
+		this->unloadPlugin();
+	}
+	catch (...)
+	{
+		LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0,
+		          "Exception while executing serviceResumed in plugin %s",
+		          this->info->path.c_str());
+		this->unloadPlugin();
+	}
+}
+
+void PluginAdapter::notifyTrimMemory()
+{
+	if (!this->plugin)
+	{
+		return;
+	}
+
+	LOG_DEBUG("Calling trimMemory on plugin %s", this->info->path.c_str());
+
+	try
+	{
+		this->plugin->trimMemory();
+	}
+	catch (const std::exception &e)
+	{
+		LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0,
+		          "Exception while executing trimMemory in plugin %s, message: %s",
+		          this->info->path.c_str(), e.what());
+		this->unloadPlugin();
+	}
+	catch (...)
+	{
+		LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0,
+		          "Exception while executing trimMemory in plugin %s",
+		          this->info->path.c_str());
+		this->unloadPlugin();
+	}
+}
+
 void PluginAdapter::subscribeToMethod(const std::string &subscriptionId,
                                        const std::string &serviceName,
                                        JValue &params,
@@ -229,6 +356,7 @@ void PluginAdapter::subscribeToMethod(const std::string &subscriptionId,
 		throw Error("Can only subscribe to services that are in required list");
 	}
 
+	this->metrics->busCalls++;
 	SubscribeHandle handle = this->manager->lunaService.subscribeToMethod(
 	                             serviceName,
 	                             params,
@@ -249,6 +377,7 @@ bool PluginAdapter::unsubscribeFromMethod(const std::string &subscriptionId)
 	SubscribeHandle handle = this->subscriptions[subscriptionId];
 	this->manager->lunaService.cancelSubscribe(handle);
 	this->subscriptions.erase(subscriptionId);
+	this->signals.erase(subscriptionId);
 	return true;
 }
 
@@ -271,6 +400,7 @@ void PluginAdapter::subscribeToSignal(const std::string &subscriptionId,
 		params.put("method", method.c_str());
 	}
 
+	this->metrics->busCalls++;
 	SubscribeHandle handle = this->manager->lunaService.subscribeToMethod(
 			"luna://com.webos.service.bus/signal/addmatch",
 			params,
@@ -279,6 +409,65 @@ void PluginAdapter::subscribeToSignal(const std::string &subscriptionId,
 			this,
 			true);
 	this->subscriptions[subscriptionId] = handle;
+	this->signals[subscriptionId] = std::make_pair(category, method);
+}
+
+void PluginAdapter::replaySignal(const std::string &category,
+                                 const std::string &method,
+                                 pbnjson::JValue &payload)
+{
+	std::vector<std::string> matching;
+
+	for (const auto &signal : this->signals)
+	{
+		if (signal.second.first == category &&
+		        (signal.second.second.empty() || signal.second.second == method))
+		{
+			matching.push_back(signal.first);
+		}
+	}
+
+	for (const std::string &subscriptionId : matching)
+	{
+		// Previous callback might have unsubscribed it.
+		if (this->subscriptions.count(subscriptionId) == 0)
+		{
+			continue;
+		}
+
+		SubscribeHandle handle = this->subscriptions[subscriptionId];
+		LOG_DEBUG("Replaying signal %s/%s to plugin %s",
+		          category.c_str(),
+		          method.c_str(),
+		          this->info->name.c_str());
+
+		JValue previousValue = handle->previousValue;
+		handle->previousValue = payload;
+
+		try
+		{
+			handle->subscribeCallback(previousValue, payload);
+		}
+		catch (const std::exception &e)
+		{
+			LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0,
+			          "Exception while replaying signal in plugin %s, message: %s",
+			          this->info->path.c_str(), e.what());
+			this->unloadPlugin();
+		}
+		catch (...)
+		{
+			LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0,
+			          "Exception while replaying signal in plugin %s",
+			          this->info->path.c_str());
+			this->unloadPlugin();
+		}
+
+		if (this->needUnload)
+		{
+			return;
+		}
+	}
 }
 
 bool PluginAdapter::unsubscribeFromSignal(const std::string &subscriptionId)
@@ -290,13 +479,17 @@ pbnjson::JValue PluginAdapter::lunaCall(const std::string &serviceUrl,
                                         pbnjson::JValue &params,
                                         unsigned long timeout)
 {
-	return this->manager->lunaService.call(serviceUrl, params, timeout);
+	this->metrics->busCalls++;
+	Tracer::Span span("call", "lunaCall", serviceUrl, Tracer::currentFlow());
+	return this->manager->lunaService.call(serviceUrl, params, this, timeout);
 }
 
 void PluginAdapter::lunaCallAsync(const std::string &serviceUrl,
                                   pbnjson::JValue &params,
                                   LunaCallback callback)
 {
+	this->metrics->busCalls++;
+	Tracer::Span span("call", "lunaCallAsync", serviceUrl, Tracer::currentFlow());
 	this->manager->lunaService.callAsync(serviceUrl, params, callback, this);
 }
 
@@ -328,6 +521,14 @@ void PluginAdapter::setTimeout(const std::string &timeoutId,
 	timeout->timeoutId = timeoutId;
 	timeout->repeat = repeat;
 	timeout->handle = handle;
+
+	// A repeating timer fires on its own schedule, not because of the event
+	// that happened to set it.
+	if (!repeat)
+	{
+		timeout->origin = EventOrigin::capture();
+	}
+
 	this->timeouts[timeoutId] = timeout;
 }
 
@@ -358,12 +559,16 @@ gboolean PluginAdapter::timeoutCallback(gpointer userData)
 	{
 		std::string timeoutId = state->timeoutId;
 		TimeoutCallback callback = state->callback;
+		EventOrigin origin = state->origin;
 
 		LOG_DEBUG("Plugin %s timeout happened: %s",
 		          state->adapter->info->name.c_str(),
 		          timeoutId.c_str());
 
 		//Do any processing before doing the callback, as it might unload the plugin
+		adapter->markActive();
+		FlightRecorder::record(FLIGHT_TIMER, FlightRecorder::intern(adapter->info->name),
+		                       FlightRecorder::hash(timeoutId));
 
 		if (state->repeat)
 		{
@@ -375,6 +580,10 @@ gboolean PluginAdapter::timeoutCallback(gpointer userData)
 			continueTimeout = G_SOURCE_REMOVE;
 		}
 
+		ScopedLatency latency(&adapter->metrics->timers);
+		StallWatchdog::Activity activity(adapter->info->name, "timeout", timeoutId, true);
+		EventOrigin::Scope originScope(origin);
+
 		try
 		{
 			callback(timeoutId);
@@ -399,6 +608,420 @@ gboolean PluginAdapter::timeoutCallback(gpointer userData)
 	return continueTimeout;
 }
 
+void PluginAdapter::debounce(const std::string &debounceId,
+                             unsigned int delayMs,
+                             TimeoutCallback callback)
+{
+	LOG_DEBUG("Plugin %s debounce: %s",
+	          this->info->name.c_str(),
+	          debounceId.c_str());
+
+	this->setTimeout(DEBOUNCE_TIMEOUT_PREFIX + debounceId,
+	                 delayMs,
+	                 false,
+	                 [debounceId, callback](const std::string &timeoutId)
+	                 {
+	                     callback(debounceId);
+	                 });
+}
+
+bool PluginAdapter::cancelDebounce(const std::string &debounceId)
+{
+	return this->cancelTimeout(DEBOUNCE_TIMEOUT_PREFIX + debounceId);
+}
+
+void PluginAdapter::throttle(const std::string &throttleId,
+                             unsigned int intervalMs,
+                             TimeoutCallback callback)
+{
+	gint64 now = g_get_monotonic_time() / 1000;
+	std::string timeoutId = THROTTLE_TIMEOUT_PREFIX + throttleId;
+
+	if (this->timeouts.count(timeoutId) > 0)
+	{
+		// Trailing call already scheduled, just replace the callback.
+		this->throttles[throttleId].pendingCallback = callback;
+		return;
+	}
+
+	if (this->throttles.count(throttleId) == 0 ||
+	        now - this->throttles[throttleId].lastCallMs >= intervalMs)
+	{
+		ThrottleState &state = this->throttles[throttleId];
+		state.lastCallMs = now;
+		state.pendingCallback = nullptr;
+		//Callback always last as it can change the state
+		callback(throttleId);
+		return;
+	}
+
+	ThrottleState &state = this->throttles[throttleId];
+	state.pendingCallback = callback;
+
+	LOG_DEBUG("Plugin %s throttled: %s",
+	          this->info->name.c_str(),
+	          throttleId.c_str());
+
+	this->setTimeout(timeoutId,
+	                 static_cast<unsigned int>(state.lastCallMs + intervalMs - now),
+	                 false,
+	                 std::bind(&PluginAdapter::throttleTimeout, this, throttleId));
+}
+
+bool PluginAdapter::cancelThrottle(const std::string &throttleId)
+{
+	(void) this->cancelTimeout(THROTTLE_TIMEOUT_PREFIX + throttleId);
+	return this->throttles.erase(throttleId) > 0;
+}
+
+void PluginAdapter::throttleTimeout(const std::string &throttleId)
+{
+	if (this->throttles.count(throttleId) == 0)
+	{
+		return;
+	}
+
+	ThrottleState &state = this->throttles[throttleId];
+	TimeoutCallback callback = state.pendingCallback;
+	state.pendingCallback = nullptr;
+	state.lastCallMs = g_get_monotonic_time() / 1000;
+
+	if (callback)
+	{
+		//Callback always last as it can change the state
+		callback(throttleId);
+	}
+}
+
+void PluginAdapter::startPolling(const std::string &pollId,
+                                 const std::string &serviceUrl,
+                                 pbnjson::JValue &params,
+                                 unsigned int minIntervalMs,
+                                 unsigned int maxIntervalMs,
+                                 SubscribeCallback callback)
+{
+	(void) this->stopPolling(pollId);
+
+	LOG_DEBUG("Plugin %s start polling %s: %s",
+	          this->info->name.c_str(),
+	          pollId.c_str(),
+	          serviceUrl.c_str());
+
+	if (minIntervalMs == 0 || maxIntervalMs < minIntervalMs)
+	{
+		throw Error("Poll interval must be non-zero and min <= max");
+	}
+
+	PollState &state = this->polls[pollId];
+	state.serviceUrl = serviceUrl;
+	state.params = params;
+	state.minIntervalMs = minIntervalMs;
+	state.maxIntervalMs = maxIntervalMs;
+	state.intervalMs = minIntervalMs;
+	state.previousValue = JValue(); // Null value
+	state.callback = callback;
+	state.call = nullptr;
+
+	this->pollTimeout(pollId);
+}
+
+bool PluginAdapter::stopPolling(const std::string &pollId)
+{
+	if (this->polls.count(pollId) == 0)
+	{
+		return false;
+	}
+
+	LOG_DEBUG("Plugin %s stop polling: %s",
+	          this->info->name.c_str(),
+	          pollId.c_str());
+
+	PollState &state = this->polls[pollId];
+
+	if (state.call)
+	{
+		this->manager->lunaService.cancelSubscribe(state.call);
+	}
+
+	(void) this->cancelTimeout(POLL_TIMEOUT_PREFIX + pollId);
+	this->polls.erase(pollId);
+	return true;
+}
+
+bool PluginAdapter::runInBackground(BackgroundTask task, BackgroundCallback completion)
+{
+	EventOrigin origin = EventOrigin::capture();
+	bool queued = this->manager->backgroundPool.submit(this, task,
+	              [this, completion, origin](const std::string &error)
+	{
+		this->markActive();
+
+		if (!error.empty())
+		{
+			LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0,
+			          "Exception while executing background task in plugin %s, message: %s",
+			          this->info->path.c_str(), error.c_str());
+			this->unloadPlugin();
+		}
+		else if (completion)
+		{
+			StallWatchdog::Activity activity(this->info->name, "background completion");
+			EventOrigin::Scope originScope(origin);
+
+			try
+			{
+				completion();
+			}
+			catch (const std::exception &e)
+			{
+				LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0,
+				          "Exception while executing background completion in plugin %s, message: %s",
+				          this->info->path.c_str(), e.what());
+				this->unloadPlugin();
+			}
+			catch (...)
+			{
+				LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0,
+				          "Exception while executing background completion in plugin %s",
+				          this->info->path.c_str());
+				this->unloadPlugin();
+			}
+		}
+
+		this->manager->processUnload(this);
+	});
+
+	if (!queued)
+	{
+		LOG_WARNING(MSGID_PLUGIN_BACKGROUND, 0,
+		            "Plugin %s background task rejected, %u tasks pending",
+		            this->info->name.c_str(),
+		            this->manager->backgroundPool.getPendingCount(this));
+	}
+
+	return queued;
+}
+
+JValue PluginAdapter::getActiveCounts()
+{
+	return JObject{{"subscriptions", JValue(static_cast<int64_t>(this->subscriptions.size()))},
+	               {"timers", JValue(static_cast<int64_t>(this->timeouts.size()))},
+	               {"polls", JValue(static_cast<int64_t>(this->polls.size()))},
+	               {"alerts", JValue(static_cast<int64_t>(this->alerts.size()))}};
+}
+
+void PluginAdapter::post(PostCallback callback)
+{
+	gint64 postedAt = this->postStats.notePosted();
+
+	this->postQueue.post([this, callback, postedAt]()
+	{
+		this->runPosted(callback, postedAt);
+	});
+}
+
+void PluginAdapter::runPosted(const PostCallback &callback, gint64 postedAt)
+{
+	if (!this->plugin || this->needUnload)
+	{
+		this->postStats.noteDropped();
+		return;
+	}
+
+	this->postStats.noteRun(postedAt);
+	this->markActive();
+
+	try
+	{
+		StallWatchdog::Activity activity(this->info->name, "posted function");
+		callback();
+	}
+	catch (const std::exception &e)
+	{
+		LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0,
+		          "Exception while executing posted function in plugin %s, message: %s",
+		          this->info->path.c_str(), e.what());
+		this->unloadPlugin();
+	}
+	catch (...)
+	{
+		LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0,
+		          "Exception while executing posted function in plugin %s",
+		          this->info->path.c_str());
+		this->unloadPlugin();
+	}
+
+	if (this->needUnload && !this->unloadSource)
+	{
+		// Not from here, postQueue is running this.
+		this->unloadSource = g_idle_add(PluginAdapter::unloadCallback, this);
+	}
+}
+
+gboolean PluginAdapter::unloadCallback(gpointer userData)
+{
+	auto adapter = reinterpret_cast<PluginAdapter *>(userData);
+
+	adapter->unloadSource = 0;
+	adapter->manager->processUnload(adapter);
+	return G_SOURCE_REMOVE;
+}
+
+gint64 PostStats::notePosted()
+{
+	unsigned int current = ++this->depth;
+	unsigned int seen = this->maxDepth.load();
+
+	while (current > seen && !this->maxDepth.compare_exchange_weak(seen, current))
+	{
+	}
+
+	this->posted++;
+	return g_get_monotonic_time();
+}
+
+void PostStats::noteRun(gint64 postedAt)
+{
+	int64_t latency = g_get_monotonic_time() - postedAt;
+	int64_t seen = this->maxLatencyUs.load();
+
+	while (latency > seen && !this->maxLatencyUs.compare_exchange_weak(seen, latency))
+	{
+	}
+
+	this->totalLatencyUs += latency;
+	this->run++;
+	this->depth--;
+}
+
+void PostStats::noteDropped()
+{
+	this->dropped++;
+	this->depth--;
+}
+
+JValue PostStats::toJson() const
+{
+	uint64_t runCount = this->run.load();
+	int64_t averageUs = runCount ? this->totalLatencyUs.load() / static_cast<int64_t>(runCount) : 0;
+
+	return JObject{{"posted", JValue(static_cast<int64_t>(this->posted.load()))},
+	               {"run", JValue(static_cast<int64_t>(runCount))},
+	               {"dropped", JValue(static_cast<int64_t>(this->dropped.load()))},
+	               {"depth", JValue(static_cast<int64_t>(this->depth.load()))},
+	               {"maxDepth", JValue(static_cast<int64_t>(this->maxDepth.load()))},
+	               {"averageLatencyUs", JValue(averageUs)},
+	               {"maxLatencyUs", JValue(this->maxLatencyUs.load())}};
+}
+
+void PluginAdapter::pollTimeout(const std::string &pollId)
+{
+	if (this->polls.count(pollId) == 0)
+	{
+		return;
+	}
+
+	PollState &state = this->polls[pollId];
+	this->metrics->busCalls++;
+
+	try
+	{
+		state.call = this->manager->lunaService.callAsync(
+		                 state.serviceUrl,
+		                 state.params,
+		                 std::bind(&PluginAdapter::pollResult, this, pollId,
+		                           std::placeholders::_1),
+		                 this,
+		                 std::bind(&PluginAdapter::pollFailed, this, pollId));
+	}
+	catch (const LS::Error &error)
+	{
+		this->pollFailed(pollId);
+	}
+}
+
+/**
+ * Poll call got no usable reply, try again at the current interval.
+ */
+void PluginAdapter::pollFailed(const std::string &pollId)
+{
+	if (this->polls.count(pollId) == 0)
+	{
+		return;
+	}
+
+	PollState &state = this->polls[pollId];
+	// Call handle is freed by luna service before this is called.
+	state.call = nullptr;
+
+	LOG_WARNING(MSGID_PLUGIN_POLL_FAILED, 0,
+	            "Plugin %s poll %s of %s failed, retry in %u ms",
+	            this->info->name.c_str(),
+	            pollId.c_str(),
+	            state.serviceUrl.c_str(),
+	            state.intervalMs);
+
+	this->setTimeout(POLL_TIMEOUT_PREFIX + pollId,
+	                 state.intervalMs,
+	                 false,
+	                 std::bind(&PluginAdapter::pollTimeout, this, pollId));
+}
+
+void PluginAdapter::pollResult(const std::string &pollId, JValue &response)
+{
+	if (this->polls.count(pollId) == 0)
+	{
+		return;
+	}
+
+	PollState &state = this->polls[pollId];
+	// Call handle is freed by luna service once the reply is delivered.
+	state.call = nullptr;
+
+	bool changed = state.previousValue.isNull() || state.previousValue != response;
+
+	if (changed)
+	{
+		state.intervalMs = state.minIntervalMs;
+	}
+	else
+	{
+		// Doubling could wrap around past UINT_MAX / 2.
+		state.intervalMs = state.intervalMs > state.maxIntervalMs / 2 ?
+		                   state.maxIntervalMs : state.intervalMs * 2;
+	}
+
+	// In 64 bits, the percentage of a large interval overflows 32 bits.
+	gint64 jitter = std::min<gint64>(static_cast<gint64>(state.intervalMs) *
+	                                 POLL_JITTER_PERCENT / 100,
+	                                 std::numeric_limits<gint32>::max() - 1);
+	gint64 jitteredMs = static_cast<gint64>(state.intervalMs) +
+	                    g_random_int_range(static_cast<gint32>(-jitter),
+	                                       static_cast<gint32>(jitter + 1));
+	unsigned int nextMs = static_cast<unsigned int>(
+	                          std::min<gint64>(jitteredMs, std::numeric_limits<unsigned int>::max()));
+
+	LOG_DEBUG("Plugin %s poll %s %s, next in %u ms",
+	          this->info->name.c_str(),
+	          pollId.c_str(),
+	          changed ? "changed" : "unchanged",
+	          nextMs);
+
+	this->setTimeout(POLL_TIMEOUT_PREFIX + pollId,
+	                 nextMs,
+	                 false,
+	                 std::bind(&PluginAdapter::pollTimeout, this, pollId));
+
+	if (changed)
+	{
+		JValue previousValue = state.previousValue;
+		state.previousValue = response;
+		SubscribeCallback callback = state.callback;
+		//Callback always last as it can change the state or even delete state
+		callback(previousValue, response);
+	}
+}
+
 const std::string PluginAdapter::getUILocale()
 {
 	return this->manager->getUILocale();
@@ -429,6 +1052,9 @@ void PluginAdapter::createToast(
 		params.put("onclick", onClickAction);
 	}
 
+	this->metrics->busCalls++;
+	this->noteNotification("toast");
+	Tracer::Span span("call", "createToast", this->info->name, Tracer::currentFlow());
 	this->manager->lunaService.callAsync("luna://com.webos.notification/createToast",
 	                                     params,
 	                                     nullptr,
@@ -460,9 +1086,12 @@ void PluginAdapter::createAlert(const std::string &alertId,
 		params.put("iconUrl", JValue(iconUrl));
 	}
 
+	this->metrics->busCalls++;
+	this->noteNotification("alert");
+	Tracer::Span span("call", "createAlert", alertId, Tracer::currentFlow());
 	JValue result = this->manager->lunaService.call(
 	                    "luna://com.webos.notification/createAlert",
-	                    params);
+	                    params, this);
 
 	bool success = false;
 	std::string internalId = "";
@@ -493,11 +1122,26 @@ bool PluginAdapter::closeAlert(const std::string &alertId)
 
 	JObject params = JObject{{"alertId", JValue(this->alerts[alertId])}};
 	this->alerts.erase(alertId);
+	this->metrics->busCalls++;
+	Tracer::Span span("call", "closeAlert", alertId, Tracer::currentFlow());
 	this->manager->lunaService.call("luna://com.webos.notification/closeAlert",
-	                                params);
+	                                params, this);
 	return true;
 }
 
+void PluginAdapter::noteNotification(const char *kind)
+{
+	const EventOrigin &origin = EventOrigin::current();
+
+	// Not caused by a bus reply, e.g. a method call or plugin start.
+	if (!origin.isSet())
+	{
+		return;
+	}
+
+	this->manager->recordNotification(this->info->name, kind, origin);
+}
+
 std::string PluginAdapter::registerMethod(const std::string &category,
                                           const std::string &name,
                                           LunaCallHandler handler,
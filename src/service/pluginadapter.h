@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <string>
 #include <unordered_map>
 
@@ -23,6 +24,9 @@
 
 #include "pluginloader.h"
 #include "lunaservice.h"
+#include "pluginmetrics.h"
+#include "eventlatency.h"
+#include "taskqueue.h"
 
 using namespace EventMonitor;
 
@@ -37,6 +41,63 @@ public:
 	bool repeat;
 	guint handle;
 	TimeoutCallback callback;
+	EventOrigin origin; // of one-shot timers only
+};
+
+class ThrottleState
+{
+public:
+	gint64 lastCallMs;
+	TimeoutCallback pendingCallback;
+};
+
+class PollState
+{
+public:
+	std::string serviceUrl;
+	pbnjson::JValue params;
+	unsigned int minIntervalMs;
+	unsigned int maxIntervalMs;
+	unsigned int intervalMs;
+	pbnjson::JValue previousValue;
+	SubscribeCallback callback;
+	CallHandle call;
+};
+
+/**
+ * Queue depth and latency of functions posted with Manager::post.
+ * Updated from any thread.
+ */
+class PostStats
+{
+public:
+	PostStats():
+		posted(0),
+		run(0),
+		dropped(0),
+		depth(0),
+		maxDepth(0),
+		totalLatencyUs(0),
+		maxLatencyUs(0)
+	{};
+
+	/**
+	 * @return time of posting, to pass to noteRun.
+	 */
+	gint64 notePosted();
+	void noteRun(gint64 postedAt);
+	void noteDropped();
+
+	pbnjson::JValue toJson() const;
+
+private:
+	std::atomic<uint64_t> posted;
+	std::atomic<uint64_t> run;
+	std::atomic<uint64_t> dropped;
+	std::atomic<unsigned int> depth;
+	std::atomic<unsigned int> maxDepth;
+	std::atomic<int64_t> totalLatencyUs;
+	std::atomic<int64_t> maxLatencyUs;
 };
 
 /**
@@ -113,6 +174,37 @@ public:
 
 	bool cancelTimeout(const std::string &timeoutId);
 
+	void debounce(const std::string &debounceId,
+	              unsigned int delayMs,
+	              TimeoutCallback callback);
+
+	bool cancelDebounce(const std::string &debounceId);
+
+	void throttle(const std::string &throttleId,
+	              unsigned int intervalMs,
+	              TimeoutCallback callback);
+
+	bool cancelThrottle(const std::string &throttleId);
+
+	void startPolling(const std::string &pollId,
+	                  const std::string &serviceUrl,
+	                  pbnjson::JValue &params,
+	                  unsigned int minIntervalMs,
+	                  unsigned int maxIntervalMs,
+	                  SubscribeCallback callback);
+
+	bool stopPolling(const std::string &pollId);
+
+	/**
+	 * Tasks run on the manager's BackgroundPool with the adapter as owner.
+	 */
+	bool runInBackground(BackgroundTask task, BackgroundCallback completion);
+
+	/**
+	 * Thread safe. Functions run from the adapter's own queue on the main loop.
+	 */
+	void post(PostCallback callback);
+
 	void createToast(
 	    const std::string &message,
 	    const std::string &iconUrl = "",
@@ -139,12 +231,58 @@ public:
 
 	void notifyLocaleChanged(const std::string &locale);
 	void notifyPluginShouldUnload(const std::string &service);
+	void notifyServicePaused(const std::string &service);
+	void notifyServiceResumed(const std::string &service);
+	void notifyTrimMemory();
+
+	/**
+	 * Deliver a signal that arrived before the plugin was loaded to the
+	 * plugin's matching signal subscriptions.
+	 */
+	void replaySignal(const std::string &category,
+	                  const std::string &method,
+	                  pbnjson::JValue &payload);
 
 	inline const PluginInfo *getInfo()
 	{
 		return this->info;
 	}
 
+	/**
+	 * Called on every callback into the plugin, used for idle unload.
+	 */
+	inline void markActive()
+	{
+		this->lastActivity = g_get_monotonic_time();
+	}
+
+	inline gint64 getLastActivity()
+	{
+		return this->lastActivity;
+	}
+
+	inline PostStats &getPostStats()
+	{
+		return this->postStats;
+	}
+
+	inline PluginMetrics *getMetrics()
+	{
+		return this->metrics;
+	}
+
+	/**
+	 * Subscriptions, timers, polls and alerts the plugin has now.
+	 */
+	pbnjson::JValue getActiveCounts();
+
+	/**
+	 * Cancel the plugin's luna calls, subscriptions, timers, background
+	 * tasks and methods and close its alerts. Must be called before deleting
+	 * an adapter whose plugin made Manager calls but never got loaded.
+	 */
+	void cancelAll();
+
 public:
 	//Plugin needs to be unloaded
 	bool needUnload;
@@ -152,19 +290,43 @@ public:
 
 private:
 	static gboolean timeoutCallback(gpointer userData);
+	static gboolean unloadCallback(gpointer userData);
+	void runPosted(const PostCallback &callback, gint64 postedAt);
+	void throttleTimeout(const std::string &throttleId);
+	void pollTimeout(const std::string &pollId);
+	void pollFailed(const std::string &pollId);
+	void pollResult(const std::string &pollId, pbnjson::JValue &response);
+	void noteNotification(const char *kind);
 
 	const PluginInfo *info;
 	PmLogContext logContext;
 	Plugin *plugin;
 	//Plugin was notified that it should unload
 	bool unloadNotified;
+	gint64 lastActivity; // monotonic, us
+
+	// Functions posted by the plugin, see post.
+	TaskQueue postQueue;
+	PostStats postStats;
+	guint unloadSource;
+
+	PluginMetrics *metrics; // owned by the manager
 
 	// Active subscriptions
 	std::unordered_map<std::string, SubscribeHandle> subscriptions;
 
-	// Active alerts
+	// Signal category and method of signal subscriptions
+	std::unordered_map<std::string, std::pair<std::string, std::string>> signals;
+
+	// Active timeouts
 	std::unordered_map<std::string, TimeoutState *> timeouts;
 
+	// Active throttles
+	std::unordered_map<std::string, ThrottleState> throttles;
+
+	// Active polls
+	std::unordered_map<std::string, PollState> polls;
+
 	// Active alerts
 	std::unordered_map<std::string, std::string> alerts;
 };
@@ -0,0 +1,339 @@
+// Copyright (c) 2015-2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <glib.h>
+
+#include "plugincache.h"
+#include "logging.h"
+
+using namespace pbnjson;
+
+// Increment if the cache format or metadata format changes.
+static const int CACHE_VERSION = 7;
+
+static const char *BOOT_CLASS_NAMES[BOOT_CLASS_COUNT] = {"critical", "normal", "background"};
+
+JValue pluginMetadataToJson(const PluginInfo &info)
+{
+	JValue services = JArray();
+
+	for (const auto &service : info.requiredServices)
+	{
+		services.append(JValue(service));
+	}
+
+	JValue metadata = JObject{{"requiredServices", services},
+	                          {"bootClass", BOOT_CLASS_NAMES[info.bootClass]}};
+
+	if (info.isolated)
+	{
+		metadata.put("isolation", "process");
+	}
+
+	if (!info.thread.empty())
+	{
+		metadata.put("thread", info.thread);
+	}
+
+	if (info.handlesResume)
+	{
+		metadata.put("serviceResume", "notify");
+	}
+
+	if (info.lazy)
+	{
+		metadata.put("activation", JObject{
+			{"mode", "lazy"},
+			{"idleTimeout", JValue(static_cast<int64_t>(info.idleTimeout))},
+			{"triggers", info.triggers},
+			{"methods", info.methods}});
+	}
+
+	return metadata;
+}
+
+static bool bootClassFromJson(const JValue &bootClass, PluginInfo &info)
+{
+	std::string name;
+
+	if (bootClass.asString(name))
+	{
+		return false;
+	}
+
+	for (int i = 0; i < BOOT_CLASS_COUNT; i++)
+	{
+		if (name == BOOT_CLASS_NAMES[i])
+		{
+			info.bootClass = static_cast<BootClass>(i);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool activationFromJson(const JValue &activation, PluginInfo &info)
+{
+	std::string mode = "eager";
+	int idleTimeout = 0;
+
+	if (activation["mode"].isString())
+	{
+		(void) activation["mode"].asString(mode);
+	}
+
+	if (mode == "eager")
+	{
+		info.lazy = false;
+		return true;
+	}
+
+	if (mode != "lazy")
+	{
+		return false;
+	}
+
+	if (activation["idleTimeout"].isNumber() &&
+	        (activation["idleTimeout"].asNumber(idleTimeout) || idleTimeout < 0))
+	{
+		return false;
+	}
+
+	JValue triggers = activation["triggers"].isArray() ? activation["triggers"] : JArray();
+	JValue methods = activation["methods"].isArray() ? activation["methods"] : JArray();
+
+	for (const auto &trigger : triggers.items())
+	{
+		if (!trigger["method"].isString() && !trigger["signal"].isString())
+		{
+			return false;
+		}
+	}
+
+	for (const auto &method : methods.items())
+	{
+		if (!method["category"].isString() || !method["name"].isString())
+		{
+			return false;
+		}
+	}
+
+	info.lazy = true;
+	info.idleTimeout = static_cast<unsigned int>(idleTimeout);
+	info.triggers = triggers;
+	info.methods = methods;
+	return true;
+}
+
+bool pluginMetadataFromJson(const JValue &metadata, PluginInfo &info)
+{
+	JValue services = metadata["requiredServices"];
+
+	if (!services.isArray())
+	{
+		return false;
+	}
+
+	std::vector<std::string> requiredServices;
+
+	for (const auto &item : services.items())
+	{
+		std::string service;
+
+		if (item.asString(service) || service.empty())
+		{
+			return false;
+		}
+
+		requiredServices.push_back(service);
+	}
+
+	if (metadata.hasKey("bootClass") &&
+	        !bootClassFromJson(metadata["bootClass"], info))
+	{
+		return false;
+	}
+
+	if (metadata["activation"].isObject() &&
+	        !activationFromJson(metadata["activation"], info))
+	{
+		return false;
+	}
+
+	if (metadata.hasKey("isolation"))
+	{
+		std::string isolation;
+
+		if (metadata["isolation"].asString(isolation) ||
+		        (isolation != "process" && isolation != "none"))
+		{
+			return false;
+		}
+
+		info.isolated = isolation == "process";
+	}
+
+	if (metadata.hasKey("thread") &&
+	        (metadata["thread"].asString(info.thread) || info.thread.empty()))
+	{
+		return false;
+	}
+
+	if (metadata.hasKey("serviceResume"))
+	{
+		std::string resume;
+
+		if (metadata["serviceResume"].asString(resume) ||
+		        (resume != "notify" && resume != "restart"))
+		{
+			return false;
+		}
+
+		info.handlesResume = resume == "notify";
+	}
+
+	info.requiredServices = requiredServices;
+	return true;
+}
+
+PluginCache::PluginCache(const std::string &_cacheFile):
+	cacheFile(_cacheFile),
+	modified(false)
+{
+	if (!g_file_test(this->cacheFile.c_str(), G_FILE_TEST_EXISTS))
+	{
+		return;
+	}
+
+	JValue cache = JDomParser::fromFile(this->cacheFile.c_str(),
+	                                    JSchema::AllSchema());
+	int version = 0;
+
+	if (!cache.isObject() || cache["version"].asNumber(version) ||
+	        version != CACHE_VERSION || !cache["plugins"].isArray())
+	{
+		LOG_WARNING(MSGID_PLUGIN_CACHE, 0, "Ignoring invalid plugin cache %s",
+		            this->cacheFile.c_str());
+		this->modified = true;
+		return;
+	}
+
+	for (const auto &item : cache["plugins"].items())
+	{
+		std::string path;
+		int64_t inode = 0;
+		int64_t size = 0;
+		int64_t mtimeNs = 0;
+		int64_t manifestMtimeNs = 0;
+		ConversionResultFlags problems = 0;
+
+		problems |= item["path"].asString(path);
+		problems |= item["inode"].asNumber(inode);
+		problems |= item["size"].asNumber(size);
+		problems |= item["mtimeNs"].asNumber(mtimeNs);
+		problems |= item["manifestMtimeNs"].asNumber(manifestMtimeNs);
+
+		if (problems || !item["metadata"].isObject())
+		{
+			this->modified = true;
+			continue;
+		}
+
+		Entry &entry = this->entries[path];
+		entry.key.inode = static_cast<ino_t>(inode);
+		entry.key.size = static_cast<off_t>(size);
+		entry.key.mtimeNs = mtimeNs;
+		entry.key.manifestMtimeNs = manifestMtimeNs;
+		entry.metadata = item["metadata"];
+		entry.used = false;
+	}
+}
+
+bool PluginCache::lookup(const PluginFileKey &key, PluginInfo &info)
+{
+	auto iter = this->entries.find(info.path);
+
+	if (iter == this->entries.end() || !(iter->second.key == key))
+	{
+		return false;
+	}
+
+	if (!pluginMetadataFromJson(iter->second.metadata, info))
+	{
+		return false;
+	}
+
+	iter->second.used = true;
+	return true;
+}
+
+void PluginCache::store(const PluginFileKey &key, const PluginInfo &info)
+{
+	Entry &entry = this->entries[info.path];
+	entry.key = key;
+	entry.metadata = pluginMetadataToJson(info);
+	entry.used = true;
+	this->modified = true;
+}
+
+void PluginCache::save()
+{
+	JValue plugins = JArray();
+
+	for (const auto &iter : this->entries)
+	{
+		if (!iter.second.used)
+		{
+			// Plugin removed, drop the entry
+			this->modified = true;
+			continue;
+		}
+
+		const PluginFileKey &key = iter.second.key;
+		plugins.append(JObject{
+			{"path", JValue(iter.first)},
+			{"inode", JValue(static_cast<int64_t>(key.inode))},
+			{"size", JValue(static_cast<int64_t>(key.size))},
+			{"mtimeNs", JValue(key.mtimeNs)},
+			{"manifestMtimeNs", JValue(key.manifestMtimeNs)},
+			{"metadata", iter.second.metadata}});
+	}
+
+	if (!this->modified)
+	{
+		return;
+	}
+
+	gchar *dir = g_path_get_dirname(this->cacheFile.c_str());
+	g_mkdir_with_parents(dir, 0755);
+	g_free(dir);
+
+	JValue cache = JObject{{"version", CACHE_VERSION}, {"plugins", plugins}};
+	std::string content = cache.stringify("");
+	GError *error = nullptr;
+
+	if (!g_file_set_contents(this->cacheFile.c_str(), content.c_str(),
+	                         content.length(), &error))
+	{
+		LOG_WARNING(MSGID_PLUGIN_CACHE, 0, "Failed to write plugin cache %s: %s",
+		            this->cacheFile.c_str(), error->message);
+		g_error_free(error);
+		return;
+	}
+
+	this->modified = false;
+}
@@ -0,0 +1,112 @@
+// Copyright (c) 2015-2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <sys/stat.h>
+#include <pbnjson.hpp>
+
+#include "plugininfo.h"
+
+/**
+ * Identifies a plugin file version, cached metadata is only used
+ * if all of the fields match the file on disk.
+ */
+class PluginFileKey
+{
+public:
+	ino_t inode;
+	off_t size;
+	// Modification times in ns, a file rewritten within a second keeps
+	// its inode, size and st_mtime.
+	int64_t mtimeNs;
+	int64_t manifestMtimeNs; // 0 if there is no manifest
+
+	bool operator==(const PluginFileKey &other) const
+	{
+		return inode == other.inode && size == other.size &&
+		       mtimeNs == other.mtimeNs && manifestMtimeNs == other.manifestMtimeNs;
+	}
+};
+
+/**
+ * On-disk cache of plugin metadata, keyed by plugin path.
+ * Allows discovering plugins without opening the shared libraries.
+ */
+class PluginCache
+{
+public:
+	PluginCache(const std::string &cacheFile);
+
+	/**
+	 * Fill in plugin metadata from the cache.
+	 * @returns - false if there is no valid entry for the file.
+	 */
+	bool lookup(const PluginFileKey &key, PluginInfo &info);
+
+	void store(const PluginFileKey &key, const PluginInfo &info);
+
+	/**
+	 * Write the cache to disk if anything changed.
+	 * Entries not looked up or stored since loading are dropped.
+	 */
+	void save();
+
+private:
+	class Entry
+	{
+	public:
+		PluginFileKey key;
+		pbnjson::JValue metadata;
+		bool used;
+	};
+
+	const std::string cacheFile;
+	std::unordered_map<std::string, Entry> entries;
+	bool modified;
+};
+
+/**
+ * Convert plugin metadata to and from JSON. Same format is used by the
+ * manifest files installed next to the plugins and by the cache.
+ * Example: {"requiredServices": ["com.webos.notification"]}
+ *
+ * Optional "bootClass" is one of "critical", "normal" (default) or
+ * "background". Critical plugins are started as soon as their services are
+ * up, the others are spread over idle main loop iterations in that order.
+ *
+ * Optional "activation" section makes the plugin lazy: it is loaded only
+ * when one of the triggers fires or one of the methods is called, and
+ * unloaded after being idle for idleTimeout seconds.
+ * "activation": {
+ *     "mode": "lazy",
+ *     "idleTimeout": 300,
+ *     "triggers": [
+ *         {"method": "luna://com.webos.service.x/getStatus", "params": {},
+ *          "match": {"state": "error"}},
+ *         {"signal": "/com/palm/power", "name": "batteryStatus"}
+ *     ],
+ *     "methods": [{"category": "/myPlugin", "name": "action"}]
+ * }
+ * idleTimeout is optional, daemon default is used if not set or 0.
+ * Method triggers fire on subscription updates, not on the first response.
+ * Optional "match" requires the listed top level keys to be equal.
+ */
+pbnjson::JValue pluginMetadataToJson(const PluginInfo &info);
+bool pluginMetadataFromJson(const pbnjson::JValue &metadata, PluginInfo &info);
@@ -20,6 +20,18 @@
 #include <vector>
 #include <bits/unique_ptr.h>
 #include <functional>
+#include <pbnjson.hpp>
+
+/**
+ * Startup order of plugins, see StartupScheduler.
+ */
+enum BootClass
+{
+	BOOT_CRITICAL = 0,
+	BOOT_NORMAL,
+	BOOT_BACKGROUND,
+	BOOT_CLASS_COUNT
+};
 
 /**
  * Storage class for plugin information.
@@ -27,10 +39,33 @@
 class PluginInfo
 {
 public:
+	PluginInfo():
+		dlHandle(nullptr),
+		removed(false),
+		bootClass(BOOT_NORMAL),
+		lazy(false),
+		idleTimeout(0),
+		isolated(false),
+		handlesResume(false)
+	{};
+
 	std::string name;
 	std::string path;
 	std::vector<std::string> requiredServices;
 	void *dlHandle; // handle from dlopen
+	bool removed; // plugin file deleted, see PluginLoader::watchPluginPath
+	BootClass bootClass;
+
+	// Lazy activation from manifest, see pluginMetadataFromJson.
+	bool lazy;
+	unsigned int idleTimeout; // seconds, 0 to use daemon default
+	pbnjson::JValue triggers;
+	pbnjson::JValue methods;
+
+	bool isolated; // runs in its own host process, see RemotePlugin
+	std::string thread; // PluginThread to run on, empty for the main loop
+	// Renews its subscriptions in serviceResumed, otherwise it is restarted.
+	bool handlesResume;
 
 	bool containsURI(const std::string &uri) const;
 };
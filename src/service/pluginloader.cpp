@@ -14,15 +14,87 @@
 //
 // SPDX-License-Identifier: Apache-2.0
 
+#include <algorithm>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <link.h>
+#include <unistd.h>
+#include <sys/inotify.h>
 #include <event-monitor-api/api.h>
 
 #include "pluginloader.h"
+#include "plugincache.h"
 #include "logging.h"
 #include "utils.h"
 
-PluginLoader::PluginLoader(const std::string &_pluginPath):
-	pluginPath(_pluginPath)
+static const unsigned int MAX_WORKER_THREADS = 4;
+// Package updates write the library and the manifest separately,
+// wait for the directory to be quiet before reloading.
+static const unsigned int RELOAD_DELAY_MS = 1000;
+
+static std::string buildPath(const std::string &directory, const std::string &filename)
+{
+	gchar *path = g_build_path("/", directory.c_str(), filename.c_str(), NULL);
+	std::string result{path};
+	g_free(path);
+	return result;
+}
+
+static int64_t mtimeNsOf(const struct stat &fileStat)
+{
+	return static_cast<int64_t>(fileStat.st_mtim.tv_sec) * 1000000000 +
+	       fileStat.st_mtim.tv_nsec;
+}
+
+static unsigned int workerThreads()
+{
+	return std::max(1u, std::min(g_get_num_processors(), MAX_WORKER_THREADS));
+}
+
+static int addMappedSize(struct dl_phdr_info *info, size_t size, void *data)
+{
+	auto search = reinterpret_cast<std::pair<const char *, size_t> *>(data);
+
+	if (!info->dlpi_name || strcmp(info->dlpi_name, search->first) != 0)
+	{
+		return 0;
+	}
+
+	for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++)
+	{
+		if (info->dlpi_phdr[i].p_type == PT_LOAD)
+		{
+			search->second += info->dlpi_phdr[i].p_memsz;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Size of the loadable segments of an opened library.
+ */
+static size_t getMappedSize(const std::string &path)
+{
+	std::pair<const char *, size_t> search{path.c_str(), 0};
+	dl_iterate_phdr(addMappedSize, &search);
+	return search.second;
+}
+
+PluginLoader::PluginLoader(const std::string &_pluginPath,
+                           const std::string &cacheFile):
+	pluginPath(_pluginPath),
+	inotifySource(0),
+	reloadTimer(0),
+	openPool(nullptr),
+	residentSize(0),
+	graceSeconds(0),
+	budgetBytes(0),
+	expireTimer(0),
+	cacheHits(0),
+	cacheMisses(0),
+	evictions(0),
+	expiries(0)
 {
 
 	LOG_INFO(MSGID_PLUGIN_LOADER, 0 , "Loooking for plugins in %s",
@@ -40,6 +112,12 @@ PluginLoader::PluginLoader(const std::string &_pluginPath):
 		return; // No plugins
 	}
 
+	this->openPool = g_thread_pool_new(PluginLoader::openWorker, this,
+	                                   workerThreads(), FALSE, nullptr);
+
+	PluginCache cache{cacheFile};
+	std::vector<DiscoveryJob *> jobs;
+
 	while (const gchar *filename = g_dir_read_name(dir.get()))
 	{
 		if (!g_str_has_suffix(filename, ".so"))
@@ -47,60 +125,588 @@ PluginLoader::PluginLoader(const std::string &_pluginPath):
 			continue;
 		}
 
-		std::string filePath = g_build_path("/", this->pluginPath.c_str(), filename,
-		                                    NULL);
-		LOG_INFO(MSGID_PLUGIN_LOADER, 0, "Loading file: %s", filePath.c_str());
+		//strip the .so part
+		std::string name{filename, strlen(filename) - 3};
 
-		std::unique_ptr<void, std::function<void(void *)>> handle { dlopen(filePath.c_str(), RTLD_NOW), dlclose};
+		DiscoveryJob *job = new DiscoveryJob();
 
-		if (!handle.get())
+		if (!this->statPlugin(name, *job))
 		{
-			LOG_CRITICAL(MSGID_PLUGIN_LOADER, 0, "Failed to load plugin file: %s",
-			             filePath.c_str());
+			LOG_CRITICAL(MSGID_PLUGIN_LOADER, 0, "Failed to stat plugin file: %s",
+			             job->info.path.c_str());
+			delete job;
 			continue;
 		}
 
-		auto services = reinterpret_cast<const char **>(dlsym(handle.get(),
-		                "requiredServices"));
-		auto instantiateFunc =
-		    reinterpret_cast<EventMonitor::Plugin* (*)(int, EventMonitor::Manager *)>(dlsym(
-		                handle.get(), "instantiatePlugin"));
-
-		if (!services || !instantiateFunc)
+		if (cache.lookup(job->key, job->info))
 		{
-			LOG_CRITICAL(MSGID_PLUGIN_LOADER, 0,
-			             "Failed to find plugin methods, requiredServices and instantiatePlugin.");
+			LOG_INFO(MSGID_PLUGIN_LOADER, 0, "Found cached plugin: %s", job->info.path.c_str());
+			this->fileKeys[job->info.path] = job->key;
+			this->plugins.push_back(job->info);
+			delete job;
 			continue;
 		}
 
-		//strip the .so part
-		std::string name{filename, strlen(filename) - 3};
+		jobs.push_back(job);
+	}
 
-		PluginInfo info;
-		info.name = name;
-		info.path = std::string(filePath);
-		info.dlHandle = nullptr;
+	// Manifests and libraries are read in parallel, the cache is only
+	// touched from this thread.
+	GThreadPool *discoveryPool = nullptr;
 
-		for (size_t pos = 0; services[pos]; pos += 1)
+	if (jobs.size() > 1)
+	{
+		discoveryPool = g_thread_pool_new(PluginLoader::discoverWorker, nullptr,
+		                                  std::min<unsigned int>(workerThreads(), jobs.size()),
+		                                  TRUE, nullptr);
+	}
+
+	for (DiscoveryJob *job : jobs)
+	{
+		if (!discoveryPool || !g_thread_pool_push(discoveryPool, job, nullptr))
 		{
-			info.requiredServices.push_back(std::string(services[pos]));
+			PluginLoader::discoverWorker(job, nullptr);
 		}
+	}
 
-		this->plugins.push_back(info);
+	if (discoveryPool)
+	{
+		// Waits for all jobs.
+		g_thread_pool_free(discoveryPool, FALSE, TRUE);
 	}
 
+	for (DiscoveryJob *job : jobs)
+	{
+		if (job->found)
+		{
+			cache.store(job->key, job->info);
+			this->fileKeys[job->info.path] = job->key;
+			this->plugins.push_back(job->info);
+		}
+
+		delete job;
+	}
+
+	cache.save();
 };
 
-const std::vector<PluginInfo> *PluginLoader::getPlugins()
+/**
+ * Fill in plugin path and file key for the plugin name.
+ * @return false if the plugin file does not exist.
+ */
+bool PluginLoader::statPlugin(const std::string &name, DiscoveryJob &job)
+{
+	job.loader = this;
+	job.found = false;
+	job.info.name = name;
+	job.info.path = buildPath(this->pluginPath, name + ".so");
+	job.info.dlHandle = nullptr;
+	job.manifestPath = buildPath(this->pluginPath, name + ".json");
+
+	struct stat fileStat;
+	struct stat manifestStat;
+
+	if (stat(job.info.path.c_str(), &fileStat) != 0)
+	{
+		return false;
+	}
+
+	job.hasManifest = stat(job.manifestPath.c_str(), &manifestStat) == 0;
+	job.key.inode = fileStat.st_ino;
+	job.key.size = fileStat.st_size;
+	job.key.mtimeNs = mtimeNsOf(fileStat);
+	job.key.manifestMtimeNs = job.hasManifest ? mtimeNsOf(manifestStat) : 0;
+	return true;
+}
+
+void PluginLoader::discoverWorker(gpointer data, gpointer userData UNUSED_VAR)
+{
+	DiscoveryJob *job = reinterpret_cast<DiscoveryJob *>(data);
+
+	if (job->hasManifest && job->loader->readManifest(job->manifestPath, job->info))
+	{
+		LOG_INFO(MSGID_PLUGIN_LOADER, 0, "Found plugin manifest: %s",
+		         job->manifestPath.c_str());
+		job->found = true;
+	}
+	else
+	{
+		job->found = job->loader->readLibrary(job->info);
+	}
+}
+
+bool PluginLoader::readManifest(const std::string &manifestPath, PluginInfo &info)
+{
+	pbnjson::JValue manifest = pbnjson::JDomParser::fromFile(manifestPath.c_str(),
+	                           pbnjson::JSchema::AllSchema());
+
+	if (!manifest.isObject() || !pluginMetadataFromJson(manifest, info))
+	{
+		LOG_ERROR(MSGID_PLUGIN_LOADER, 0, "Invalid plugin manifest: %s",
+		          manifestPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool PluginLoader::readLibrary(PluginInfo &info)
+{
+	LOG_INFO(MSGID_PLUGIN_LOADER, 0, "Loading file: %s", info.path.c_str());
+
+	// Only reading the symbols, lazy binding is enough.
+	std::unique_ptr<void, std::function<void(void *)>> handle { dlopen(info.path.c_str(), RTLD_LAZY), dlclose};
+
+	if (!handle.get())
+	{
+		LOG_CRITICAL(MSGID_PLUGIN_LOADER, 0, "Failed to load plugin file: %s",
+		             info.path.c_str());
+		return false;
+	}
+
+	auto services = reinterpret_cast<const char **>(dlsym(handle.get(),
+	                "requiredServices"));
+	auto instantiateFunc =
+	    reinterpret_cast<EventMonitor::Plugin* (*)(int, EventMonitor::Manager *)>(dlsym(
+	                handle.get(), "instantiatePlugin"));
+
+	if (!services || !instantiateFunc)
+	{
+		LOG_CRITICAL(MSGID_PLUGIN_LOADER, 0,
+		             "Failed to find plugin methods, requiredServices and instantiatePlugin.");
+		return false;
+	}
+
+	info.requiredServices.clear();
+
+	for (size_t pos = 0; services[pos]; pos += 1)
+	{
+		info.requiredServices.push_back(std::string(services[pos]));
+	}
+
+	return true;
+}
+
+PluginLoader::~PluginLoader()
+{
+	if (this->inotifySource)
+	{
+		g_source_remove(this->inotifySource);
+		this->inotifySource = 0;
+	}
+
+	if (this->reloadTimer)
+	{
+		g_source_remove(this->reloadTimer);
+		this->reloadTimer = 0;
+	}
+
+	if (this->openPool)
+	{
+		// Drop queued requests, wait for the running ones.
+		g_thread_pool_free(this->openPool, TRUE, TRUE);
+		this->openPool = nullptr;
+	}
+
+	for (OpenRequest *request : this->openRequests)
+	{
+		if (request->source)
+		{
+			g_source_remove(request->source);
+		}
+
+		if (request->dlHandle)
+		{
+			dlclose(request->dlHandle);
+		}
+
+		delete request;
+	}
+
+	this->openRequests.clear();
+
+	for (const auto &opened : this->openedModules)
+	{
+		dlclose(opened.second);
+	}
+
+	this->openedModules.clear();
+
+	(void) this->releaseResidentModules();
+}
+
+const PluginList *PluginLoader::getPlugins()
 {
 	return &this->plugins;
 }
 
+bool PluginLoader::watchPluginPath(PluginChangeListener listener)
+{
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (fd < 0)
+	{
+		LOG_WARNING(MSGID_PLUGIN_LOADER, 0, "Failed to initialize inotify: %s",
+		            strerror(errno));
+		return false;
+	}
+
+	if (inotify_add_watch(fd, this->pluginPath.c_str(),
+	                      IN_CREATE | IN_CLOSE_WRITE | IN_DELETE |
+	                      IN_MOVED_FROM | IN_MOVED_TO) < 0)
+	{
+		LOG_WARNING(MSGID_PLUGIN_LOADER, 0, "Failed to watch plugin directory %s: %s",
+		            this->pluginPath.c_str(), strerror(errno));
+		close(fd);
+		return false;
+	}
+
+	GIOChannel *channel = g_io_channel_unix_new(fd);
+	g_io_channel_set_close_on_unref(channel, TRUE);
+	g_io_channel_set_encoding(channel, NULL, NULL);
+	g_io_channel_set_buffered(channel, FALSE);
+
+	this->changeListener = listener;
+	this->inotifySource = g_io_add_watch(channel,
+	                                     static_cast<GIOCondition>(G_IO_IN | G_IO_HUP
+	                                             | G_IO_ERR | G_IO_NVAL),
+	                                     PluginLoader::inotifyCallback, this);
+	g_io_channel_unref(channel);
+
+	LOG_INFO(MSGID_PLUGIN_LOADER, 0, "Watching %s for plugin changes",
+	         this->pluginPath.c_str());
+	return true;
+}
+
+gboolean PluginLoader::inotifyCallback(GIOChannel *channel, GIOCondition cond,
+                                       gpointer userData)
+{
+	auto loader = reinterpret_cast<PluginLoader *>(userData);
+
+	if (cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP))
+	{
+		loader->inotifySource = 0;
+		return G_SOURCE_REMOVE;
+	}
+
+	alignas(struct inotify_event) char buffer[4096];
+	ssize_t length;
+
+	while ((length = read(g_io_channel_unix_get_fd(channel), buffer, sizeof(buffer))) > 0)
+	{
+		for (char *pos = buffer; pos < buffer + length;
+		        pos += sizeof(struct inotify_event) + reinterpret_cast<struct inotify_event *>(pos)->len)
+		{
+			auto event = reinterpret_cast<struct inotify_event *>(pos);
+
+			if (event->len == 0)
+			{
+				continue;
+			}
+
+			const char *filename = event->name;
+
+			if (g_str_has_suffix(filename, ".so"))
+			{
+				loader->changedPlugins.insert(std::string(filename, strlen(filename) - 3));
+			}
+			else if (g_str_has_suffix(filename, ".json"))
+			{
+				loader->changedPlugins.insert(std::string(filename, strlen(filename) - 5));
+			}
+		}
+	}
+
+	if (!loader->changedPlugins.empty())
+	{
+		if (loader->reloadTimer)
+		{
+			g_source_remove(loader->reloadTimer);
+		}
+
+		loader->reloadTimer = g_timeout_add(RELOAD_DELAY_MS,
+		                                    PluginLoader::reloadCallback, loader);
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+gboolean PluginLoader::reloadCallback(gpointer userData)
+{
+	auto loader = reinterpret_cast<PluginLoader *>(userData);
+	loader->reloadTimer = 0;
+
+	std::set<std::string> changed;
+	changed.swap(loader->changedPlugins);
+
+	for (const std::string &name : changed)
+	{
+		loader->reloadPlugin(name);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * Compare plugin files with the list and report the difference.
+ */
+void PluginLoader::reloadPlugin(const std::string &name)
+{
+	DiscoveryJob job;
+	bool exists = this->statPlugin(name, job);
+	size_t index = 0;
+
+	while (index < this->plugins.size() && this->plugins[index].path != job.info.path)
+	{
+		index++;
+	}
+
+	bool known = index < this->plugins.size() && !this->plugins[index].removed;
+
+	if (exists && known && this->fileKeys[job.info.path] == job.key)
+	{
+		// Only touched.
+		return;
+	}
+
+	if (exists)
+	{
+		job.found = (job.hasManifest && this->readManifest(job.manifestPath, job.info)) ||
+		            this->readLibrary(job.info);
+	}
+
+	if (known)
+	{
+		LOG_INFO(MSGID_PLUGIN_LOADER, 0, "Plugin %s %s", job.info.path.c_str(),
+		         job.found ? "changed, reloading" : "removed");
+
+		this->changeListener(index, PLUGIN_REMOVED);
+		this->forgetModule(job.info.path);
+		this->plugins[index].removed = true;
+		this->fileKeys.erase(job.info.path);
+	}
+
+	if (!job.found)
+	{
+		return;
+	}
+
+	if (!known)
+	{
+		LOG_INFO(MSGID_PLUGIN_LOADER, 0, "Plugin %s added", job.info.path.c_str());
+	}
+
+	if (index == this->plugins.size())
+	{
+		this->plugins.push_back(job.info);
+	}
+	else
+	{
+		// Same slot, pointers to the PluginInfo stay valid.
+		this->plugins[index] = job.info;
+	}
+
+	this->fileKeys[job.info.path] = job.key;
+	this->changeListener(index, PLUGIN_ADDED);
+}
+
+/**
+ * Close the old library of a removed or changed plugin, so that the
+ * next load maps the new file.
+ */
+void PluginLoader::forgetModule(const std::string &path)
+{
+	this->generations[path] += 1;
+	this->closeResidentModule(path);
+
+	auto opened = this->openedModules.find(path);
+
+	if (opened != this->openedModules.end())
+	{
+		dlclose(opened->second);
+		this->openedModules.erase(opened);
+	}
+
+	// Libraries with unique symbols or RTLD_NODELETE stay loaded and dlopen
+	// would return the old code for the same path.
+	void *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_NOLOAD);
+
+	if (handle)
+	{
+		LOG_WARNING(MSGID_PLUGIN_LOADER, 0,
+		            "Old version of %s can not be unmapped, restart to use the new one",
+		            path.c_str());
+		dlclose(handle);
+	}
+}
+
+void PluginLoader::openPlugin(const PluginInfo *info, OpenCallback callback)
+{
+	if (!this->openPool ||
+	        this->residentModules.count(info->path) > 0 ||
+	        this->openedModules.count(info->path) > 0)
+	{
+		// Already mapped or no workers, loadPlugin will take care of it.
+		callback(true);
+		return;
+	}
+
+	OpenRequest *request = new OpenRequest();
+	request->loader = this;
+	request->path = info->path;
+	request->generation = this->generations[info->path];
+	request->dlHandle = nullptr;
+	request->callback = callback;
+	request->source = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(this->openMutex);
+		this->openRequests.insert(request);
+	}
+
+	LOG_DEBUG("Opening plugin %s on worker thread", info->path.c_str());
+
+	if (!g_thread_pool_push(this->openPool, request, nullptr))
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->openMutex);
+			this->openRequests.erase(request);
+		}
+
+		delete request;
+		callback(true);
+	}
+}
+
+void PluginLoader::openWorker(gpointer data, gpointer userData)
+{
+	OpenRequest *request = reinterpret_cast<OpenRequest *>(data);
+	PluginLoader *loader = reinterpret_cast<PluginLoader *>(userData);
+
+	// dlopen maps and relocates under the dynamic linker lock,
+	// read the file into page cache before taking it.
+	int fd = open(request->path.c_str(), O_RDONLY | O_CLOEXEC);
+
+	if (fd >= 0)
+	{
+		(void) posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		close(fd);
+	}
+
+	void *handle = dlopen(request->path.c_str(), RTLD_NOW);
+
+	if (!handle)
+	{
+		LOG_CRITICAL(MSGID_PLUGIN_LOADER, 0, "Failed to load plugin file: %s, %s",
+		             request->path.c_str(), dlerror());
+	}
+	else if (!dlsym(handle, "instantiatePlugin"))
+	{
+		LOG_CRITICAL(MSGID_PLUGIN_LOADER, 0,
+		             "Failed to find plugin method instantiatePlugin in %s.",
+		             request->path.c_str());
+		dlclose(handle);
+		handle = nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(loader->openMutex);
+	request->dlHandle = handle;
+	request->source = g_idle_add(PluginLoader::openDone, request);
+}
+
+gboolean PluginLoader::openDone(gpointer userData)
+{
+	OpenRequest *request = reinterpret_cast<OpenRequest *>(userData);
+	PluginLoader *loader = request->loader;
+	std::string path = request->path;
+	OpenCallback callback = request->callback;
+	bool success = request->dlHandle != nullptr;
+
+	if (request->generation != loader->generations[path])
+	{
+		// Plugin file changed while opening, open the new one.
+		std::lock_guard<std::mutex> lock(loader->openMutex);
+
+		if (request->dlHandle)
+		{
+			dlclose(request->dlHandle);
+		}
+
+		request->generation = loader->generations[path];
+		request->dlHandle = nullptr;
+		request->source = 0;
+
+		if (g_thread_pool_push(loader->openPool, request, nullptr))
+		{
+			return G_SOURCE_REMOVE;
+		}
+
+		// Let loadPlugin open it.
+		success = true;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(loader->openMutex);
+		loader->openRequests.erase(request);
+	}
+
+	if (request->dlHandle)
+	{
+		if (loader->openedModules.count(path) > 0)
+		{
+			// Opened twice, only drops the reference count.
+			dlclose(request->dlHandle);
+		}
+		else
+		{
+			loader->openedModules[path] = request->dlHandle;
+		}
+	}
+
+	delete request;
+	callback(success);
+
+	// Not instantiated, keep it like an unloaded plugin.
+	auto opened = loader->openedModules.find(path);
+
+	if (opened != loader->openedModules.end())
+	{
+		void *handle = opened->second;
+		loader->openedModules.erase(opened);
+		loader->keepResident(path, handle);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
 Plugin *PluginLoader::loadPlugin(const PluginInfo *info, Manager *manager)
 {
 	LOG_INFO(MSGID_PLUGIN_LOADED, 0, "Loading plugin %s", info->path.c_str());
 
-	void *handle = dlopen(info->path.c_str(), RTLD_NOW);
+	void *handle = nullptr;
+	auto resident = this->residentModules.find(info->path);
+	auto opened = this->openedModules.find(info->path);
+
+	if (resident != this->residentModules.end())
+	{
+		// Still mapped, no need to open and relocate again.
+		handle = resident->second.dlHandle;
+		this->residentSize -= resident->second.mappedSize;
+		this->residentModules.erase(resident);
+		this->cacheHits += 1;
+	}
+	else if (opened != this->openedModules.end())
+	{
+		// Opened by a worker thread.
+		handle = opened->second;
+		this->openedModules.erase(opened);
+		this->cacheMisses += 1;
+	}
+	else
+	{
+		handle = dlopen(info->path.c_str(), RTLD_NOW);
+		this->cacheMisses += 1;
+	}
 
 	if (!handle)
 	{
@@ -147,6 +753,179 @@ void PluginLoader::unloadPlugin(const PluginInfo *info)
 		return;
 	}
 
-	dlclose(info->dlHandle);
+	void *handle = info->dlHandle;
 	const_cast<PluginInfo *>(info)->dlHandle = nullptr;
+
+	this->keepResident(info->path, handle);
+}
+
+/**
+ * Keep the library of an unloaded plugin mapped for the grace period.
+ */
+void PluginLoader::keepResident(const std::string &path, void *handle)
+{
+	if (this->graceSeconds == 0)
+	{
+		dlclose(handle);
+		return;
+	}
+
+	ResidentModule &module = this->residentModules[path];
+	module.dlHandle = handle;
+	module.releasedAt = g_get_monotonic_time();
+	module.mappedSize = getMappedSize(path);
+	this->residentSize += module.mappedSize;
+
+	LOG_DEBUG("Keeping plugin %s mapped, %zu bytes", path.c_str(),
+	          module.mappedSize);
+
+	// Make room within the budget, oldest first.
+	this->evictResidentModules(0, this->budgetBytes);
+	this->scheduleExpiry();
+}
+
+void PluginLoader::setModuleCachePolicy(unsigned int _graceSeconds,
+                                        size_t _budgetBytes)
+{
+	this->graceSeconds = _graceSeconds;
+	this->budgetBytes = _budgetBytes;
+
+	if (this->graceSeconds == 0)
+	{
+		(void) this->releaseResidentModules();
+	}
+	else
+	{
+		this->evictResidentModules(0, this->budgetBytes);
+		this->scheduleExpiry();
+	}
+}
+
+size_t PluginLoader::releaseResidentModules()
+{
+	size_t released = this->residentSize;
+
+	while (!this->residentModules.empty())
+	{
+		this->closeResidentModule(this->residentModules.begin()->first);
+		this->evictions += 1;
+	}
+
+	if (this->expireTimer != 0)
+	{
+		g_source_remove(this->expireTimer);
+		this->expireTimer = 0;
+	}
+
+	return released;
+}
+
+void PluginLoader::closeResidentModule(const std::string &path)
+{
+	auto iter = this->residentModules.find(path);
+
+	if (iter == this->residentModules.end())
+	{
+		return;
+	}
+
+	LOG_DEBUG("Closing plugin library %s", path.c_str());
+
+	dlclose(iter->second.dlHandle);
+	this->residentSize -= iter->second.mappedSize;
+	this->residentModules.erase(iter);
+}
+
+/**
+ * Close libraries released before expiredBefore and the oldest ones
+ * until the total size fits the budget.
+ */
+void PluginLoader::evictResidentModules(gint64 expiredBefore, size_t budget)
+{
+	while (!this->residentModules.empty())
+	{
+		auto oldest = this->residentModules.begin();
+
+		for (auto iter = this->residentModules.begin();
+		        iter != this->residentModules.end(); ++iter)
+		{
+			if (iter->second.releasedAt < oldest->second.releasedAt)
+			{
+				oldest = iter;
+			}
+		}
+
+		bool expired = oldest->second.releasedAt < expiredBefore;
+
+		if (!expired && this->residentSize <= budget)
+		{
+			break;
+		}
+
+		this->closeResidentModule(oldest->first);
+
+		if (expired)
+		{
+			this->expiries += 1;
+		}
+		else
+		{
+			this->evictions += 1;
+		}
+	}
+}
+
+/**
+ * Set the expire timer to when the oldest kept library expires.
+ */
+void PluginLoader::scheduleExpiry()
+{
+	if (this->expireTimer != 0)
+	{
+		g_source_remove(this->expireTimer);
+		this->expireTimer = 0;
+	}
+
+	if (this->residentModules.empty())
+	{
+		return;
+	}
+
+	gint64 oldest = this->residentModules.begin()->second.releasedAt;
+
+	for (const auto &module : this->residentModules)
+	{
+		oldest = std::min(oldest, module.second.releasedAt);
+	}
+
+	gint64 graceUs = static_cast<gint64>(this->graceSeconds) * G_USEC_PER_SEC;
+	gint64 delayUs = std::max<gint64>(oldest + graceUs - g_get_monotonic_time(), 0);
+
+	this->expireTimer = g_timeout_add((delayUs + 999) / 1000,
+	                                  PluginLoader::expireCallback, this);
+}
+
+gboolean PluginLoader::expireCallback(gpointer userData)
+{
+	auto loader = reinterpret_cast<PluginLoader *>(userData);
+	gint64 graceUs = static_cast<gint64>(loader->graceSeconds) * G_USEC_PER_SEC;
+
+	loader->expireTimer = 0;
+	loader->evictResidentModules(g_get_monotonic_time() - graceUs + 1,
+	                             loader->budgetBytes);
+	loader->scheduleExpiry();
+	return G_SOURCE_REMOVE;
+}
+
+pbnjson::JValue PluginLoader::getModuleCacheStats()
+{
+	return pbnjson::JObject{
+		{"hits", pbnjson::JValue(static_cast<int64_t>(this->cacheHits))},
+		{"misses", pbnjson::JValue(static_cast<int64_t>(this->cacheMisses))},
+		{"evictions", pbnjson::JValue(static_cast<int64_t>(this->evictions))},
+		{"expiries", pbnjson::JValue(static_cast<int64_t>(this->expiries))},
+		{"residentModules", pbnjson::JValue(static_cast<int64_t>(this->residentModules.size()))},
+		{"residentBytes", pbnjson::JValue(static_cast<int64_t>(this->residentSize))},
+		{"graceSeconds", pbnjson::JValue(static_cast<int64_t>(this->graceSeconds))},
+		{"budgetBytes", pbnjson::JValue(static_cast<int64_t>(this->budgetBytes))}};
 }
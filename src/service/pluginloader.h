@@ -16,27 +16,199 @@
 
 #pragma once
 
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <string>
 #include <vector>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <glib.h>
 #include <event-monitor-api/api.h>
 
 #include "plugininfo.h"
+#include "plugincache.h"
 
 using namespace EventMonitor;
 
+/**
+ * Called on the main loop once the plugin library is opened.
+ */
+typedef std::function<void(bool success)> OpenCallback;
+
+/**
+ * Plugins are never removed from the list, so indexes and PluginInfo
+ * pointers stay valid while plugins are added and reloaded.
+ */
+typedef std::deque<PluginInfo> PluginList;
+
+enum PluginChange
+{
+	PLUGIN_ADDED,
+	PLUGIN_REMOVED
+};
+
+/**
+ * Called on the main loop when a plugin file changes.
+ * Changed plugin is first removed and then added again.
+ */
+typedef std::function<void(size_t pluginIndex, PluginChange change)> PluginChangeListener;
+
+class PluginLoader;
+
+/**
+ * Plugin without cached metadata, examined on a worker thread.
+ */
+class DiscoveryJob
+{
+public:
+	PluginLoader *loader;
+	PluginInfo info;
+	PluginFileKey key;
+	std::string manifestPath;
+	bool hasManifest;
+	bool found;
+};
+
+/**
+ * Plugin library opened on a worker thread.
+ */
+class OpenRequest
+{
+public:
+	PluginLoader *loader;
+	std::string path;
+	unsigned int generation; // plugin file version when requested
+	void *dlHandle; // null if failed
+	OpenCallback callback;
+	guint source; // result idle source, 0 while opening
+};
+
+/**
+ * Shared library kept mapped after its plugin instance was destroyed.
+ */
+class ResidentModule
+{
+public:
+	void *dlHandle;
+	gint64 releasedAt; // monotonic time, us
+	size_t mappedSize;
+};
+
 /**
  * Manages list of available plugins and performs the actual loading unloading.
+ * Unloaded plugin libraries are kept mapped for a grace period, within
+ * a memory budget, so that plugins of flapping services are reloaded
+ * without dlopen.
+ * Reading plugin metadata and opening plugin libraries is done on
+ * a bounded pool of worker threads, plugins are instantiated on the
+ * main loop only.
  */
 class PluginLoader
 {
 public:
-	PluginLoader(const std::string &pluginPath);
+	/**
+	 * Discover plugins in pluginPath.
+	 * Plugin metadata is read from the cache file, or from <name>.json
+	 * manifest next to the plugin, so the plugins do not need to be opened.
+	 * Plugins without a manifest are opened once to read requiredServices.
+	 * Plugins missing from the cache are examined in parallel.
+	 */
+	PluginLoader(const std::string &pluginPath, const std::string &cacheFile);
+
+	~PluginLoader();
+
+	PluginLoader(const PluginLoader &) = delete;
+	PluginLoader &operator=(const PluginLoader &) = delete;
+
+	const PluginList *getPlugins();
+
+	/**
+	 * Watch the plugin directory with inotify. Added, changed and removed
+	 * plugins and manifests are reported once the directory is quiet,
+	 * one plugin at a time.
+	 * @return false if the directory can not be watched.
+	 */
+	bool watchPluginPath(PluginChangeListener listener);
 
-	const std::vector<PluginInfo> *getPlugins();
+	/**
+	 * Open and relocate the plugin library on a worker thread.
+	 * The callback is called on the main loop, possibly right away if the
+	 * library is still mapped. If the callback does not call loadPlugin,
+	 * the library is kept like an unloaded plugin.
+	 */
+	void openPlugin(const PluginInfo *info, OpenCallback callback);
+
+	/**
+	 * Instantiate the plugin, opening the library unless openPlugin
+	 * already did.
+	 */
 	Plugin *loadPlugin(const PluginInfo *info, Manager *manager);
 	void unloadPlugin(const PluginInfo *info);
 
+	/**
+	 * Set how long and how much of unloaded plugin libraries is kept mapped.
+	 * @param graceSeconds - time to keep the library, 0 to close immediately.
+	 * @param budgetBytes - maximum total mapped size of kept libraries.
+	 */
+	void setModuleCachePolicy(unsigned int graceSeconds, size_t budgetBytes);
+
+	/**
+	 * Close all kept libraries that are not in use.
+	 * @returns - number of bytes unmapped.
+	 */
+	size_t releaseResidentModules();
+
+	pbnjson::JValue getModuleCacheStats();
+
+private:
+	bool statPlugin(const std::string &name, DiscoveryJob &job);
+	bool readManifest(const std::string &manifestPath, PluginInfo &info);
+	bool readLibrary(PluginInfo &info);
+	static gboolean inotifyCallback(GIOChannel *channel, GIOCondition cond,
+	                                gpointer userData);
+	static gboolean reloadCallback(gpointer userData);
+	void reloadPlugin(const std::string &name);
+	void forgetModule(const std::string &path);
+	static void discoverWorker(gpointer data, gpointer userData);
+	static void openWorker(gpointer data, gpointer userData);
+	static gboolean openDone(gpointer userData);
+
+	void keepResident(const std::string &path, void *handle);
+	void closeResidentModule(const std::string &path);
+	void evictResidentModules(gint64 expiredBefore, size_t budget);
+	void scheduleExpiry();
+	static gboolean expireCallback(gpointer userData);
+
 private:
 	const std::string pluginPath;
-	std::vector<PluginInfo> plugins;
+	PluginList plugins;
+	std::unordered_map<std::string, PluginFileKey> fileKeys;
+
+	// Hot reload
+	PluginChangeListener changeListener;
+	guint inotifySource;
+	guint reloadTimer;
+	std::set<std::string> changedPlugins;
+	// Map plugin path to number of reloads, to drop stale opens.
+	std::unordered_map<std::string, unsigned int> generations;
+
+	GThreadPool *openPool;
+	std::mutex openMutex;
+	std::unordered_set<OpenRequest *> openRequests;
+	// Map plugin path to library opened by openPlugin, not instantiated yet.
+	std::unordered_map<std::string, void *> openedModules;
+
+	// Map plugin path to library kept after unload.
+	std::unordered_map<std::string, ResidentModule> residentModules;
+	size_t residentSize;
+	unsigned int graceSeconds;
+	size_t budgetBytes;
+	guint expireTimer;
+
+	unsigned long long cacheHits;
+	unsigned long long cacheMisses;
+	unsigned long long evictions; // closed for the budget or memory pressure
+	unsigned long long expiries; // closed after the grace period
 };
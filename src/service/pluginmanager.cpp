@@ -14,26 +14,90 @@
 //
 // SPDX-License-Identifier: Apache-2.0
 
+#include <algorithm>
+
 #include "pluginmanager.h"
+#include "remoteplugin.h"
+#include "threadedplugin.h"
 #include "logging.h"
+#include "flightrecorder.h"
+#include "stallwatchdog.h"
+
+using namespace pbnjson;
+
+static const unsigned int IDLE_CHECK_INTERVAL = 10; // seconds
 
 PluginManager::PluginManager(PluginLoader &_loader,
                              LunaService &_lunaService,
                              GMainLoop *_mainLoop):
 	lunaService(_lunaService),
 	mainLoop(_mainLoop),
-	loader(_loader)
+	backgroundPool(std::max(1u, std::min(g_get_num_processors(), MAX_BACKGROUND_THREADS)),
+	               MAX_PLUGIN_BACKGROUND_TASKS),
+	loader(_loader),
+	idleTimeoutSeconds(0),
+	idleTimer(0),
+	isolateAll(false)
 {
 }
 
 PluginManager::~PluginManager()
 {
+	if (this->idleTimer)
+	{
+		g_source_remove(this->idleTimer);
+		this->idleTimer = 0;
+	}
+
+	for (auto &lazy : this->lazyPlugins)
+	{
+		for (SubscribeHandle handle : lazy.second.triggers)
+		{
+			this->lunaService.cancelSubscribe(handle);
+		}
+	}
+
+	this->lazyPlugins.clear();
+
 	while (this->activePlugins.size() > 0)
 	{
 		PluginAdapter *adapter = this->activePlugins.begin()->second;
 		adapter->unloadPlugin();
 		this->processUnload(adapter);
 	}
+
+	// After the plugins running on them are gone.
+	for (auto &thread : this->threads)
+	{
+		delete thread.second;
+	}
+
+	this->threads.clear();
+}
+
+void PluginManager::setIdleTimeout(unsigned int _idleTimeoutSeconds)
+{
+	this->idleTimeoutSeconds = _idleTimeoutSeconds;
+}
+
+void PluginManager::setLoadListener(std::function<void(const PluginInfo *)> listener)
+{
+	this->loadListener = listener;
+}
+
+void PluginManager::setOpenListener(std::function<void(const PluginInfo *)> listener)
+{
+	this->openListener = listener;
+}
+
+void PluginManager::setIsolation(bool _isolateAll)
+{
+	this->isolateAll = _isolateAll;
+}
+
+bool PluginManager::isIsolated(const PluginInfo *info)
+{
+	return this->isolateAll || info->isolated;
 }
 
 /**
@@ -48,27 +112,449 @@ void PluginManager::loadPlugin(const PluginInfo *info,
 		adapter->pluginLoaded(nullptr);
 		this->processUnload(adapter);
 	}
+	else if (info->lazy)
+	{
+		this->armPlugin(info);
+	}
+	else if (this->isIsolated(info))
+	{
+		// Library is opened by the host process.
+		(void) this->instantiatePlugin(info);
+	}
 	else // new plugin
 	{
-		PluginAdapter *adapter = new PluginAdapter(this, info);
-		Plugin *plugin = this->loader.loadPlugin(info, adapter);
+		this->openPlugin(info);
+	}
+}
+
+void PluginManager::openPlugin(const PluginInfo *info)
+{
+	bool opening = this->openingPlugins.count(info->path) > 0;
+	this->openingPlugins[info->path] = true;
+
+	if (opening)
+	{
+		return;
+	}
+
+	this->loader.openPlugin(info, [this, info](bool success)
+	{
+		bool wanted = this->openingPlugins[info->path];
+		this->openingPlugins.erase(info->path);
 
-		if (!plugin)
+		if (!success)
 		{
-			//Plugin loader method successfully called but returned null.
-			// Most likely API incompatibility.
-			LOG_ERROR(MSGID_PLUGIN_LOAD_FAILED,
-			          0,
-			          "Plugin %s instantiatePlugin returned NULL",
+			LOG_ERROR(MSGID_PLUGIN_LOAD_FAILED, 0, "Plugin %s could not be opened",
 			          info->name.c_str());
+		}
+		else if (wanted && !this->isPluginLoaded(info))
+		{
+			(void) this->instantiatePlugin(info);
+		}
+
+		if (this->openListener)
+		{
+			this->openListener(info);
+		}
+	});
+}
+
+PluginThread *PluginManager::getPluginThread(const std::string &name)
+{
+	auto found = this->threads.find(name);
+
+	if (found != this->threads.end())
+	{
+		return found->second;
+	}
+
+	PluginThread *thread = new PluginThread(name);
+	this->threads[name] = thread;
+	return thread;
+}
+
+bool PluginManager::instantiatePlugin(const PluginInfo *info)
+{
+	StallWatchdog::Activity activity(info->name, "load");
+	PluginAdapter *adapter = new PluginAdapter(this, info);
+	Plugin *plugin = nullptr;
+
+	if (this->isIsolated(info))
+	{
+		plugin = RemotePlugin::spawn(adapter, info);
+	}
+	else if (!info->thread.empty())
+	{
+		// The plugin gets the threaded stand-in as its Manager.
+		ThreadedPlugin *threaded = new ThreadedPlugin(adapter,
+		                                              this->getPluginThread(info->thread));
+		Plugin *inner = this->loader.loadPlugin(info, threaded);
+
+		if (inner)
+		{
+			threaded->setPlugin(inner);
+			plugin = threaded;
+		}
+		else
+		{
+			delete threaded;
+		}
+	}
+	else
+	{
+		plugin = this->loader.loadPlugin(info, adapter);
+	}
+
+	if (!plugin)
+	{
+		//Plugin loader method successfully called but returned null.
+		// Most likely API incompatibility.
+		LOG_ERROR(MSGID_PLUGIN_LOAD_FAILED,
+		          0,
+		          "Plugin %s instantiatePlugin returned NULL",
+		          info->name.c_str());
+
+		adapter->cancelAll();
+		this->loader.unloadPlugin(info);
+		delete adapter;
+		return false;
+	}
+
+	this->activePlugins[info->path] = adapter;
+	FlightRecorder::record(FLIGHT_PLUGIN_LOAD, info->name);
+
+	if (this->loadListener)
+	{
+		this->loadListener(info);
+	}
+
+	adapter->pluginLoaded(plugin);
+	this->processUnload(adapter);
+	return this->isPluginLoaded(info);
+}
+
+void PluginManager::armPlugin(const PluginInfo *info)
+{
+	LazyPluginState &lazy = this->lazyPlugins[info->path];
+
+	if (lazy.armed)
+	{
+		return;
+	}
+
+	LOG_DEBUG("Arming lazy plugin %s", info->name.c_str());
+	lazy.armed = true;
+
+	for (const JValue &trigger : info->triggers.items())
+	{
+		std::string serviceUrl;
+		JValue params;
+		bool isSignal = trigger["signal"].isString();
+
+		if (isSignal)
+		{
+			serviceUrl = "luna://com.webos.service.bus/signal/addmatch";
+			params = JObject{{"category", trigger["signal"]}};
+
+			if (trigger["name"].isString())
+			{
+				params.put("method", trigger["name"]);
+			}
+		}
+		else
+		{
+			(void) trigger["method"].asString(serviceUrl);
+			params = trigger["params"].isObject() ? trigger["params"].duplicate() : JObject();
+		}
+
+		try
+		{
+			SubscribeHandle handle = this->lunaService.subscribeToMethod(
+			                             serviceUrl,
+			                             params,
+			                             [this, info, trigger](JValue & previousValue, JValue & value)
+			{
+				this->triggerCallback(info, trigger, previousValue, value);
+			},
+			JSchema::AllSchema(),
+			nullptr,
+			isSignal);
+			lazy.triggers.push_back(handle);
+		}
+		catch (const std::exception &e)
+		{
+			LOG_ERROR(MSGID_PLUGIN_LAZY_ACTIVATION, 0,
+			          "Plugin %s failed to subscribe trigger %s: %s",
+			          info->name.c_str(), trigger.stringify().c_str(), e.what());
+		}
+	}
+
+	for (const JValue &method : info->methods.items())
+	{
+		std::string category;
+		std::string name;
+		(void) method["category"].asString(category);
+		(void) method["name"].asString(name);
+
+		try
+		{
+			this->lunaService.registerLazyMethod(category,
+			                                     name,
+			                                     [this, info]()
+			{
+				this->activatePlugin(info);
+			});
+		}
+		catch (const std::exception &e)
+		{
+			LOG_ERROR(MSGID_PLUGIN_LAZY_ACTIVATION, 0,
+			          "Plugin %s failed to register method %s: %s",
+			          info->name.c_str(), method.stringify().c_str(), e.what());
+		}
+	}
+}
+
+void PluginManager::disarmPlugin(const PluginInfo *info)
+{
+	if (this->lazyPlugins.count(info->path) == 0)
+	{
+		return;
+	}
+
+	LazyPluginState &lazy = this->lazyPlugins[info->path];
+
+	LOG_DEBUG("Disarming lazy plugin %s", info->name.c_str());
+
+	for (SubscribeHandle handle : lazy.triggers)
+	{
+		this->lunaService.cancelSubscribe(handle);
+	}
+
+	// Lazy methods stay on the bus, their activator does nothing while disarmed.
+	lazy.triggers.clear();
+	lazy.armed = false;
+}
+
+void PluginManager::activatePlugin(const PluginInfo *info)
+{
+	if (this->isPluginLoaded(info) ||
+	        this->lazyPlugins.count(info->path) == 0 ||
+	        !this->lazyPlugins[info->path].armed)
+	{
+		return;
+	}
+
+	LOG_INFO(MSGID_PLUGIN_LAZY_ACTIVATION, 0, "Activating lazy plugin %s",
+	         info->name.c_str());
+
+	if (this->instantiatePlugin(info) && !this->idleTimer)
+	{
+		this->idleTimer = g_timeout_add_seconds(IDLE_CHECK_INTERVAL,
+		                                        PluginManager::idleCallback,
+		                                        this);
+	}
+}
+
+void PluginManager::triggerCallback(const PluginInfo *info,
+                                    const JValue &trigger,
+                                    JValue &previousValue,
+                                    JValue &value)
+{
+	bool isSignal = trigger["signal"].isString();
+
+	// First response of a method subscription is the current state, not an event.
+	if (!isSignal && previousValue.isNull())
+	{
+		return;
+	}
 
-			this->loader.unloadPlugin(info);
-			delete adapter;
-			return;
+	if (trigger["match"].isObject())
+	{
+		for (const auto &match : trigger["match"].children())
+		{
+			std::string key;
+			(void) match.first.asString(key);
+
+			if (value[key] != match.second)
+			{
+				return;
+			}
+		}
+	}
+
+	if (this->isPluginLoaded(info))
+	{
+		// Plugin has its own subscriptions, just restart it if it was stopped.
+		PluginAdapter *adapter = this->activePlugins[info->path];
+		adapter->pluginLoaded(nullptr);
+		this->processUnload(adapter);
+		return;
+	}
+
+	this->activatePlugin(info);
+
+	// Signals are not repeated, deliver the one that woke the plugin.
+	// Method subscriptions get the current state as first response anyway.
+	if (isSignal && this->isPluginLoaded(info))
+	{
+		std::string category;
+		std::string name;
+		(void) trigger["signal"].asString(category);
+		(void) trigger["name"].asString(name);
+
+		PluginAdapter *adapter = this->activePlugins[info->path];
+		adapter->replaySignal(category, name, value);
+		this->processUnload(adapter);
+	}
+}
+
+gboolean PluginManager::idleCallback(gpointer userData)
+{
+	auto manager = reinterpret_cast<PluginManager *>(userData);
+	manager->unloadIdlePlugins();
+
+	for (const auto &plugin : manager->activePlugins)
+	{
+		if (plugin.second->getInfo()->lazy)
+		{
+			return G_SOURCE_CONTINUE;
+		}
+	}
+
+	manager->idleTimer = 0;
+	return G_SOURCE_REMOVE;
+}
+
+void PluginManager::unloadIdlePlugins()
+{
+	gint64 now = g_get_monotonic_time();
+	std::vector<PluginAdapter *> idle;
+
+	for (const auto &plugin : this->activePlugins)
+	{
+		PluginAdapter *adapter = plugin.second;
+		const PluginInfo *info = adapter->getInfo();
+		unsigned int timeout = info->idleTimeout ? info->idleTimeout : this->idleTimeoutSeconds;
+
+		if (info->lazy && timeout > 0 &&
+		        now - adapter->getLastActivity() >= static_cast<gint64>(timeout) * G_USEC_PER_SEC)
+		{
+			idle.push_back(adapter);
+		}
+	}
+
+	(void) this->unloadLazyPlugins(idle);
+}
+
+JValue PluginManager::getQueueStats()
+{
+	JValue stats = JObject();
+
+	for (const auto &active : this->activePlugins)
+	{
+		PluginAdapter *adapter = active.second;
+		JValue queues = JObject{
+			{"posted", adapter->getPostStats().toJson()},
+			{"background", JValue(static_cast<int64_t>(
+			                   this->backgroundPool.getPendingCount(adapter)))}};
+		stats.put(adapter->getInfo()->name, queues);
+	}
+
+	return stats;
+}
+
+PluginMetrics *PluginManager::getPluginMetrics(const PluginInfo *pluginInfo)
+{
+	return &this->metrics[pluginInfo->name];
+}
+
+JValue PluginManager::getMetrics()
+{
+	JValue result = JObject();
+
+	for (const auto &entry : this->metrics)
+	{
+		JValue plugin = entry.second.toJson();
+		plugin.put("loaded", false);
+		result.put(entry.first, plugin);
+	}
+
+	for (const auto &active : this->activePlugins)
+	{
+		PluginAdapter *adapter = active.second;
+		JValue plugin = result[adapter->getInfo()->name];
+		plugin.put("loaded", true);
+		plugin.put("active", adapter->getActiveCounts());
+	}
+
+	return result;
+}
+
+void PluginManager::recordNotification(const std::string &pluginName, const char *kind,
+                                       const EventOrigin &origin)
+{
+	this->notificationLatency.record(pluginName, kind, origin);
+}
+
+JValue PluginManager::getNotificationLatency()
+{
+	return this->notificationLatency.toJson();
+}
+
+unsigned int PluginManager::releaseIdlePlugins(unsigned int idleSeconds)
+{
+	gint64 now = g_get_monotonic_time();
+	std::vector<PluginAdapter *> idle;
+
+	for (const auto &plugin : this->activePlugins)
+	{
+		PluginAdapter *adapter = plugin.second;
+
+		if (adapter->getInfo()->lazy &&
+		        now - adapter->getLastActivity() >= static_cast<gint64>(idleSeconds) * G_USEC_PER_SEC)
+		{
+			idle.push_back(adapter);
+		}
+	}
+
+	return this->unloadLazyPlugins(idle);
+}
+
+unsigned int PluginManager::unloadLazyPlugins(const std::vector<PluginAdapter *> &adapters)
+{
+	unsigned int unloaded = 0;
+
+	for (PluginAdapter *adapter : adapters)
+	{
+		const PluginInfo *info = adapter->getInfo();
+
+		LOG_INFO(MSGID_PLUGIN_LAZY_ACTIVATION, 0, "Unloading idle lazy plugin %s",
+		         info->name.c_str());
+
+		adapter->notifyPluginShouldUnload("");
+
+		// Plugin may cancel the unload, give it another idle period.
+		adapter->markActive();
+		this->processUnload(adapter);
+
+		if (!this->isPluginLoaded(info))
+		{
+			unloaded += 1;
 		}
+	}
+
+	return unloaded;
+}
 
-		this->activePlugins[info->path] = adapter;
-		adapter->pluginLoaded(plugin);
+void PluginManager::trimMemory()
+{
+	for (auto iter = this->activePlugins.begin();
+	        iter != this->activePlugins.end(); /* no increment */)
+	{
+		PluginAdapter *adapter = iter->second;
+		adapter->notifyTrimMemory();
+
+		iter ++;
 		this->processUnload(adapter);
 	}
 }
@@ -78,6 +564,35 @@ bool PluginManager::isPluginLoaded(const PluginInfo *pluginInfo)
 	return this->activePlugins.count(pluginInfo->path) > 0;
 }
 
+bool PluginManager::isPluginOpening(const PluginInfo *pluginInfo)
+{
+	return this->openingPlugins.count(pluginInfo->path) > 0;
+}
+
+void PluginManager::removePlugin(const PluginInfo *info)
+{
+	if (info->lazy)
+	{
+		this->disarmPlugin(info);
+		this->lazyPlugins.erase(info->path);
+	}
+
+	if (this->openingPlugins.count(info->path) > 0)
+	{
+		this->openingPlugins[info->path] = false;
+	}
+
+	if (!this->isPluginLoaded(info))
+	{
+		return;
+	}
+
+	PluginAdapter *adapter = this->activePlugins[info->path];
+	adapter->notifyPluginShouldUnload("");
+	adapter->unloadPlugin();
+	this->processUnload(adapter);
+}
+
 void PluginManager::processUnload(PluginAdapter *adapter)
 {
 	if (!adapter->needUnload)
@@ -87,6 +602,7 @@ void PluginManager::processUnload(PluginAdapter *adapter)
 
 	const PluginInfo *info = adapter->getInfo();
 	this->activePlugins.erase(info->path);
+	FlightRecorder::record(FLIGHT_PLUGIN_UNLOAD, info->name);
 
 	adapter->unloadPlugin();
 	delete adapter;
@@ -98,6 +614,16 @@ void PluginManager::processUnload(PluginAdapter *adapter)
 void PluginManager::notifyPluginShouldUnload(const PluginInfo *pluginInfo,
         const std::string &serviceName)
 {
+	if (pluginInfo->lazy)
+	{
+		this->disarmPlugin(pluginInfo);
+	}
+
+	if (this->openingPlugins.count(pluginInfo->path) > 0)
+	{
+		this->openingPlugins[pluginInfo->path] = false;
+	}
+
 	if (!this->isPluginLoaded(pluginInfo))
 	{
 		return;
@@ -108,6 +634,32 @@ void PluginManager::notifyPluginShouldUnload(const PluginInfo *pluginInfo,
 	this->processUnload(adapter);
 }
 
+void PluginManager::notifyServicePaused(const PluginInfo *pluginInfo,
+        const std::string &serviceName)
+{
+	if (!this->isPluginLoaded(pluginInfo))
+	{
+		return;
+	}
+
+	PluginAdapter *adapter = this->activePlugins[pluginInfo->path];
+	adapter->notifyServicePaused(serviceName);
+	this->processUnload(adapter);
+}
+
+void PluginManager::notifyServiceResumed(const PluginInfo *pluginInfo,
+        const std::string &serviceName)
+{
+	if (!this->isPluginLoaded(pluginInfo))
+	{
+		return;
+	}
+
+	PluginAdapter *adapter = this->activePlugins[pluginInfo->path];
+	adapter->notifyServiceResumed(serviceName);
+	this->processUnload(adapter);
+}
+
 void PluginManager::notifyLocaleChanged(const pbnjson::JValue &locale)
 {
 	this->locale = locale;
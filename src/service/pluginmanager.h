@@ -17,8 +17,25 @@
 #pragma once
 
 #include <unordered_map>
+#include "backgroundpool.h"
 #include "pluginadapter.h"
+#include "eventlatency.h"
+#include "pluginthread.h"
 
+/**
+ * Lazy plugin that is not loaded, the manager holds its declared
+ * triggers until one fires.
+ */
+class LazyPluginState
+{
+public:
+	LazyPluginState():
+		armed(false)
+	{};
+
+	bool armed; // required services online, triggers subscribed
+	std::vector<SubscribeHandle> triggers;
+};
 
 /**
  * Manages list of loaded plugins and dispatches common notifications to them.
@@ -32,12 +49,50 @@ public:
 	~PluginManager();
 
 	/**
-	 * Called by lunaMonitor
+	 * Lazy plugins are unloaded after being idle for this many seconds,
+	 * unless the plugin manifest sets its own idle timeout.
+	 * @param idleTimeoutSeconds - 0 to keep lazy plugins loaded once activated.
+	 */
+	void setIdleTimeout(unsigned int idleTimeoutSeconds);
+
+	/**
+	 * Called on the main loop whenever a plugin instance is created.
+	 */
+	void setLoadListener(std::function<void(const PluginInfo *)> listener);
+
+	/**
+	 * Called on the main loop once a library opened on a worker thread
+	 * is handed back, after the plugin was instantiated or not.
+	 */
+	void setOpenListener(std::function<void(const PluginInfo *)> listener);
+
+	/**
+	 * Run all plugins in host processes, not only those with
+	 * "isolation": "process" in their manifest.
+	 */
+	void setIsolation(bool isolateAll);
+
+	/**
+	 * Called by lunaMonitor.
+	 * Plugin library is opened on a worker thread and the plugin is
+	 * instantiated once that is done, unless it was unloaded meanwhile.
+	 * Lazy plugins are not loaded, instead their triggers are armed.
 	 */
 	void loadPlugin(const PluginInfo *pluginInfo, const std::string &service);
 
 	bool isPluginLoaded(const PluginInfo *pluginInfo);
 
+	/**
+	 * @return true while the plugin library is opened on a worker thread.
+	 */
+	bool isPluginOpening(const PluginInfo *pluginInfo);
+
+	/**
+	 * Plugin file changed or was removed. Unload the plugin right away,
+	 * even if it cancels the unload.
+	 */
+	void removePlugin(const PluginInfo *pluginInfo);
+
 	//  void unloadPlugin(const PluginInfo* pluginInfo);
 
 	/**
@@ -51,17 +106,86 @@ public:
 	void notifyPluginShouldUnload(const PluginInfo *pluginInfo,
 	                              const std::string &serviceName);
 
+	/**
+	 * Called by lunaMonitor
+	 */
+	void notifyServicePaused(const PluginInfo *pluginInfo,
+	                         const std::string &serviceName);
+
+	/**
+	 * Called by lunaMonitor
+	 */
+	void notifyServiceResumed(const PluginInfo *pluginInfo,
+	                          const std::string &serviceName);
+
 	/**
 	 * Called by lunaMonitor
 	 */
 	void notifyLocaleChanged(const pbnjson::JValue &locale);
 
+	/**
+	 * Ask all loaded plugins to drop caches they can rebuild.
+	 */
+	void trimMemory();
+
+	/**
+	 * Unload lazy plugins that have been idle for at least idleSeconds,
+	 * regardless of their idle timeout. They stay armed.
+	 * @return number of plugins unloaded.
+	 */
+	unsigned int releaseIdlePlugins(unsigned int idleSeconds);
+
+	/**
+	 * Posted function and background task queues of loaded plugins.
+	 */
+	pbnjson::JValue getQueueStats();
+
+	/**
+	 * Metrics of the plugin, created on first use and kept across reloads.
+	 */
+	PluginMetrics *getPluginMetrics(const PluginInfo *pluginInfo);
+
+	/**
+	 * Metrics of every plugin loaded so far, with active subscriptions,
+	 * timers, polls and alerts of those loaded now.
+	 */
+	pbnjson::JValue getMetrics();
+
+	/**
+	 * Note a toast or alert the plugin created while handling origin.
+	 */
+	void recordNotification(const std::string &pluginName, const char *kind,
+	                        const EventOrigin &origin);
+
+	/**
+	 * Event to notification latency percentiles, overall and by notification
+	 * kind, plugin and source service.
+	 */
+	pbnjson::JValue getNotificationLatency();
+
 	const std::string getUILocale();
 
 public:
 	LunaService &lunaService;
 	pbnjson::JValue locale;
 	GMainLoop *mainLoop;
+	BackgroundPool backgroundPool;
+
+private:
+	void openPlugin(const PluginInfo *pluginInfo);
+	bool instantiatePlugin(const PluginInfo *pluginInfo);
+	bool isIsolated(const PluginInfo *pluginInfo);
+	PluginThread *getPluginThread(const std::string &name);
+	void armPlugin(const PluginInfo *pluginInfo);
+	void disarmPlugin(const PluginInfo *pluginInfo);
+	void activatePlugin(const PluginInfo *pluginInfo);
+	void triggerCallback(const PluginInfo *pluginInfo,
+	                     const pbnjson::JValue &trigger,
+	                     pbnjson::JValue &previousValue,
+	                     pbnjson::JValue &value);
+	void unloadIdlePlugins();
+	unsigned int unloadLazyPlugins(const std::vector<PluginAdapter *> &adapters);
+	static gboolean idleCallback(gpointer userData);
 
 private:
 	PluginLoader &loader;
@@ -70,4 +194,33 @@ private:
 	 * Map plugin path to plugin adapter.
 	 */
 	std::unordered_map<std::string, PluginAdapter *> activePlugins;
+
+	/**
+	 * Map plugin path of plugins being opened to whether the plugin is
+	 * still wanted once it is opened.
+	 */
+	std::unordered_map<std::string, bool> openingPlugins;
+	std::function<void(const PluginInfo *)> loadListener;
+	std::function<void(const PluginInfo *)> openListener;
+
+	/**
+	 * Map plugin path to lazy plugin triggers.
+	 */
+	std::unordered_map<std::string, LazyPluginState> lazyPlugins;
+	unsigned int idleTimeoutSeconds;
+	guint idleTimer;
+	bool isolateAll;
+
+	/**
+	 * Map thread name to worker thread, see PluginInfo::thread.
+	 * Threads are kept until the manager is destroyed.
+	 */
+	std::unordered_map<std::string, PluginThread *> threads;
+
+	/**
+	 * Map plugin name to its metrics.
+	 */
+	std::unordered_map<std::string, PluginMetrics> metrics;
+
+	NotificationLatency notificationLatency;
 };
@@ -0,0 +1,170 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+
+#include "pluginmetrics.h"
+
+using namespace pbnjson;
+
+const gint64 LatencyHistogram::BOUNDS_US[BOUND_COUNT] =
+{
+	100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000
+};
+
+LatencyHistogram::LatencyHistogram():
+	count(0),
+	totalUs(0),
+	maxUs(0),
+	buckets()
+{
+}
+
+void LatencyHistogram::record(gint64 durationUs)
+{
+	unsigned int bucket = 0;
+
+	while (bucket < BOUND_COUNT && durationUs > BOUNDS_US[bucket])
+	{
+		bucket++;
+	}
+
+	this->buckets[bucket]++;
+	this->count++;
+	this->totalUs += durationUs;
+
+	if (durationUs > this->maxUs)
+	{
+		this->maxUs = durationUs;
+	}
+}
+
+JValue LatencyHistogram::toJson() const
+{
+	JValue bounds = JArray();
+	JValue counts = JArray();
+
+	for (unsigned int i = 0; i < BOUND_COUNT; i++)
+	{
+		bounds.append(JValue(static_cast<int64_t>(BOUNDS_US[i])));
+	}
+
+	for (unsigned int i = 0; i <= BOUND_COUNT; i++)
+	{
+		counts.append(JValue(static_cast<int64_t>(this->buckets[i])));
+	}
+
+	int64_t averageUs = this->count ? this->totalUs / static_cast<int64_t>(this->count) : 0;
+
+	return JObject{{"count", JValue(static_cast<int64_t>(this->count))},
+	               {"averageUs", JValue(averageUs)},
+	               {"maxUs", JValue(static_cast<int64_t>(this->maxUs))},
+	               {"boundsUs", bounds},
+	               {"counts", counts}};
+}
+
+PercentileHistogram::PercentileHistogram():
+	count(0),
+	totalUs(0),
+	maxUs(0),
+	buckets()
+{
+}
+
+void PercentileHistogram::record(gint64 durationUs)
+{
+	uint64_t value = durationUs > 0 ? static_cast<uint64_t>(durationUs) : 0;
+	unsigned int bucket = 0;
+
+	if (value >= SUB_BUCKETS)
+	{
+		// Value is in [2^octave, 2^(octave + 1)), split into SUB_BUCKETS.
+		unsigned int octave = 63 - __builtin_clzll(value);
+		unsigned int sub = static_cast<unsigned int>(((value - (1ull << octave)) * SUB_BUCKETS) >> octave);
+		bucket = std::min((octave - 1) * SUB_BUCKETS + sub, BUCKET_COUNT - 1);
+	}
+	else
+	{
+		bucket = static_cast<unsigned int>(value);
+	}
+
+	this->buckets[bucket]++;
+	this->count++;
+	this->totalUs += durationUs;
+
+	if (durationUs > this->maxUs)
+	{
+		this->maxUs = durationUs;
+	}
+}
+
+gint64 PercentileHistogram::upperBound(unsigned int bucket)
+{
+	if (bucket < SUB_BUCKETS)
+	{
+		return bucket;
+	}
+
+	unsigned int octave = bucket / SUB_BUCKETS + 1;
+	unsigned int sub = bucket % SUB_BUCKETS;
+	return static_cast<gint64>((1ull << octave) + (((sub + 1ull) << octave) / SUB_BUCKETS) - 1);
+}
+
+gint64 PercentileHistogram::percentile(double fraction) const
+{
+	if (this->count == 0)
+	{
+		return 0;
+	}
+
+	uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * this->count + 0.5));
+	uint64_t seen = 0;
+
+	for (unsigned int i = 0; i < BUCKET_COUNT; i++)
+	{
+		seen += this->buckets[i];
+
+		if (seen >= target)
+		{
+			return std::min(PercentileHistogram::upperBound(i), this->maxUs);
+		}
+	}
+
+	return this->maxUs;
+}
+
+JValue PercentileHistogram::toJson() const
+{
+	int64_t averageUs = this->count ? this->totalUs / static_cast<int64_t>(this->count) : 0;
+
+	return JObject{{"count", JValue(static_cast<int64_t>(this->count))},
+	               {"averageUs", JValue(averageUs)},
+	               {"p50Us", JValue(static_cast<int64_t>(this->percentile(0.5)))},
+	               {"p90Us", JValue(static_cast<int64_t>(this->percentile(0.9)))},
+	               {"p99Us", JValue(static_cast<int64_t>(this->percentile(0.99)))},
+	               {"maxUs", JValue(static_cast<int64_t>(this->maxUs))}};
+}
+
+JValue PluginMetrics::toJson() const
+{
+	return JObject{{"subscriptionCallbacks", this->subscriptions.toJson()},
+	               {"timerCallbacks", this->timers.toJson()},
+	               {"methodHandlers", this->methods.toJson()},
+	               {"busCalls", JValue(static_cast<int64_t>(this->busCalls))},
+	               {"payloadBytes", JValue(static_cast<int64_t>(this->payloadBytes))},
+	               {"schemaFailures", JValue(static_cast<int64_t>(this->schemaFailures))},
+	               {"loads", JValue(static_cast<int64_t>(this->loads))}};
+}
@@ -0,0 +1,128 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <cstdint>
+#include <glib.h>
+#include <pbnjson.hpp>
+
+/**
+ * Callback duration histogram with fixed bucket bounds, cheap enough to
+ * record around every plugin callback.
+ */
+class LatencyHistogram
+{
+public:
+	// Upper bounds of the buckets, in us. One more bucket counts the rest.
+	static const unsigned int BOUND_COUNT = 11;
+	static const gint64 BOUNDS_US[BOUND_COUNT];
+
+	LatencyHistogram();
+
+	void record(gint64 durationUs);
+	pbnjson::JValue toJson() const;
+
+private:
+	uint64_t count;
+	gint64 totalUs;
+	gint64 maxUs;
+	uint64_t buckets[BOUND_COUNT + 1];
+};
+
+/**
+ * Latency histogram with buckets growing with the value, four per power
+ * of two, for percentiles of anything from microseconds to hours.
+ * Percentiles are the upper bound of their bucket, within 25%.
+ */
+class PercentileHistogram
+{
+public:
+	static const unsigned int SUB_BUCKETS = 4;
+	static const unsigned int BUCKET_COUNT = 40 * SUB_BUCKETS;
+
+	PercentileHistogram();
+
+	void record(gint64 durationUs);
+	gint64 percentile(double fraction) const;
+	pbnjson::JValue toJson() const;
+
+private:
+	static gint64 upperBound(unsigned int bucket);
+
+private:
+	uint64_t count;
+	gint64 totalUs;
+	gint64 maxUs;
+	uint32_t buckets[BUCKET_COUNT];
+};
+
+/**
+ * Records the time until it goes out of scope. The histogram must outlive
+ * it, the callback being timed may unload the plugin.
+ */
+class ScopedLatency
+{
+public:
+	/**
+	 * @param _histogram - null to record nothing.
+	 */
+	ScopedLatency(LatencyHistogram *_histogram):
+		histogram(_histogram),
+		start(_histogram ? g_get_monotonic_time() : 0)
+	{};
+
+	~ScopedLatency()
+	{
+		if (this->histogram)
+		{
+			this->histogram->record(g_get_monotonic_time() - this->start);
+		}
+	}
+
+	ScopedLatency(const ScopedLatency &) = delete;
+	ScopedLatency &operator=(const ScopedLatency &) = delete;
+
+private:
+	LatencyHistogram *histogram;
+	gint64 start;
+};
+
+/**
+ * Runtime cost of one plugin, kept by PluginManager across reloads.
+ * Main thread only.
+ */
+class PluginMetrics
+{
+public:
+	PluginMetrics():
+		busCalls(0),
+		payloadBytes(0),
+		schemaFailures(0),
+		loads(0)
+	{};
+
+	LatencyHistogram subscriptions; // subscription and call reply callbacks
+	LatencyHistogram timers; // timeouts, debounce, throttle and polling
+	LatencyHistogram methods; // luna method handlers
+
+	uint64_t busCalls;
+	uint64_t payloadBytes; // replies received
+	uint64_t schemaFailures;
+	uint64_t loads;
+
+	pbnjson::JValue toJson() const;
+};
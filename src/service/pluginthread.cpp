@@ -0,0 +1,98 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <poll.h>
+
+#include "pluginthread.h"
+#include "logging.h"
+
+PluginThread::PluginThread(const std::string &_name):
+	name(_name),
+	context(g_main_context_new()),
+	loop(g_main_loop_new(this->context, FALSE)),
+	queue(new TaskQueue(this->context)),
+	mainQueue(new TaskQueue(g_main_context_default())),
+	thread(nullptr)
+{
+	// Thread names are limited to 15 characters.
+	std::string threadName = ("plugin-" + this->name).substr(0, 15);
+	this->thread = g_thread_new(threadName.c_str(), PluginThread::run, this);
+
+	LOG_INFO(MSGID_PLUGIN_THREAD, 0, "Started plugin thread %s", this->name.c_str());
+}
+
+PluginThread::~PluginThread()
+{
+	GMainLoop *threadLoop = this->loop;
+
+	this->queue->post([threadLoop]()
+	{
+		g_main_loop_quit(threadLoop);
+	});
+
+	g_thread_join(this->thread);
+	delete this->queue;
+	delete this->mainQueue;
+	g_main_loop_unref(this->loop);
+	g_main_context_unref(this->context);
+
+	LOG_INFO(MSGID_PLUGIN_THREAD, 0, "Stopped plugin thread %s", this->name.c_str());
+}
+
+void PluginThread::post(TaskQueue::Task task)
+{
+	this->queue->post(std::move(task));
+}
+
+void PluginThread::postToMain(TaskQueue::Task task)
+{
+	this->mainQueue->post(std::move(task));
+}
+
+void PluginThread::call(TaskQueue::Task task)
+{
+	bool done = false;
+	TaskQueue *toMain = this->mainQueue;
+
+	// Completion comes through the main queue too, so it cannot be missed.
+	this->queue->post([task, toMain, &done]()
+	{
+		task();
+		toMain->post([&done]()
+		{
+			done = true;
+		});
+	});
+
+	while (!done)
+	{
+		struct pollfd fd = {this->mainQueue->getFd(), POLLIN, 0};
+		(void) poll(&fd, 1, -1);
+		this->mainQueue->runPending();
+	}
+}
+
+gpointer PluginThread::run(gpointer userData)
+{
+	auto pluginThread = reinterpret_cast<PluginThread *>(userData);
+
+	// Plugins adding their own sources with g_main_context_get_thread_default
+	// get this context.
+	g_main_context_push_thread_default(pluginThread->context);
+	g_main_loop_run(pluginThread->loop);
+	g_main_context_pop_thread_default(pluginThread->context);
+	return nullptr;
+}
@@ -0,0 +1,78 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <string>
+#include <glib.h>
+
+#include "taskqueue.h"
+
+/**
+ * Worker thread with its own GMainContext, shared by the plugins that name
+ * it in their manifest, see ThreadedPlugin.
+ */
+class PluginThread
+{
+public:
+	PluginThread(const std::string &name);
+
+	/**
+	 * Stops the thread once the tasks posted so far have run.
+	 */
+	~PluginThread();
+
+	PluginThread(const PluginThread &) = delete;
+	PluginThread &operator=(const PluginThread &) = delete;
+
+	/**
+	 * Run the task on the thread. Thread safe.
+	 */
+	void post(TaskQueue::Task task);
+
+	/**
+	 * Run the task on the main loop. Thread safe.
+	 */
+	void postToMain(TaskQueue::Task task);
+
+	/**
+	 * Run the task on the thread and wait for it. Tasks the thread posts to
+	 * the main loop meanwhile are run, so that plugins on the thread can
+	 * call the Manager. Main thread only, the task must not throw.
+	 */
+	void call(TaskQueue::Task task);
+
+	bool isCurrent() const
+	{
+		return g_thread_self() == this->thread;
+	}
+
+	const std::string &getName() const
+	{
+		return this->name;
+	}
+
+private:
+	static gpointer run(gpointer userData);
+
+private:
+	std::string name;
+	GMainContext *context;
+	GMainLoop *loop;
+	TaskQueue *queue;
+	TaskQueue *mainQueue;
+	GThread *thread;
+};
@@ -0,0 +1,692 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "config.h"
+#include "remoteplugin.h"
+#include "pluginmanager.h"
+#include "logging.h"
+#include "utils.h"
+
+using namespace pbnjson;
+
+static const unsigned int INIT_TIMEOUT_MS = 5000;
+static const unsigned int STOP_TIMEOUT_MS = 2000;
+static const unsigned int METHOD_TIMEOUT_MS = 5000;
+static const unsigned int BACKLOG_RETRY_MS = 10;
+// Host exit is checked this often while waiting for a reply.
+static const unsigned int HOST_CHECK_MS = 50;
+// Host is considered hung if this many messages are waiting for it.
+static const size_t MAX_BACKLOG = 1024;
+// Event origins kept for calls the host makes while handling the events.
+static const size_t ORIGIN_SLOTS = 64;
+
+static std::string stringOf(const JValue &value)
+{
+	std::string result;
+	(void) value.asString(result);
+	return result;
+}
+
+static int64_t numberOf(const JValue &value)
+{
+	int64_t result = 0;
+	(void) value.asNumber(result);
+	return result;
+}
+
+static bool boolOf(const JValue &value)
+{
+	bool result = false;
+	(void) value.asBool(result);
+	return result;
+}
+
+RemotePlugin *RemotePlugin::spawn(PluginAdapter *adapter, const PluginInfo *info)
+{
+	ShmChannel *channel = ShmChannel::create(HOST_CHANNEL_CAPACITY);
+
+	if (!channel)
+	{
+		LOG_ERROR(MSGID_PLUGIN_HOST, 0, "Failed to create channel for plugin %s: %s",
+		          info->name.c_str(), strerror(errno));
+		return nullptr;
+	}
+
+	pid_t pid = fork();
+
+	if (pid < 0)
+	{
+		LOG_ERROR(MSGID_PLUGIN_HOST, 0, "Failed to fork host for plugin %s: %s",
+		          info->name.c_str(), strerror(errno));
+		delete channel;
+		return nullptr;
+	}
+
+	if (pid == 0)
+	{
+		// Only async-signal-safe calls until exec, loader threads may hold locks.
+		(void) prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+		if (channel->prepareChild())
+		{
+			execl(WEBOS_EVENT_MONITOR_HOST_PATH, "event-monitor-host",
+			      info->path.c_str(), info->name.c_str(), static_cast<char *>(nullptr));
+		}
+
+		_exit(127);
+	}
+
+	RemotePlugin *remote = new RemotePlugin(adapter, info, channel, pid);
+	JValue reply = remote->request(JObject{{"op", "init"},
+	                                       {"locale", adapter->getUILocale()},
+	                                       {"localeInfo", adapter->getLocaleInfo()}},
+	                               INIT_TIMEOUT_MS);
+
+	if (!boolOf(reply["result"]))
+	{
+		LOG_ERROR(MSGID_PLUGIN_HOST, 0, "Plugin host for %s failed to start: %s",
+		          info->name.c_str(),
+		          reply.hasKey("error") ? stringOf(reply["error"]).c_str() : "no reply");
+		// Timers, subscriptions and methods the plugin set up while
+		// initializing call back into remote.
+		adapter->cancelAll();
+		delete remote;
+		return nullptr;
+	}
+
+	remote->childSource = g_child_watch_add(pid, RemotePlugin::childCallback, remote);
+
+	// The channel owns the descriptor.
+	GIOChannel *ioChannel = g_io_channel_unix_new(channel->getReceiveFd());
+	g_io_channel_set_encoding(ioChannel, NULL, NULL);
+	g_io_channel_set_buffered(ioChannel, FALSE);
+	remote->receiveSource = g_io_add_watch(ioChannel,
+	                                       static_cast<GIOCondition>(G_IO_IN | G_IO_ERR
+	                                               | G_IO_HUP | G_IO_NVAL),
+	                                       RemotePlugin::receiveCallback,
+	                                       remote);
+	g_io_channel_unref(ioChannel);
+
+	LOG_INFO(MSGID_PLUGIN_HOST, 0, "Plugin %s running in host process %d",
+	         info->name.c_str(), static_cast<int>(pid));
+	return remote;
+}
+
+RemotePlugin::RemotePlugin(PluginAdapter *_adapter, const PluginInfo *_info,
+                           ShmChannel *_channel, GPid _pid):
+	adapter(_adapter),
+	info(_info),
+	channel(_channel),
+	pid(_pid),
+	hostLost(false),
+	receiveSource(0),
+	childSource(0),
+	backlogSource(0),
+	nextSeq(0),
+	nextOrigin(0),
+	origins(ORIGIN_SLOTS)
+{
+}
+
+RemotePlugin::~RemotePlugin()
+{
+	if (this->receiveSource)
+	{
+		g_source_remove(this->receiveSource);
+	}
+
+	if (this->backlogSource)
+	{
+		g_source_remove(this->backlogSource);
+	}
+
+	if (this->childSource)
+	{
+		g_source_remove(this->childSource);
+	}
+
+	if (this->pid > 0)
+	{
+		// Plugin was already told to stop, nothing left to wait for.
+		kill(this->pid, SIGKILL);
+		(void) waitpid(this->pid, nullptr, 0);
+		g_spawn_close_pid(this->pid);
+		LOG_INFO(MSGID_PLUGIN_HOST, 0, "Stopped host process %d of plugin %s",
+		         static_cast<int>(this->pid), this->info->name.c_str());
+	}
+
+	delete this->channel;
+}
+
+void RemotePlugin::startMonitoring()
+{
+	this->send(JObject{{"op", "startMonitoring"}});
+}
+
+UnloadResult RemotePlugin::stopMonitoring(const std::string &service)
+{
+	JValue reply = this->request(JObject{{"op", "stopMonitoring"}, {"service", service}},
+	                             STOP_TIMEOUT_MS);
+
+	if (reply.hasKey("error"))
+	{
+		throw Error(stringOf(reply["error"]));
+	}
+
+	// No reply, the host is stuck and is stopped with the plugin.
+	return numberOf(reply["result"]) == UNLOAD_CANCEL ? UNLOAD_CANCEL : UNLOAD_OK;
+}
+
+void RemotePlugin::uiLocaleChanged(const std::string &uiLocale)
+{
+	this->send(JObject{{"op", "uiLocaleChanged"},
+	                   {"locale", uiLocale},
+	                   {"localeInfo", this->adapter->getLocaleInfo()}});
+}
+
+void RemotePlugin::servicePaused(const std::string &service)
+{
+	this->send(JObject{{"op", "servicePaused"}, {"service", service}});
+}
+
+void RemotePlugin::serviceResumed(const std::string &service)
+{
+	this->send(JObject{{"op", "serviceResumed"}, {"service", service}});
+}
+
+void RemotePlugin::trimMemory()
+{
+	this->send(JObject{{"op", "trimMemory"}});
+}
+
+void RemotePlugin::send(const JValue &message)
+{
+	if (this->hostLost)
+	{
+		return;
+	}
+
+	std::string text = message.stringify("");
+
+	if (text.size() > this->channel->maxMessageSize())
+	{
+		LOG_ERROR(MSGID_PLUGIN_HOST, 0, "Dropping %zu byte message to plugin %s",
+		          text.size(), this->info->name.c_str());
+		return;
+	}
+
+	this->backlog.push_back(text);
+
+	if (this->flushBacklog())
+	{
+		return;
+	}
+
+	if (this->backlog.size() > MAX_BACKLOG && this->pid > 0)
+	{
+		LOG_ERROR(MSGID_PLUGIN_HOST, 0, "Plugin %s is not reading messages, stopping its host",
+		          this->info->name.c_str());
+		// Unloaded from childCallback.
+		kill(this->pid, SIGKILL);
+		this->hostLost = true;
+		this->backlog.clear();
+		return;
+	}
+
+	if (!this->backlogSource)
+	{
+		this->backlogSource = g_timeout_add(BACKLOG_RETRY_MS,
+		                                    RemotePlugin::backlogCallback, this);
+	}
+}
+
+bool RemotePlugin::flushBacklog()
+{
+	while (!this->backlog.empty())
+	{
+		if (!this->channel->send(this->backlog.front()))
+		{
+			return false;
+		}
+
+		this->backlog.pop_front();
+	}
+
+	return true;
+}
+
+gboolean RemotePlugin::backlogCallback(gpointer userData)
+{
+	auto remote = reinterpret_cast<RemotePlugin *>(userData);
+
+	if (!remote->flushBacklog())
+	{
+		return G_SOURCE_CONTINUE;
+	}
+
+	remote->backlogSource = 0;
+	return G_SOURCE_REMOVE;
+}
+
+JValue RemotePlugin::request(JValue message, unsigned int timeoutMs)
+{
+	int64_t seq = ++this->nextSeq;
+	message.put("seq", JValue(seq));
+	this->send(message);
+
+	gint64 deadline = g_get_monotonic_time() + static_cast<gint64>(timeoutMs) * 1000;
+	JValue reply;
+
+	while (!this->hostLost)
+	{
+		std::string text;
+		this->channel->clearSignal();
+
+		// Drain everything, the signal is already consumed.
+		while (this->channel->receive(text))
+		{
+			JValue received = JDomParser::fromString(text, JSchema::AllSchema());
+
+			if (stringOf(received["op"]) == "reply" && numberOf(received["seq"]) == seq)
+			{
+				reply = received;
+			}
+			else
+			{
+				this->handleMessage(received);
+			}
+		}
+
+		if (!reply.isNull())
+		{
+			return reply;
+		}
+
+		if (this->checkChannel())
+		{
+			break;
+		}
+
+		(void) this->flushBacklog();
+
+		// A crashed host never replies, do not wait for the deadline.
+		if (this->hostExited())
+		{
+			this->hostLost = true;
+
+			if (!this->childSource)
+			{
+				// Not watched from the main loop yet, reap it here.
+				(void) waitpid(this->pid, nullptr, 0);
+				g_spawn_close_pid(this->pid);
+				this->pid = 0;
+			}
+
+			break;
+		}
+
+		gint64 remaining = deadline - g_get_monotonic_time();
+
+		if (remaining <= 0)
+		{
+			break;
+		}
+
+		gint64 waitMs = std::min<gint64>((remaining + 999) / 1000, HOST_CHECK_MS);
+		struct pollfd fd = {this->channel->getReceiveFd(), POLLIN, 0};
+		(void) poll(&fd, 1, static_cast<int>(waitMs));
+	}
+
+	LOG_WARNING(MSGID_PLUGIN_HOST, 0, "Plugin %s did not reply to %s in %u ms",
+	            this->info->name.c_str(), stringOf(message["op"]).c_str(), timeoutMs);
+	return reply;
+}
+
+/**
+ * Check if the host exited without reaping it, so that the child watch
+ * still gets its status.
+ */
+bool RemotePlugin::hostExited()
+{
+	if (this->pid <= 0)
+	{
+		return true;
+	}
+
+	siginfo_t status;
+	memset(&status, 0, sizeof(status));
+
+	if (waitid(P_PID, this->pid, &status, WEXITED | WNOHANG | WNOWAIT) < 0)
+	{
+		return errno == ECHILD;
+	}
+
+	// si_pid stays 0 while the host is running.
+	return status.si_pid == this->pid;
+}
+
+void RemotePlugin::receive()
+{
+	std::string text;
+	this->channel->clearSignal();
+
+	while (this->channel->receive(text))
+	{
+		this->handleMessage(JDomParser::fromString(text, JSchema::AllSchema()));
+	}
+
+	(void) this->checkChannel();
+}
+
+/**
+ * Stop a host that corrupted the channel, its messages can't be read.
+ * @return true if the host is lost.
+ */
+bool RemotePlugin::checkChannel()
+{
+	if (this->channel->isBroken() && !this->hostLost && this->pid > 0)
+	{
+		LOG_ERROR(MSGID_PLUGIN_HOST, 0, "Plugin %s host wrote an invalid message, stopping it",
+		          this->info->name.c_str());
+		// Unloaded from childCallback, or reaped by request during init.
+		kill(this->pid, SIGKILL);
+		this->hostLost = true;
+	}
+
+	return this->hostLost;
+}
+
+void RemotePlugin::handleMessage(const JValue &message)
+{
+	std::string op = stringOf(message["op"]);
+
+	if (op == "reply")
+	{
+		// Late reply to a request that timed out.
+		return;
+	}
+
+	if (op == "exception")
+	{
+		LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0, "Exception in plugin %s, message: %s",
+		          this->info->name.c_str(), stringOf(message["message"]).c_str());
+		this->adapter->unloadPlugin();
+		return;
+	}
+
+	JValue reply = JObject{{"op", "reply"}, {"seq", message["seq"]}};
+	// Call made while handling an event, unset if the origin is gone.
+	int64_t token = numberOf(message["origin"]);
+	const auto &slot = this->origins[token % ORIGIN_SLOTS];
+	EventOrigin origin = token > 0 && slot.first == token ? slot.second : EventOrigin();
+	EventOrigin::Scope originScope(origin);
+
+	try
+	{
+		reply.put("result", this->handleRequest(op, message));
+	}
+	catch (const std::exception &e)
+	{
+		reply.put("error", e.what());
+	}
+
+	this->send(reply);
+}
+
+/**
+ * Send a plugin event, tagged with the origin of the callback running.
+ */
+void RemotePlugin::sendEvent(JValue message)
+{
+	EventOrigin origin = EventOrigin::capture();
+
+	if (origin.isSet() || origin.flow != 0)
+	{
+		int64_t token = ++this->nextOrigin;
+		this->origins[token % ORIGIN_SLOTS] = std::make_pair(token, origin);
+		message.put("origin", JValue(token));
+	}
+
+	this->send(message);
+}
+
+/**
+ * Execute a Manager call of the plugin on its adapter. Callbacks are
+ * forwarded to the host by id, the host keeps the plugin's functions.
+ */
+JValue RemotePlugin::handleRequest(const std::string &op, const JValue &message)
+{
+	Manager *manager = this->adapter;
+	std::string id = stringOf(message["id"]);
+	JValue params = message["params"].duplicate();
+
+	auto forwardSubscription = [this, id](const char *event)
+	{
+		std::string eventOp = event;
+		return [this, id, eventOp](JValue & previousValue, JValue & value)
+		{
+			this->sendEvent(JObject{{"op", eventOp}, {"id", id},
+			                        {"previous", previousValue}, {"value", value}});
+		};
+	};
+
+	auto forwardTimeout = [this](const char *event)
+	{
+		std::string eventOp = event;
+		return [this, eventOp](const std::string & timeoutId)
+		{
+			this->sendEvent(JObject{{"op", eventOp}, {"id", timeoutId}});
+		};
+	};
+
+	if (op == "unloadPlugin")
+	{
+		manager->unloadPlugin();
+		return JValue(true);
+	}
+	else if (op == "lunaCall")
+	{
+		return manager->lunaCall(stringOf(message["url"]), params,
+		                         numberOf(message["timeout"]));
+	}
+	else if (op == "lunaCallAsync")
+	{
+		LunaCallback callback = nullptr;
+
+		if (!id.empty())
+		{
+			callback = [this, id](JValue & response)
+			{
+				this->sendEvent(JObject{{"op", "callResult"}, {"id", id}, {"value", response}});
+			};
+		}
+
+		manager->lunaCallAsync(stringOf(message["url"]), params, callback);
+		return JValue(true);
+	}
+	else if (op == "subscribeToMethod")
+	{
+		manager->subscribeToMethod(id, stringOf(message["url"]), params,
+		                           forwardSubscription("subscription"));
+		return JValue(true);
+	}
+	else if (op == "unsubscribeFromMethod")
+	{
+		return JValue(manager->unsubscribeFromMethod(id));
+	}
+	else if (op == "subscribeToSignal")
+	{
+		manager->subscribeToSignal(id, stringOf(message["category"]),
+		                           stringOf(message["method"]),
+		                           forwardSubscription("subscription"));
+		return JValue(true);
+	}
+	else if (op == "unsubscribeFromSignal")
+	{
+		return JValue(manager->unsubscribeFromSignal(id));
+	}
+	else if (op == "setTimeout")
+	{
+		manager->setTimeout(id, numberOf(message["ms"]), boolOf(message["repeat"]),
+		                    forwardTimeout("timeout"));
+		return JValue(true);
+	}
+	else if (op == "cancelTimeout")
+	{
+		return JValue(manager->cancelTimeout(id));
+	}
+	else if (op == "debounce")
+	{
+		manager->debounce(id, numberOf(message["ms"]), forwardTimeout("debounce"));
+		return JValue(true);
+	}
+	else if (op == "cancelDebounce")
+	{
+		return JValue(manager->cancelDebounce(id));
+	}
+	else if (op == "throttle")
+	{
+		manager->throttle(id, numberOf(message["ms"]), forwardTimeout("throttle"));
+		return JValue(true);
+	}
+	else if (op == "cancelThrottle")
+	{
+		return JValue(manager->cancelThrottle(id));
+	}
+	else if (op == "startPolling")
+	{
+		manager->startPolling(id, stringOf(message["url"]), params,
+		                      numberOf(message["minMs"]), numberOf(message["maxMs"]),
+		                      forwardSubscription("poll"));
+		return JValue(true);
+	}
+	else if (op == "stopPolling")
+	{
+		return JValue(manager->stopPolling(id));
+	}
+	else if (op == "registerMethod")
+	{
+		std::string category = stringOf(message["category"]);
+		std::string method = stringOf(message["method"]);
+
+		// Parameters are validated against the schema in the host.
+		return JValue(manager->registerMethod(category, method,
+		                                      [this, category, method](const JValue & callParams)
+		{
+			return this->callMethod(category, method, callParams);
+		}));
+	}
+	else if (op == "createToast")
+	{
+		manager->createToast(stringOf(message["message"]), stringOf(message["iconUrl"]),
+		                     message["onClickAction"]);
+		return JValue(true);
+	}
+	else if (op == "createAlert")
+	{
+		manager->createAlert(id, stringOf(message["title"]), stringOf(message["message"]),
+		                     boolOf(message["modal"]), stringOf(message["iconUrl"]),
+		                     message["buttons"], message["onClose"]);
+		return JValue(true);
+	}
+	else if (op == "closeAlert")
+	{
+		return JValue(manager->closeAlert(id));
+	}
+
+	throw Error("Unknown plugin host request: " + op);
+}
+
+JValue RemotePlugin::callMethod(const std::string &category,
+                                const std::string &method,
+                                const JValue &params)
+{
+	JValue reply = this->request(JObject{{"op", "method"},
+	                                     {"category", category},
+	                                     {"method", method},
+	                                     {"params", params}},
+	                             METHOD_TIMEOUT_MS);
+
+	if (!reply.hasKey("result"))
+	{
+		return JObject{{"returnValue", false},
+		               {"errorCode", 3},
+		               {"errorMessage", "Plugin did not respond."}};
+	}
+
+	return reply["result"];
+}
+
+gboolean RemotePlugin::receiveCallback(GIOChannel *ioChannel UNUSED_VAR,
+                                       GIOCondition condition,
+                                       gpointer userData)
+{
+	auto remote = reinterpret_cast<RemotePlugin *>(userData);
+	PluginAdapter *adapter = remote->adapter;
+
+	if (condition & (G_IO_ERR | G_IO_HUP | G_IO_NVAL))
+	{
+		remote->receiveSource = 0;
+		return G_SOURCE_REMOVE;
+	}
+
+	remote->receive();
+
+	if (adapter->needUnload)
+	{
+		// Deletes remote.
+		remote->receiveSource = 0;
+		adapter->manager->processUnload(adapter);
+		return G_SOURCE_REMOVE;
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+void RemotePlugin::childCallback(GPid pid, gint status, gpointer userData)
+{
+	auto remote = reinterpret_cast<RemotePlugin *>(userData);
+	PluginAdapter *adapter = remote->adapter;
+
+	if (WIFSIGNALED(status))
+	{
+		LOG_ERROR(MSGID_PLUGIN_HOST, 0, "Host process of plugin %s killed by signal %d",
+		          remote->info->name.c_str(), WTERMSIG(status));
+	}
+	else
+	{
+		LOG_ERROR(MSGID_PLUGIN_HOST, 0, "Host process of plugin %s exited with status %d",
+		          remote->info->name.c_str(), WEXITSTATUS(status));
+	}
+
+	g_spawn_close_pid(pid);
+	remote->childSource = 0;
+	remote->pid = 0;
+	remote->hostLost = true;
+
+	// Only this plugin goes away.
+	adapter->unloadPlugin();
+	adapter->manager->processUnload(adapter);
+}
@@ -0,0 +1,115 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <glib.h>
+#include <pbnjson.hpp>
+
+#include <event-monitor-api/api.h>
+
+#include "eventlatency.h"
+#include "plugininfo.h"
+#include "shmring.h"
+
+using namespace EventMonitor;
+
+class PluginAdapter;
+
+/**
+ * Stands in for a plugin that runs in its own event-monitor-host process.
+ * Plugin calls are forwarded to the host and the host's Manager calls are
+ * executed on the plugin's adapter, so timers, subscriptions and luna
+ * methods stay in the event monitor and only their callbacks cross over.
+ * Messages are JSON text on a pair of shared memory rings, see ShmChannel.
+ *
+ * If the host crashes, only its plugin is unloaded.
+ */
+class RemotePlugin: public Plugin
+{
+public:
+	/**
+	 * Start the host process and instantiate the plugin in it.
+	 * @return nullptr on failure.
+	 */
+	static RemotePlugin *spawn(PluginAdapter *adapter, const PluginInfo *info);
+
+	virtual ~RemotePlugin();
+
+	RemotePlugin(const RemotePlugin &) = delete;
+	RemotePlugin &operator=(const RemotePlugin &) = delete;
+
+	void startMonitoring();
+	UnloadResult stopMonitoring(const std::string &service);
+	void uiLocaleChanged(const std::string &uiLocale);
+	void servicePaused(const std::string &service);
+	void serviceResumed(const std::string &service);
+	void trimMemory();
+
+private:
+	RemotePlugin(PluginAdapter *adapter, const PluginInfo *info,
+	             ShmChannel *channel, GPid pid);
+
+	void send(const pbnjson::JValue &message);
+	void sendEvent(pbnjson::JValue message);
+	bool flushBacklog();
+
+	/**
+	 * Send a message and wait for the host to reply, handling the host's
+	 * own requests meanwhile.
+	 * @return the reply, null if the host did not reply in time.
+	 */
+	pbnjson::JValue request(pbnjson::JValue message, unsigned int timeoutMs);
+	bool hostExited();
+
+	void receive();
+	bool checkChannel();
+	void handleMessage(const pbnjson::JValue &message);
+	pbnjson::JValue handleRequest(const std::string &op,
+	                              const pbnjson::JValue &message);
+	pbnjson::JValue callMethod(const std::string &category,
+	                           const std::string &method,
+	                           const pbnjson::JValue &params);
+
+	static gboolean receiveCallback(GIOChannel *channel,
+	                                GIOCondition condition,
+	                                gpointer userData);
+	static gboolean backlogCallback(gpointer userData);
+	static void childCallback(GPid pid, gint status, gpointer userData);
+
+private:
+	PluginAdapter *adapter;
+	const PluginInfo *info;
+	ShmChannel *channel;
+	GPid pid;
+	bool hostLost;
+	guint receiveSource;
+	guint childSource;
+	guint backlogSource;
+	int64_t nextSeq;
+
+	// Messages that did not fit the ring, sent once the host catches up.
+	std::deque<std::string> backlog;
+
+	// Origins of the latest events sent to the host, by token. The host
+	// tags the calls the plugin makes while handling an event with its
+	// token, so they run with the origin as in process.
+	int64_t nextOrigin;
+	std::vector<std::pair<int64_t, EventOrigin>> origins;
+};
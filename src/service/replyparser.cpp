@@ -0,0 +1,128 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "replyparser.h"
+#include "logging.h"
+#include "tracer.h"
+
+using namespace pbnjson;
+
+void ParsedReply::parse()
+{
+	if (this->status == REPLY_HUB_ERROR)
+	{
+		return;
+	}
+
+	{
+		Tracer::Span span("bus", "parse", std::string(), this->flow);
+		this->value = JDomParser::fromString(this->payload, JSchema::AllSchema());
+	}
+
+	if (!this->value.isValid())
+	{
+		this->status = REPLY_PARSE_ERROR;
+	}
+	else if (!this->value.isObject())
+	{
+		this->status = REPLY_NOT_OBJECT;
+	}
+	else
+	{
+		Tracer::Span span("bus", "validate", std::string(), this->flow);
+		JResult validation = this->schema.validate(this->value);
+
+		if (validation.isError())
+		{
+			this->status = REPLY_SCHEMA_ERROR;
+			this->schemaError = validation.errorString();
+		}
+	}
+}
+
+ReplyParser::ReplyParser(unsigned int laneCount, Delivery _delivery):
+	results(g_main_context_default()),
+	delivery(_delivery)
+{
+	for (unsigned int i = 0; i < laneCount; i++)
+	{
+		GError *error = nullptr;
+		GThreadPool *lane = g_thread_pool_new(ReplyParser::work, this, 1, TRUE, &error);
+
+		if (error)
+		{
+			LOG_ERROR(MSGID_LS2_REPLY_PARSER, 0,
+			          "Failed to start reply parser thread: %s", error->message);
+			g_error_free(error);
+			break;
+		}
+
+		this->lanes.push_back(lane);
+	}
+
+	LOG_INFO(MSGID_LS2_REPLY_PARSER, 0, "Parsing luna replies on %zu threads",
+	         this->lanes.size());
+}
+
+ReplyParser::~ReplyParser()
+{
+	for (GThreadPool *lane : this->lanes)
+	{
+		// Finishes what is queued, the results are dropped with the queue.
+		g_thread_pool_free(lane, FALSE, TRUE);
+	}
+
+	this->lanes.clear();
+}
+
+void ReplyParser::submit(ParsedReply *reply, unsigned long long laneKey)
+{
+	if (this->lanes.empty())
+	{
+		reply->parse();
+		this->delivery(*reply);
+		delete reply;
+		return;
+	}
+
+	GThreadPool *lane = this->lanes[laneKey % this->lanes.size()];
+
+	if (!g_thread_pool_push(lane, reply, nullptr))
+	{
+		reply->parse();
+		this->delivery(*reply);
+		delete reply;
+	}
+}
+
+void ReplyParser::work(gpointer data, gpointer userData)
+{
+	auto parser = reinterpret_cast<ReplyParser *>(userData);
+	auto reply = reinterpret_cast<ParsedReply *>(data);
+
+	reply->parse();
+
+	// Only the task owns the reply, so it is freed on the main loop, or with
+	// the task if the parser goes away first.
+	std::shared_ptr<ParsedReply> owned(reply);
+	TaskQueue::Task task = [parser, owned]()
+	{
+		parser->delivery(*owned);
+	};
+
+	owned.reset();
+	parser->results.post(std::move(task));
+}
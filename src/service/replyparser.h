@@ -0,0 +1,111 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glib.h>
+#include <pbnjson.hpp>
+
+#include "taskqueue.h"
+
+enum ReplyStatus
+{
+	REPLY_OK = 0,
+	REPLY_HUB_ERROR, // not parsed
+	REPLY_PARSE_ERROR,
+	REPLY_NOT_OBJECT,
+	REPLY_SCHEMA_ERROR,
+};
+
+/**
+ * Luna reply on its way from the bus to the plugin.
+ */
+class ParsedReply
+{
+public:
+	ParsedReply():
+		owner(nullptr),
+		serial(0),
+		flow(0),
+		receivedAt(0),
+		status(REPLY_OK),
+		schema(pbnjson::JSchema::AllSchema())
+	{};
+
+	// Set by the caller to find the receiver again.
+	const void *owner;
+	unsigned long long serial;
+	unsigned long long flow; // trace flow, see Tracer
+	gint64 receivedAt; // monotonic, us
+
+	ReplyStatus status;
+	std::string payload;
+	pbnjson::JSchema schema;
+
+	// Set by parse.
+	pbnjson::JValue value;
+	std::string schemaError;
+
+	/**
+	 * Parse the payload and validate it against the schema.
+	 * Does nothing for hub errors.
+	 */
+	void parse();
+};
+
+/**
+ * Parses and validates luna replies on worker threads instead of the main
+ * loop, see LunaService::setParseThreads.
+ * Each lane is a single worker, replies with the same lane key always take
+ * the same lane, so they are delivered in the order they were submitted.
+ */
+class ReplyParser
+{
+public:
+	/**
+	 * Called on the main loop with every parsed reply.
+	 */
+	typedef std::function<void(ParsedReply &reply)> Delivery;
+
+	ReplyParser(unsigned int lanes, Delivery delivery);
+
+	/**
+	 * Waits for the replies being parsed, replies not delivered yet are
+	 * dropped.
+	 */
+	~ReplyParser();
+
+	ReplyParser(const ReplyParser &) = delete;
+	ReplyParser &operator=(const ReplyParser &) = delete;
+
+	/**
+	 * Takes ownership of the reply.
+	 * @param laneKey - same key for replies that must stay in order.
+	 */
+	void submit(ParsedReply *reply, unsigned long long laneKey);
+
+private:
+	static void work(gpointer data, gpointer userData);
+
+private:
+	std::vector<GThreadPool *> lanes;
+	TaskQueue results;
+	Delivery delivery;
+};
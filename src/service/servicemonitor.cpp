@@ -15,6 +15,8 @@
 // SPDX-License-Identifier: Apache-2.0
 
 
+#include <algorithm>
+
 #include "servicemonitor.h"
 #include "logging.h"
 
@@ -24,7 +26,17 @@ ServiceMonitor::ServiceMonitor(PluginManager &_manager, LunaService &_service):
 	manager(_manager),
 	service(_service),
 	plugins(nullptr),
-	monitorStarted(false)
+	reconcileWindowMs(0),
+	reconcileSource(0),
+	unloadDelayMs(0),
+	flapThreshold(0),
+	flapWindowMs(0),
+	unloadTimer(0),
+	monitorStarted(false),
+	snapshot(nullptr),
+	restoreFromSnapshot(false),
+	scheduler(std::bind(&ServiceMonitor::startPlugin, this, std::placeholders::_1)),
+	startupBase(g_get_monotonic_time())
 {
 }
 
@@ -33,10 +45,34 @@ ServiceMonitor::~ServiceMonitor()
 	this->stopMonitor();
 }
 
-void ServiceMonitor::startMonitor(const std::vector<PluginInfo> *plugins)
+void ServiceMonitor::startMonitor(const PluginList *plugins)
 {
 	this->plugins = plugins;
 
+	// Plugins are instantiated once their library is opened, not right
+	// when they are started.
+	this->manager.setLoadListener([this](const PluginInfo *info)
+	{
+		this->markStartup("firstPluginLoaded");
+	});
+
+	// Deferred plugins are started one open at a time.
+	this->manager.setOpenListener([this](const PluginInfo *info)
+	{
+		for (size_t i = 0; i < this->pluginStates.size(); i++)
+		{
+			if (this->pluginStates[i].info == info)
+			{
+				this->scheduler.opened(i);
+			}
+		}
+	});
+
+	for (size_t i = 0; i < this->plugins->size(); i++)
+	{
+		this->indexPlugin(i);
+	}
+
 	JValue params = JObject{{"keys", JArray({JValue("localeInfo")})}};
 
 	this->service.subscribeToMethod("luna://com.webos.settingsservice/getSystemSettings",
@@ -48,13 +84,146 @@ void ServiceMonitor::startMonitor(const std::vector<PluginInfo> *plugins)
 	                          pbnjson::JSchema::AllSchema(),
 	                          nullptr,
 	                          false);
-	// Start the actual monitor once we have the locale information
-	// Otherwise plugins will be created with incorrect locale.
+	this->markStartup("localeRequested");
+
+	// Service status is monitored right away, in parallel with the locale
+	// request. Plugins are created only once we have the locale information,
+	// otherwise they would be created with incorrect locale.
+	for (const auto& iter : *this->plugins)
+	{
+		this->addPlugin(iter);
+	}
+
+	this->markStartup("statusRequested");
+
+	if (this->restoreFromSnapshot)
+	{
+		this->restoreSnapshot();
+	}
+}
+
+void ServiceMonitor::setSnapshot(StatusSnapshot *_snapshot, bool restore)
+{
+	this->snapshot = _snapshot;
+	this->restoreFromSnapshot = restore;
+}
+
+/**
+ * Start plugins from the last known locale and service status.
+ * Live replies will correct the status like any other status change.
+ */
+void ServiceMonitor::restoreSnapshot()
+{
+	if (!this->snapshot)
+	{
+		return;
+	}
+
+	JValue saved = this->snapshot->read();
+
+	if (saved.isNull())
+	{
+		return;
+	}
+
+	for (ServiceId id = 0; id < this->services.size(); id++)
+	{
+		ServiceState &state = this->services[id];
+		bool connected = false;
+
+		if (saved["services"][state.name].asBool(connected) || !connected)
+		{
+			continue;
+		}
+
+		state.connected = true;
+
+		for (size_t pluginIndex : state.dependents)
+		{
+			this->pluginStates[pluginIndex].unmetDependencies -= 1;
+		}
+
+		this->updatePlugins(id);
+	}
+
+	LOG_INFO(MSGID_STATUS_SNAPSHOT, 0, "Starting plugins from snapshot");
+
+	this->manager.notifyLocaleChanged(saved["locale"]);
+	this->monitorStarted = true;
+	this->markStartup("snapshotRestored");
+	this->reconcilePlugins();
+}
+
+void ServiceMonitor::saveSnapshot()
+{
+	if (!this->snapshot || !this->monitorStarted)
+	{
+		return;
+	}
+
+	JValue services = JObject();
+
+	for (const ServiceState &state : this->services)
+	{
+		services.put(state.name, JValue(state.connected));
+	}
+
+	this->snapshot->write(JObject{{"locale", this->manager.locale},
+	                              {"services", services}});
 }
 
 void ServiceMonitor::stopMonitor()
 {
+	this->scheduler.clear();
+	this->manager.setLoadListener(nullptr);
+	this->manager.setOpenListener(nullptr);
+
+	if (this->reconcileSource != 0)
+	{
+		g_source_remove(this->reconcileSource);
+		this->reconcileSource = 0;
+	}
+
+	if (this->unloadTimer != 0)
+	{
+		g_source_remove(this->unloadTimer);
+		this->unloadTimer = 0;
+	}
+}
+
+void ServiceMonitor::setReconcileWindow(unsigned int windowMs)
+{
+	this->reconcileWindowMs = windowMs;
+}
+
+void ServiceMonitor::setFlapDamping(unsigned int _unloadDelayMs,
+                                    unsigned int _flapThreshold,
+                                    unsigned int _flapWindowMs)
+{
+	this->unloadDelayMs = _unloadDelayMs;
+	this->flapThreshold = _flapThreshold;
+	this->flapWindowMs = _flapWindowMs;
+}
+
+JValue ServiceMonitor::getServiceStats()
+{
+	JValue services = JArray();
 
+	for (const ServiceState &state : this->services)
+	{
+		services.append(JObject{
+			{"service", JValue(state.name)},
+			{"connected", JValue(state.connected)},
+			{"outages", JValue(static_cast<int64_t>(state.outages))},
+			{"recentOutages", JValue(static_cast<int64_t>(state.windowOutages))},
+			{"flapping", JValue(state.damped)},
+			{"suppressedUnloads", JValue(static_cast<int64_t>(state.suppressedUnloads))}});
+	}
+
+	return JObject{{"unloadDelayMs", JValue(static_cast<int64_t>(this->unloadDelayMs))},
+	               {"flapThreshold", JValue(static_cast<int64_t>(this->flapThreshold))},
+	               {"flapWindowMs", JValue(static_cast<int64_t>(this->flapWindowMs))},
+	               {"services", services}};
 }
 
 void ServiceMonitor::localeCallback(pbnjson::JValue &previousValue,
@@ -69,16 +238,127 @@ void ServiceMonitor::localeCallback(pbnjson::JValue &previousValue,
 		return;
 	}
 
-	this->manager.notifyLocaleChanged(locale);
+	if (!this->monitorStarted || locale != this->manager.locale)
+	{
+		// Skipped if same as the one restored from snapshot.
+		this->manager.notifyLocaleChanged(locale);
+	}
+
+	this->markStartup("localeReceived");
 
 	if (!this->monitorStarted)
 	{
-		for (const auto& iter : *this->plugins)
+		this->monitorStarted = true;
+		// Apply service status collected while waiting for the locale.
+		this->reconcilePlugins();
+	}
+
+	this->saveSnapshot();
+}
+
+/**
+ * Record the first occurrence of a startup milestone.
+ */
+void ServiceMonitor::markStartup(const char *event)
+{
+	for (const auto &iter : this->startupEvents)
+	{
+		if (iter.first == event)
 		{
-			this->addPlugin(iter);
+			return;
 		}
+	}
 
-		this->monitorStarted = true;
+	gint64 elapsedMs = (g_get_monotonic_time() - this->startupBase) / 1000;
+	this->startupEvents.push_back(std::make_pair(std::string(event), elapsedMs));
+
+	LOG_INFO(MSGID_STARTUP_TIMELINE, 0, "%s at %lld ms", event,
+	         static_cast<long long>(elapsedMs));
+}
+
+JValue ServiceMonitor::getStartupTimeline()
+{
+	JValue timeline = JObject();
+
+	for (const auto &iter : this->startupEvents)
+	{
+		timeline.put(iter.first, JValue(static_cast<int64_t>(iter.second)));
+	}
+
+	return timeline;
+}
+
+ServiceId ServiceMonitor::internService(const std::string &serviceName)
+{
+	auto iter = this->serviceIds.find(serviceName);
+
+	if (iter != this->serviceIds.end())
+	{
+		return iter->second;
+	}
+
+	ServiceId id = static_cast<ServiceId>(this->services.size());
+	this->serviceIds[serviceName] = id;
+	this->services.push_back(ServiceState());
+	this->services[id].name = serviceName;
+	this->services[id].connected = false;
+	this->services[id].monitored = false;
+	this->services[id].seenOnline = false;
+	this->services[id].lastOnlineAt = 0;
+	this->services[id].flapWindowStart = 0;
+	this->services[id].windowOutages = 0;
+	this->services[id].outages = 0;
+	this->services[id].suppressedUnloads = 0;
+	this->services[id].damped = false;
+	return id;
+}
+
+/**
+ * Add plugin to the reverse dependency index. All services start offline,
+ * so initially every required service is unmet.
+ */
+void ServiceMonitor::indexPlugin(size_t pluginIndex)
+{
+	const PluginInfo &info = (*this->plugins)[pluginIndex];
+
+	if (this->pluginStates.size() <= pluginIndex)
+	{
+		this->pluginStates.resize(pluginIndex + 1);
+	}
+
+	PluginState &state = this->pluginStates[pluginIndex];
+	state.info = &info;
+	state.unmetDependencies = 0;
+	state.ready = false;
+	state.dirty = false;
+	state.lastService = 0;
+	state.services.clear();
+	state.paused = false;
+	state.unloadSuppressed = false;
+	state.pausedAt = 0;
+
+	std::set<ServiceId> required;
+
+	for (const auto &serviceName : info.requiredServices)
+	{
+		required.insert(this->internService(serviceName));
+	}
+
+	for (ServiceId id : required)
+	{
+		this->services[id].dependents.push_back(pluginIndex);
+		state.services.push_back(id);
+
+		if (!this->services[id].connected)
+		{
+			state.unmetDependencies += 1;
+		}
+	}
+
+	if (state.services.empty())
+	{
+		// No service status will ever mark it, ready right away.
+		this->markDirty(pluginIndex, 0);
 	}
 }
 
@@ -88,14 +368,16 @@ void ServiceMonitor::addPlugin(const PluginInfo &info)
 
 	for (const auto& service : info.requiredServices)
 	{
-		if (this->serviceStatus.count(service) > 0)
+		ServiceState &state = this->services[this->internService(service)];
+
+		if (state.monitored)
 		{
 			continue; //already subscribed.
 		}
 
 		LOG_INFO(MSGID_SERVICE_STATUS, 0, "Monitoring service %s", service.c_str());
 
-		this->serviceStatus[service] = false;
+		state.monitored = true;
 		JValue params = JObject{{"serviceName", JValue(service.c_str())}};
 
 		this->service.subscribeToMethod(
@@ -111,6 +393,65 @@ void ServiceMonitor::addPlugin(const PluginInfo &info)
 	}
 }
 
+void ServiceMonitor::pluginChanged(size_t pluginIndex, PluginChange change)
+{
+	if (change == PLUGIN_REMOVED)
+	{
+		this->removePlugin(pluginIndex);
+		return;
+	}
+
+	this->indexPlugin(pluginIndex);
+
+	const PluginInfo &info = (*this->plugins)[pluginIndex];
+	this->addPlugin(info);
+
+	PluginState &state = this->pluginStates[pluginIndex];
+
+	if (!state.services.empty())
+	{
+		// Loaded by reconcile if the services are already online.
+		this->markDirty(pluginIndex, state.services.front());
+	}
+
+	// Plugins without required services are marked by indexPlugin.
+	this->scheduleReconcile();
+}
+
+/**
+ * Unload the plugin and drop it from the reverse dependency index.
+ * Services stay monitored.
+ */
+void ServiceMonitor::removePlugin(size_t pluginIndex)
+{
+	PluginState &state = this->pluginStates[pluginIndex];
+
+	(void) this->scheduler.cancel(pluginIndex);
+
+	if (state.dirty)
+	{
+		state.dirty = false;
+		this->dirtyPlugins.erase(std::remove(this->dirtyPlugins.begin(),
+		                                     this->dirtyPlugins.end(), pluginIndex),
+		                         this->dirtyPlugins.end());
+	}
+
+	for (ServiceId id : state.services)
+	{
+		std::vector<size_t> &dependents = this->services[id].dependents;
+		dependents.erase(std::remove(dependents.begin(), dependents.end(), pluginIndex),
+		                 dependents.end());
+	}
+
+	this->manager.removePlugin(state.info);
+
+	state.services.clear();
+	state.unmetDependencies = 0;
+	state.ready = false;
+	state.paused = false;
+	state.unloadSuppressed = false;
+}
+
 void ServiceMonitor::serviceStatusCallback(pbnjson::JValue &previousValue,
         pbnjson::JValue &value)
 {
@@ -128,15 +469,22 @@ void ServiceMonitor::serviceStatusCallback(pbnjson::JValue &previousValue,
 		throw Error("Could not parse registerServerStatus response");
 	}
 
-	if (this->serviceStatus.count(serviceName) == 0)
+	auto idIter = this->serviceIds.find(serviceName);
+
+	if (idIter == this->serviceIds.end())
 	{
 		LOG_WARNING(MSGID_SERVICE_STATUS, 0,
 		            "Service status response on unexpected service: %s", value.stringify().c_str());
 		return;
 	}
 
-	bool wasConnected = this->serviceStatus[serviceName];
-	this->serviceStatus[serviceName] = connected;
+	this->markStartup("firstServiceStatus");
+
+	ServiceState &state = this->services[idIter->second];
+	bool wasConnected = state.connected;
+	state.connected = connected;
+	// Also when restored online from the snapshot, there is no transition.
+	state.seenOnline = state.seenOnline || connected;
 
 	if (connected)
 	{
@@ -151,32 +499,307 @@ void ServiceMonitor::serviceStatusCallback(pbnjson::JValue &previousValue,
 
 	if (wasConnected != connected)
 	{
-		this->updatePlugins(serviceName);
+		this->recordTransition(state, connected);
+
+		for (size_t pluginIndex : state.dependents)
+		{
+			if (connected)
+			{
+				this->pluginStates[pluginIndex].unmetDependencies -= 1;
+			}
+			else
+			{
+				this->pluginStates[pluginIndex].unmetDependencies += 1;
+			}
+		}
+
+		this->updatePlugins(idIter->second);
 	}
 }
 
-void ServiceMonitor::updatePlugins(const std::string &serviceName)
+/**
+ * Mark the plugins depending on the service for reconcile.
+ * Only plugins that require the service are touched.
+ */
+void ServiceMonitor::updatePlugins(ServiceId serviceId)
 {
-	for (const PluginInfo &plugin : *this->plugins)
+	for (size_t pluginIndex : this->services[serviceId].dependents)
 	{
-		bool dependenciesMet = true;
+		this->markDirty(pluginIndex, serviceId);
+	}
+
+	this->scheduleReconcile();
+}
+
+void ServiceMonitor::markDirty(size_t pluginIndex, ServiceId serviceId)
+{
+	PluginState &plugin = this->pluginStates[pluginIndex];
+	plugin.lastService = serviceId;
+
+	if (!plugin.dirty)
+	{
+		plugin.dirty = true;
+		this->dirtyPlugins.push_back(pluginIndex);
+	}
+}
+
+/**
+ * Service whose change made the plugin dirty, empty for plugins without
+ * required services.
+ */
+const std::string &ServiceMonitor::lastServiceName(const PluginState &plugin)
+{
+	static const std::string none;
+
+	if (plugin.services.empty())
+	{
+		return none;
+	}
+
+	return this->services[plugin.lastService].name;
+}
 
-		for (const std::string &service : plugin.requiredServices)
+void ServiceMonitor::scheduleReconcile()
+{
+	if (this->reconcileSource != 0 || this->dirtyPlugins.empty() ||
+	        !this->monitorStarted)
+	{
+		// Waiting for locale, reconciled once it arrives.
+		return;
+	}
+
+	if (this->reconcileWindowMs == 0)
+	{
+		// Runs after all pending bus messages are dispatched.
+		this->reconcileSource = g_idle_add(ServiceMonitor::reconcileCallback, this);
+	}
+	else
+	{
+		this->reconcileSource = g_timeout_add(this->reconcileWindowMs,
+		                                      ServiceMonitor::reconcileCallback, this);
+	}
+}
+
+gboolean ServiceMonitor::reconcileCallback(gpointer userData)
+{
+	auto monitor = reinterpret_cast<ServiceMonitor *>(userData);
+	monitor->reconcileSource = 0;
+	monitor->reconcilePlugins();
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * Load or unload the plugins whose readiness changed since last reconcile.
+ */
+void ServiceMonitor::reconcilePlugins()
+{
+	std::vector<size_t> pending;
+	pending.swap(this->dirtyPlugins);
+
+	for (size_t pluginIndex : pending)
+	{
+		PluginState &plugin = this->pluginStates[pluginIndex];
+		plugin.dirty = false;
+
+		bool ready = plugin.unmetDependencies == 0;
+
+		if (ready == plugin.ready)
+		{
+			// Changed back within the window.
+			continue;
+		}
+
+		plugin.ready = ready;
+		const std::string &serviceName = this->lastServiceName(plugin);
+
+		if (ready && plugin.paused && this->manager.isPluginLoaded(plugin.info) &&
+		        plugin.info->handlesResume)
+		{
+			plugin.paused = false;
+			this->manager.notifyServiceResumed(plugin.info, serviceName);
+		}
+		else if (ready && plugin.paused && this->manager.isPluginLoaded(plugin.info))
 		{
-			if (!this->serviceStatus[service])
+			// Its subscriptions to the service were cancelled by the hub
+			// error, start monitoring again to renew them.
+			LOG_INFO(MSGID_SERVICE_STATUS, 0, "Restarting plugin %s, service %s is back",
+			         plugin.info->name.c_str(), serviceName.c_str());
+			plugin.paused = false;
+			this->manager.notifyPluginShouldUnload(plugin.info, serviceName);
+			this->scheduler.schedule(pluginIndex, plugin.info->bootClass);
+		}
+		else if (ready)
+		{
+			plugin.paused = false;
+			this->scheduler.schedule(pluginIndex, plugin.info->bootClass);
+		}
+		else if (this->scheduler.cancel(pluginIndex))
+		{
+			// Was not started yet.
+			continue;
+		}
+		else if (this->unloadDelayMs > 0 && this->services[plugin.lastService].seenOnline)
+		{
+			// A service only restored from the snapshot had no outage to
+			// ride out, its plugins are stopped right away below.
+			plugin.paused = true;
+			plugin.unloadSuppressed = false;
+			plugin.pausedAt = g_get_monotonic_time();
+			this->manager.notifyServicePaused(plugin.info, serviceName);
+
+			if (this->unloadTimer == 0)
 			{
-				dependenciesMet = false;
-				break;
+				this->unloadTimer = g_timeout_add(this->unloadDelayMs,
+				                                  ServiceMonitor::unloadCallback, this);
 			}
 		}
+		else
+		{
+			this->manager.notifyPluginShouldUnload(plugin.info, serviceName);
+		}
+	}
+
+	this->saveSnapshot();
+}
+
+/**
+ * Called by the scheduler, right away or from an idle callback.
+ * @return true if the plugin library is being opened.
+ */
+bool ServiceMonitor::startPlugin(size_t pluginIndex)
+{
+	PluginState &plugin = this->pluginStates[pluginIndex];
+
+	if (!plugin.ready)
+	{
+		return false;
+	}
+
+	this->manager.loadPlugin(plugin.info, this->lastServiceName(plugin));
+	return this->manager.isPluginOpening(plugin.info);
+}
+
+void ServiceMonitor::setStartBudget(unsigned int budgetMs)
+{
+	this->scheduler.setSlotBudget(budgetMs);
+}
+
+JValue ServiceMonitor::getSchedulerStats()
+{
+	return this->scheduler.getStats();
+}
+
+/**
+ * Update flap statistics of a service that changed state.
+ */
+void ServiceMonitor::recordTransition(ServiceState &state, bool connected)
+{
+	gint64 now = g_get_monotonic_time();
+	gint64 windowUs = static_cast<gint64>(this->flapWindowMs) * 1000;
+
+	if (connected)
+	{
+		state.lastOnlineAt = now;
+		return;
+	}
+
+	// Restored from the snapshot but not there any more, not an outage.
+	if (!state.seenOnline)
+	{
+		return;
+	}
+
+	state.outages += 1;
+
+	if (state.damped && now - state.lastOnlineAt >= windowUs)
+	{
+		LOG_INFO(MSGID_SERVICE_FLAPPING, 0, "Service %s is stable again",
+		         state.name.c_str());
+		state.damped = false;
+	}
 
-		if (dependenciesMet)
+	if (now - state.flapWindowStart >= windowUs)
+	{
+		state.flapWindowStart = now;
+		state.windowOutages = 0;
+	}
+
+	state.windowOutages += 1;
+
+	if (!state.damped && this->flapThreshold > 0 &&
+	        state.windowOutages >= this->flapThreshold)
+	{
+		LOG_WARNING(MSGID_SERVICE_FLAPPING, 0,
+		            "Service %s went offline %u times within %u ms, keeping its plugins",
+		            state.name.c_str(), state.windowOutages, this->flapWindowMs);
+		state.damped = true;
+	}
+}
+
+gboolean ServiceMonitor::unloadCallback(gpointer userData)
+{
+	auto monitor = reinterpret_cast<ServiceMonitor *>(userData);
+	monitor->unloadTimer = 0;
+	monitor->checkPausedPlugins();
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * Ask paused plugins to stop monitoring once the delay has passed,
+ * unless one of their offline services is flapping.
+ */
+void ServiceMonitor::checkPausedPlugins()
+{
+	gint64 now = g_get_monotonic_time();
+	gint64 delayUs = static_cast<gint64>(this->unloadDelayMs) * 1000;
+	gint64 nextCheck = -1;
+
+	for (PluginState &plugin : this->pluginStates)
+	{
+		if (!plugin.paused || plugin.unloadSuppressed)
 		{
-			this->manager.loadPlugin(&plugin, serviceName);
+			continue;
 		}
-		else
+
+		if (now - plugin.pausedAt < delayUs)
+		{
+			gint64 remaining = plugin.pausedAt + delayUs - now;
+
+			if (nextCheck < 0 || remaining < nextCheck)
+			{
+				nextCheck = remaining;
+			}
+
+			continue;
+		}
+
+		ServiceState *damped = nullptr;
+
+		for (ServiceId id : plugin.services)
 		{
-			this->manager.notifyPluginShouldUnload(&plugin, serviceName);
+			if (!this->services[id].connected && this->services[id].damped)
+			{
+				damped = &this->services[id];
+				break;
+			}
+		}
+
+		if (damped)
+		{
+			LOG_INFO(MSGID_SERVICE_FLAPPING, 0, "Not unloading plugin %s, service %s is flapping",
+			         plugin.info->name.c_str(), damped->name.c_str());
+			damped->suppressedUnloads += 1;
+			plugin.unloadSuppressed = true;
+			continue;
 		}
+
+		plugin.paused = false;
+		this->manager.notifyPluginShouldUnload(plugin.info, this->lastServiceName(plugin));
+	}
+
+	if (nextCheck >= 0)
+	{
+		this->unloadTimer = g_timeout_add(static_cast<guint>(nextCheck / 1000) + 1,
+		                                  ServiceMonitor::unloadCallback, this);
 	}
 }
@@ -20,6 +20,53 @@
 #include "lunaservice.h"
 #include "pluginloader.h"
 #include "pluginmanager.h"
+#include "startupscheduler.h"
+#include "statussnapshot.h"
+
+/**
+ * Interned service name, index to ServiceMonitor::services.
+ */
+typedef unsigned int ServiceId;
+
+class ServiceState
+{
+public:
+	std::string name;
+	bool connected;
+	bool monitored; // registerServerStatus subscribed
+	// Reported online in this run, not only restored from the snapshot.
+	bool seenOnline;
+	// Indexes of plugins requiring this service.
+	std::vector<size_t> dependents;
+
+	// Flap statistics, times are monotonic in us.
+	gint64 lastOnlineAt;
+	gint64 flapWindowStart;
+	unsigned int windowOutages;
+	unsigned long long outages;
+	unsigned long long suppressedUnloads;
+	bool damped; // flapping, plugins are paused instead of unloaded
+};
+
+class PluginState
+{
+public:
+	const PluginInfo *info;
+	// Required services that are not connected.
+	unsigned int unmetDependencies;
+	// Readiness the manager was last told about.
+	bool ready;
+	// Waiting for reconcile, lastService is the last service that changed,
+	// unused if there are no required services.
+	bool dirty;
+	ServiceId lastService;
+	// Required services, deduplicated.
+	std::vector<ServiceId> services;
+	// Told about service outage, stopMonitoring not called yet.
+	bool paused;
+	bool unloadSuppressed;
+	gint64 pausedAt;
+};
 
 /**
  * Monitors all services present in plugin loader's list and notifies
@@ -32,23 +79,107 @@ public:
 	ServiceMonitor(PluginManager &manager, LunaService &service);
 	~ServiceMonitor();
 
-	void startMonitor(const std::vector<PluginInfo> *plugins);
+	void startMonitor(const PluginList *plugins);
 	void stopMonitor();
 
+	/**
+	 * Plugin file was added, changed or removed while running.
+	 * Removed plugins are unloaded right away, added plugins are loaded
+	 * if their required services are online.
+	 */
+	void pluginChanged(size_t pluginIndex, PluginChange change);
+
+	/**
+	 * Service status changes are collected and plugins are loaded or
+	 * unloaded at most once per window. Plugins whose readiness changed
+	 * back within the window are not touched.
+	 * @param windowMs - collect window, 0 to reconcile once per main loop iteration.
+	 */
+	void setReconcileWindow(unsigned int windowMs);
+
+	/**
+	 * When required service goes offline, plugin first gets servicePaused and
+	 * is asked to stop monitoring only if the service stays offline for
+	 * unloadDelayMs. Services going offline flapThreshold times within
+	 * flapWindowMs are considered flapping and their plugins stay paused
+	 * until the service comes back. Flapping ends once the service stays
+	 * online for flapWindowMs. When the service comes back, a paused plugin
+	 * gets serviceResumed if it handles resume, else it is restarted.
+	 * @param unloadDelayMs - 0 to stop monitoring right away.
+	 * @param flapThreshold - 0 to disable flap detection.
+	 */
+	void setFlapDamping(unsigned int unloadDelayMs,
+	                    unsigned int flapThreshold,
+	                    unsigned int flapWindowMs);
+
+	/**
+	 * Keep last known locale and service status in the snapshot.
+	 * @param restore - if true, startMonitor will start the plugins from
+	 *                  the snapshot without waiting for bus replies.
+	 */
+	void setSnapshot(StatusSnapshot *snapshot, bool restore);
+
+	/**
+	 * Plugins that are not critical are started from idle callbacks,
+	 * spending at most budgetMs per callback.
+	 * @param budgetMs - 0 to start all plugins right away.
+	 */
+	void setStartBudget(unsigned int budgetMs);
+
+	pbnjson::JValue getSchedulerStats();
+
+	pbnjson::JValue getServiceStats();
+
+	/**
+	 * Milliseconds from service monitor creation to startup milestones.
+	 */
+	pbnjson::JValue getStartupTimeline();
 
 
 private:
 	void localeCallback(pbnjson::JValue &previousValue, pbnjson::JValue &value);
 	void serviceStatusCallback(pbnjson::JValue &previousValue,
 	                           pbnjson::JValue &value);
+	void indexPlugin(size_t pluginIndex);
+	ServiceId internService(const std::string &serviceName);
 	void addPlugin(const PluginInfo &info);
-	void updatePlugins(const std::string &serviceName);
+	void updatePlugins(ServiceId serviceId);
+	void markDirty(size_t pluginIndex, ServiceId serviceId);
+	const std::string &lastServiceName(const PluginState &plugin);
+	void scheduleReconcile();
+	void removePlugin(size_t pluginIndex);
+	void reconcilePlugins();
+	bool startPlugin(size_t pluginIndex);
+	static gboolean reconcileCallback(gpointer userData);
+	void recordTransition(ServiceState &state, bool connected);
+	void checkPausedPlugins();
+	static gboolean unloadCallback(gpointer userData);
+	void markStartup(const char *event);
+	void restoreSnapshot();
+	void saveSnapshot();
 
 private:
 	PluginManager &manager;
 	LunaService &service;
-	const std::vector<PluginInfo> *plugins;
+	const PluginList *plugins;
+
+	std::unordered_map<std::string, ServiceId> serviceIds;
+	std::vector<ServiceState> services;
+	std::vector<PluginState> pluginStates;
+	std::vector<size_t> dirtyPlugins;
+	unsigned int reconcileWindowMs;
+	guint reconcileSource;
+	unsigned int unloadDelayMs;
+	unsigned int flapThreshold;
+	unsigned int flapWindowMs;
+	guint unloadTimer;
+	bool monitorStarted; // locale received, plugins can be created
+
+	StatusSnapshot *snapshot;
+	bool restoreFromSnapshot;
+
+	StartupScheduler scheduler;
 
-	std::unordered_map<std::string, bool> serviceStatus;
-	bool monitorStarted;
+	gint64 startupBase;
+	std::vector<std::pair<std::string, gint64>> startupEvents;
 };
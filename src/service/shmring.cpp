@@ -0,0 +1,290 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+#include "shmring.h"
+
+// Length of a record that only skips to the start of the ring.
+static const uint32_t WRAP_MARKER = 0xffffffff;
+
+static size_t recordSize(uint32_t length)
+{
+	return (sizeof(uint32_t) + length + 7) & ~static_cast<size_t>(7);
+}
+
+ShmRing::ShmRing(void *memory, size_t _capacity, bool initialize):
+	header(reinterpret_cast<Header *>(memory)),
+	data(reinterpret_cast<char *>(memory) + sizeof(Header)),
+	capacity(_capacity),
+	readTail(0),
+	broken(false)
+{
+	if (initialize)
+	{
+		new (this->header) Header();
+		this->header->head.store(0, std::memory_order_relaxed);
+		this->header->tail.store(0, std::memory_order_relaxed);
+	}
+
+	this->readTail = this->header->tail.load(std::memory_order_relaxed);
+}
+
+size_t ShmRing::mappingSize(size_t capacity)
+{
+	return sizeof(Header) + capacity;
+}
+
+bool ShmRing::write(const char *message, uint32_t length)
+{
+	if (length > this->maxMessageSize())
+	{
+		return false;
+	}
+
+	uint64_t head = this->header->head.load(std::memory_order_relaxed);
+	uint64_t tail = this->header->tail.load(std::memory_order_acquire);
+	size_t offset = head & (this->capacity - 1);
+	size_t needed = recordSize(length);
+	size_t skip = 0;
+
+	if (offset + needed > this->capacity)
+	{
+		// Records are contiguous, skip the rest of the ring.
+		skip = this->capacity - offset;
+	}
+
+	if (this->capacity - (head - tail) < skip + needed)
+	{
+		return false;
+	}
+
+	if (skip)
+	{
+		memcpy(this->data + offset, &WRAP_MARKER, sizeof(WRAP_MARKER));
+		offset = 0;
+	}
+
+	memcpy(this->data + offset, &length, sizeof(length));
+	memcpy(this->data + offset + sizeof(length), message, length);
+	this->header->head.store(head + skip + needed, std::memory_order_release);
+	return true;
+}
+
+bool ShmRing::read(std::string &message)
+{
+	if (this->broken)
+	{
+		return false;
+	}
+
+	uint64_t tail = this->readTail;
+	uint64_t head = this->header->head.load(std::memory_order_acquire);
+
+	while (tail != head)
+	{
+		// Also catches a head behind the tail, the difference wraps.
+		if (head - tail > this->capacity)
+		{
+			this->broken = true;
+			return false;
+		}
+
+		size_t offset = tail & (this->capacity - 1);
+		uint32_t length;
+		memcpy(&length, this->data + offset, sizeof(length));
+
+		if (length == WRAP_MARKER)
+		{
+			tail += this->capacity - offset;
+			continue;
+		}
+
+		if (length > this->maxMessageSize() ||
+		        offset + sizeof(length) + length > this->capacity ||
+		        recordSize(length) > head - tail)
+		{
+			this->broken = true;
+			return false;
+		}
+
+		message.assign(this->data + offset + sizeof(length), length);
+		this->readTail = tail + recordSize(length);
+		this->header->tail.store(this->readTail, std::memory_order_release);
+		return true;
+	}
+
+	this->readTail = tail;
+	this->header->tail.store(tail, std::memory_order_release);
+	return false;
+}
+
+ShmChannel *ShmChannel::create(size_t capacity)
+{
+	int memoryFd = memfd_create("event-monitor-channel", MFD_CLOEXEC);
+
+	if (memoryFd < 0)
+	{
+		return nullptr;
+	}
+
+	if (ftruncate(memoryFd, ShmRing::mappingSize(capacity) * 2) != 0)
+	{
+		close(memoryFd);
+		return nullptr;
+	}
+
+	int toHostFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	int toDaemonFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	if (toHostFd < 0 || toDaemonFd < 0)
+	{
+		close(memoryFd);
+
+		if (toHostFd >= 0)
+		{
+			close(toHostFd);
+		}
+
+		if (toDaemonFd >= 0)
+		{
+			close(toDaemonFd);
+		}
+
+		return nullptr;
+	}
+
+	ShmChannel *channel = new ShmChannel(memoryFd, toHostFd, toDaemonFd,
+	                                     capacity, true);
+
+	if (!channel->memory)
+	{
+		delete channel;
+		return nullptr;
+	}
+
+	return channel;
+}
+
+ShmChannel *ShmChannel::attach(size_t capacity)
+{
+	(void) fcntl(HOST_TO_HOST_FD, F_SETFL, O_NONBLOCK);
+	(void) fcntl(HOST_TO_DAEMON_FD, F_SETFL, O_NONBLOCK);
+
+	ShmChannel *channel = new ShmChannel(HOST_MEMORY_FD, HOST_TO_HOST_FD,
+	                                     HOST_TO_DAEMON_FD, capacity, false);
+
+	if (!channel->memory)
+	{
+		delete channel;
+		return nullptr;
+	}
+
+	return channel;
+}
+
+ShmChannel::ShmChannel(int _memoryFd, int _toHostFd, int _toDaemonFd,
+                       size_t capacity, bool daemonSide):
+	memoryFd(_memoryFd),
+	toHostFd(_toHostFd),
+	toDaemonFd(_toDaemonFd),
+	memory(nullptr),
+	mappingSize(ShmRing::mappingSize(capacity) * 2),
+	sendRing(nullptr),
+	receiveRing(nullptr),
+	sendFd(daemonSide ? _toHostFd : _toDaemonFd),
+	receiveFd(daemonSide ? _toDaemonFd : _toHostFd)
+{
+	void *mapping = mmap(nullptr, this->mappingSize, PROT_READ | PROT_WRITE,
+	                     MAP_SHARED, this->memoryFd, 0);
+
+	if (mapping == MAP_FAILED)
+	{
+		return;
+	}
+
+	this->memory = mapping;
+
+	char *toHost = reinterpret_cast<char *>(mapping);
+	char *toDaemon = toHost + ShmRing::mappingSize(capacity);
+
+	ShmRing *toHostRing = new ShmRing(toHost, capacity, daemonSide);
+	ShmRing *toDaemonRing = new ShmRing(toDaemon, capacity, daemonSide);
+
+	this->sendRing = daemonSide ? toHostRing : toDaemonRing;
+	this->receiveRing = daemonSide ? toDaemonRing : toHostRing;
+}
+
+ShmChannel::~ShmChannel()
+{
+	delete this->sendRing;
+	delete this->receiveRing;
+
+	if (this->memory)
+	{
+		munmap(this->memory, this->mappingSize);
+	}
+
+	close(this->memoryFd);
+	close(this->toHostFd);
+	close(this->toDaemonFd);
+}
+
+bool ShmChannel::send(const std::string &message)
+{
+	if (!this->sendRing->write(message.data(), message.size()))
+	{
+		return false;
+	}
+
+	uint64_t one = 1;
+	(void) ::write(this->sendFd, &one, sizeof(one));
+	return true;
+}
+
+bool ShmChannel::receive(std::string &message)
+{
+	return this->receiveRing->read(message);
+}
+
+void ShmChannel::clearSignal()
+{
+	uint64_t count;
+	(void) ::read(this->receiveFd, &count, sizeof(count));
+}
+
+bool ShmChannel::prepareChild() const
+{
+	// dup2 clears close-on-exec on the new descriptor. Duplicate through
+	// free numbers first, in case the sources overlap the targets. The
+	// copies are close-on-exec, only the targets reach the host.
+	int memoryCopy = fcntl(this->memoryFd, F_DUPFD_CLOEXEC, 10);
+	int toHostCopy = fcntl(this->toHostFd, F_DUPFD_CLOEXEC, 10);
+	int toDaemonCopy = fcntl(this->toDaemonFd, F_DUPFD_CLOEXEC, 10);
+
+	if (memoryCopy < 0 || toHostCopy < 0 || toDaemonCopy < 0)
+	{
+		return false;
+	}
+
+	return dup2(memoryCopy, HOST_MEMORY_FD) == HOST_MEMORY_FD &&
+	       dup2(toHostCopy, HOST_TO_HOST_FD) == HOST_TO_HOST_FD &&
+	       dup2(toDaemonCopy, HOST_TO_DAEMON_FD) == HOST_TO_DAEMON_FD;
+}
@@ -0,0 +1,165 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * File descriptors the plugin host inherits from the event monitor.
+ */
+const int HOST_MEMORY_FD = 3;
+const int HOST_TO_HOST_FD = 4;
+const int HOST_TO_DAEMON_FD = 5;
+
+/**
+ * Size of each ring between the event monitor and a plugin host.
+ */
+const size_t HOST_CHANNEL_CAPACITY = 256 * 1024;
+
+/**
+ * Single producer, single consumer ring of length prefixed messages
+ * in shared memory.
+ */
+class ShmRing
+{
+public:
+	/**
+	 * @param memory - mapping of at least mappingSize(capacity) bytes.
+	 * @param capacity - data size, power of two.
+	 * @param initialize - true on the side that created the memory.
+	 */
+	ShmRing(void *memory, size_t capacity, bool initialize);
+
+	static size_t mappingSize(size_t capacity);
+
+	/**
+	 * @return false if there is not enough free space.
+	 */
+	bool write(const char *data, uint32_t length);
+
+	/**
+	 * The other process can write anything to the ring, records that do
+	 * not fit it are not read and break the ring for good.
+	 * @return false if the ring is empty or broken.
+	 */
+	bool read(std::string &message);
+
+	bool isBroken() const
+	{
+		return this->broken;
+	}
+
+	size_t maxMessageSize() const
+	{
+		return this->capacity / 2;
+	}
+
+private:
+	struct Header
+	{
+		// Positions only grow, offset is position % capacity.
+		// Separate cache lines, written by different processes.
+		alignas(64) std::atomic<uint64_t> head; // written by producer
+		alignas(64) std::atomic<uint64_t> tail; // written by consumer
+	};
+
+	Header *header;
+	char *data;
+	size_t capacity;
+	// Consumer position, kept here as the shared tail can be overwritten.
+	uint64_t readTail;
+	bool broken;
+};
+
+/**
+ * Two rings in one shared memory file and an eventfd for each direction.
+ * The event monitor sends on the first ring, the plugin host on the second.
+ */
+class ShmChannel
+{
+public:
+	/**
+	 * Create the shared memory and eventfds, in the event monitor.
+	 * @return nullptr on failure.
+	 */
+	static ShmChannel *create(size_t capacity);
+
+	/**
+	 * Attach to the inherited file descriptors, in the plugin host.
+	 */
+	static ShmChannel *attach(size_t capacity);
+
+	~ShmChannel();
+
+	ShmChannel(const ShmChannel &) = delete;
+	ShmChannel &operator=(const ShmChannel &) = delete;
+
+	/**
+	 * Queue the message and wake up the other side.
+	 * @return false if the ring is full or the message is too large.
+	 */
+	bool send(const std::string &message);
+
+	bool receive(std::string &message);
+
+	/**
+	 * The other side wrote an invalid record, nothing more can be received.
+	 */
+	bool isBroken() const
+	{
+		return this->receiveRing->isBroken();
+	}
+
+	size_t maxMessageSize() const
+	{
+		return this->sendRing->maxMessageSize();
+	}
+
+	/**
+	 * Becomes readable when the other side sent something.
+	 * Call clearSignal before draining with receive.
+	 */
+	int getReceiveFd() const
+	{
+		return this->receiveFd;
+	}
+
+	void clearSignal();
+
+	/**
+	 * Make the descriptors available to the plugin host at the fixed
+	 * numbers. Only async-signal-safe calls, use after fork.
+	 */
+	bool prepareChild() const;
+
+private:
+	ShmChannel(int memoryFd, int toHostFd, int toDaemonFd, size_t capacity,
+	           bool daemonSide);
+
+	int memoryFd;
+	int toHostFd;
+	int toDaemonFd;
+	void *memory;
+	size_t mappingSize;
+	ShmRing *sendRing;
+	ShmRing *receiveRing;
+	int sendFd;
+	int receiveFd;
+};
@@ -0,0 +1,392 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <execinfo.h>
+#include <signal.h>
+
+#include "stallwatchdog.h"
+#include "flightrecorder.h"
+#include "logging.h"
+
+using namespace pbnjson;
+
+// Helper thread checks this many times per threshold.
+static const unsigned int CHECKS_PER_THRESHOLD = 4;
+static const gint64 MIN_CHECK_INTERVAL_US = 10000;
+
+// Stack capture, the main thread fills these from the signal handler.
+static const int STACK_SIGNAL = SIGUSR2;
+static const int MAX_STACK_FRAMES = 32;
+static const gint64 STACK_WAIT_US = 100000;
+static void *stackFrames[MAX_STACK_FRAMES];
+static std::atomic<int> stackDepth(-1);
+
+StallWatchdog *StallWatchdog::instance = nullptr;
+
+static void copyName(char *target, size_t size, const std::string &source)
+{
+	size_t length = std::min(source.size(), size - 1);
+	memcpy(target, source.data(), length);
+	target[length] = '\0';
+}
+
+StallWatchdog::Activity::Activity(const std::string &plugin, const char *callback,
+                                  const std::string &detail, bool dynamicDetail):
+	recordedAt(0),
+	recordedPlugin(FLIGHT_NO_STRING),
+	active(StallWatchdog::instance != nullptr)
+{
+	if (FlightRecorder::isRecording())
+	{
+		this->recordedAt = g_get_monotonic_time();
+		this->recordedPlugin = FlightRecorder::intern(plugin);
+		FlightRecorder::record(FLIGHT_CALLBACK_START, this->recordedPlugin,
+		                       dynamicDetail ? FlightRecorder::hash(detail) :
+		                       FlightRecorder::intern(detail),
+		                       FlightRecorder::intern(callback));
+	}
+
+	if (!this->active)
+	{
+		return;
+	}
+
+	StallWatchdog *watchdog = StallWatchdog::instance;
+	std::string callbackName = detail.empty() ? callback : std::string(callback) + " " + detail;
+	std::lock_guard<std::mutex> lock(watchdog->activityMutex);
+
+	memcpy(this->previousPlugin, watchdog->plugin, sizeof(this->previousPlugin));
+	memcpy(this->previousCallback, watchdog->callback, sizeof(this->previousCallback));
+	copyName(watchdog->plugin, sizeof(watchdog->plugin), plugin);
+	copyName(watchdog->callback, sizeof(watchdog->callback), callbackName);
+}
+
+StallWatchdog::Activity::~Activity()
+{
+	if (this->recordedAt)
+	{
+		FlightRecorder::record(FLIGHT_CALLBACK_END, this->recordedPlugin, FLIGHT_NO_STRING,
+		                       g_get_monotonic_time() - this->recordedAt);
+	}
+
+	// The watchdog outlives the main loop, so it is still there.
+	if (!this->active || !StallWatchdog::instance)
+	{
+		return;
+	}
+
+	StallWatchdog *watchdog = StallWatchdog::instance;
+	std::lock_guard<std::mutex> lock(watchdog->activityMutex);
+
+	memcpy(watchdog->plugin, this->previousPlugin, sizeof(watchdog->plugin));
+	memcpy(watchdog->callback, this->previousCallback, sizeof(watchdog->callback));
+}
+
+StallWatchdog::StallWatchdog():
+	originalPoll(nullptr),
+	thread(nullptr),
+	mainThread(pthread_self()),
+	thresholdUs(0),
+	captureStacks(false),
+	wokeAt(0),
+	stalled(false),
+	plugin(),
+	callback(),
+	stopping(false),
+	pendingWokeAt(0),
+	stallCount(0),
+	totalUs(0),
+	maxUs(0)
+{
+}
+
+StallWatchdog::~StallWatchdog()
+{
+	if (!this->thread)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stopping = true;
+	}
+
+	this->wakeup.notify_all();
+	g_thread_join(this->thread);
+
+	g_main_context_set_poll_func(g_main_context_default(), this->originalPoll);
+	StallWatchdog::instance = nullptr;
+
+	if (this->captureStacks)
+	{
+		(void) signal(STACK_SIGNAL, SIG_DFL);
+	}
+}
+
+bool StallWatchdog::start(unsigned int thresholdMs, bool _captureStacks)
+{
+	if (this->thread || StallWatchdog::instance || thresholdMs == 0)
+	{
+		return false;
+	}
+
+	this->mainThread = pthread_self();
+	this->thresholdUs = static_cast<gint64>(thresholdMs) * 1000;
+	this->captureStacks = _captureStacks;
+
+	if (this->captureStacks)
+	{
+		// First call loads the unwinder, which is not safe in a signal handler.
+		void *frame;
+		(void) backtrace(&frame, 1);
+
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = StallWatchdog::stackSignal;
+		sigemptyset(&action.sa_mask);
+		action.sa_flags = SA_RESTART;
+
+		if (sigaction(STACK_SIGNAL, &action, nullptr) != 0)
+		{
+			LOG_WARNING(MSGID_MAIN_LOOP_STALL, 0, "Failed to set stack capture handler");
+			this->captureStacks = false;
+		}
+	}
+
+	StallWatchdog::instance = this;
+	this->wokeAt = g_get_monotonic_time();
+	this->originalPoll = g_main_context_get_poll_func(g_main_context_default());
+	g_main_context_set_poll_func(g_main_context_default(), StallWatchdog::poll);
+	this->thread = g_thread_new("stall-watchdog", StallWatchdog::run, this);
+
+	LOG_INFO(MSGID_MAIN_LOOP_STALL, 0, "Watching for main loop stalls over %u ms", thresholdMs);
+	return true;
+}
+
+gint StallWatchdog::poll(GPollFD *fds, guint nfds, gint timeout)
+{
+	StallWatchdog *watchdog = StallWatchdog::instance;
+	gint64 woke = watchdog->wokeAt.load();
+
+	watchdog->wokeAt = 0;
+
+	if (watchdog->stalled.load())
+	{
+		watchdog->finishStall(woke, g_get_monotonic_time() - woke);
+	}
+
+	gint result = watchdog->originalPoll(fds, nfds, timeout);
+
+	watchdog->wokeAt = g_get_monotonic_time();
+	return result;
+}
+
+gpointer StallWatchdog::run(gpointer userData)
+{
+	auto watchdog = reinterpret_cast<StallWatchdog *>(userData);
+	auto interval = std::chrono::microseconds(
+	                    std::max(watchdog->thresholdUs / CHECKS_PER_THRESHOLD, MIN_CHECK_INTERVAL_US));
+	std::unique_lock<std::mutex> lock(watchdog->mutex);
+
+	while (!watchdog->stopping)
+	{
+		watchdog->wakeup.wait_for(lock, interval);
+
+		if (!watchdog->stopping)
+		{
+			lock.unlock();
+			watchdog->check();
+			lock.lock();
+		}
+	}
+
+	return nullptr;
+}
+
+void StallWatchdog::stackSignal(int)
+{
+	stackDepth = backtrace(stackFrames, MAX_STACK_FRAMES);
+}
+
+void StallWatchdog::check()
+{
+	gint64 woke = this->wokeAt.load();
+
+	if (woke == 0 || this->stalled.load())
+	{
+		return;
+	}
+
+	gint64 busyUs = g_get_monotonic_time() - woke;
+
+	if (busyUs < this->thresholdUs)
+	{
+		return;
+	}
+
+	StallRecord record;
+
+	{
+		std::lock_guard<std::mutex> lock(this->activityMutex);
+		record.plugin = this->plugin;
+		record.callback = this->callback;
+	}
+
+	record.detectedAt = g_get_real_time();
+	record.durationUs = busyUs;
+
+	if (this->captureStacks)
+	{
+		this->captureStack(record);
+	}
+
+	LOG_WARNING(MSGID_MAIN_LOOP_STALL, 0,
+	            "Main loop stalled for %lld ms, plugin %s, callback %s",
+	            static_cast<long long>(busyUs / 1000),
+	            record.plugin.empty() ? "none" : record.plugin.c_str(),
+	            record.callback.empty() ? "none" : record.callback.c_str());
+
+	for (const std::string &frame : record.stack)
+	{
+		LOG_WARNING(MSGID_MAIN_LOOP_STALL, 0, "  %s", frame.c_str());
+	}
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->pendingWokeAt = woke;
+	this->pending = std::move(record);
+	this->stalled = true;
+}
+
+void StallWatchdog::captureStack(StallRecord &record)
+{
+	stackDepth = -1;
+
+	if (pthread_kill(this->mainThread, STACK_SIGNAL) != 0)
+	{
+		return;
+	}
+
+	gint64 deadline = g_get_monotonic_time() + STACK_WAIT_US;
+
+	while (stackDepth.load() < 0 && g_get_monotonic_time() < deadline)
+	{
+		g_usleep(1000);
+	}
+
+	int depth = stackDepth.load();
+
+	if (depth <= 0)
+	{
+		return;
+	}
+
+	char **symbols = backtrace_symbols(stackFrames, depth);
+
+	if (!symbols)
+	{
+		return;
+	}
+
+	// Skip the signal handler frames.
+	for (int i = 2; i < depth; i++)
+	{
+		record.stack.push_back(symbols[i]);
+	}
+
+	free(symbols);
+}
+
+void StallWatchdog::finishStall(gint64 woke, gint64 busyUs)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	StallRecord &record = this->pending;
+
+	// Otherwise detected just as the stalled iteration ended, keep the
+	// duration the helper thread saw.
+	if (this->pendingWokeAt == woke)
+	{
+		record.durationUs = busyUs;
+	}
+
+	this->stallCount++;
+	this->totalUs += record.durationUs;
+	this->maxUs = std::max(this->maxUs, record.durationUs);
+
+	if (!record.plugin.empty())
+	{
+		this->pluginStalls[record.plugin]++;
+	}
+
+	this->recent.push_back(std::move(record));
+
+	if (this->recent.size() > MAX_RECENT_STALLS)
+	{
+		this->recent.pop_front();
+	}
+
+	this->pending = StallRecord();
+	this->stalled = false;
+}
+
+JValue StallWatchdog::getStats()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	JValue plugins = JObject();
+	JValue stalls = JArray();
+
+	for (const auto &entry : this->pluginStalls)
+	{
+		plugins.put(entry.first, JValue(static_cast<int64_t>(entry.second)));
+	}
+
+	for (const StallRecord &record : this->recent)
+	{
+		JValue stall = JObject{{"callback", record.callback},
+		                       {"durationMs", JValue(static_cast<int64_t>(record.durationUs / 1000))},
+		                       {"detectedAt", JValue(static_cast<int64_t>(record.detectedAt / 1000))}};
+
+		if (!record.plugin.empty())
+		{
+			stall.put("plugin", record.plugin);
+		}
+
+		if (!record.stack.empty())
+		{
+			JValue stack = JArray();
+
+			for (const std::string &frame : record.stack)
+			{
+				stack.append(frame);
+			}
+
+			stall.put("stack", stack);
+		}
+
+		stalls.append(stall);
+	}
+
+	return JObject{{"enabled", this->thread != nullptr},
+	               {"thresholdMs", JValue(static_cast<int64_t>(this->thresholdUs / 1000))},
+	               {"count", JValue(static_cast<int64_t>(this->stallCount))},
+	               {"totalMs", JValue(static_cast<int64_t>(this->totalUs / 1000))},
+	               {"maxMs", JValue(static_cast<int64_t>(this->maxUs / 1000))},
+	               {"plugins", plugins},
+	               {"recent", stalls}};
+}
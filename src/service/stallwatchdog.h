@@ -0,0 +1,137 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glib.h>
+#include <pthread.h>
+#include <pbnjson.hpp>
+
+// Stalls kept for getDiagnostics.
+const unsigned int MAX_RECENT_STALLS = 16;
+
+/**
+ * Detects main loop iterations that take longer than a threshold and
+ * records which plugin callback was running.
+ * The main loop stamps the time it wakes up from poll, a helper thread
+ * checks the stamp. Only one watchdog can run at a time.
+ */
+class StallWatchdog
+{
+public:
+	/**
+	 * Marks the plugin callback running on the main loop, for the life
+	 * of the object. Start and end are also written to the flight
+	 * recorder. Does nothing unless a watchdog or recorder is running.
+	 * @param dynamicDetail - detail is an id that keeps changing, such as
+	 * a timeout id, the flight recorder only keeps its hash.
+	 */
+	class Activity
+	{
+	public:
+		Activity(const std::string &plugin, const char *callback,
+		         const std::string &detail = std::string(),
+		         bool dynamicDetail = false);
+		~Activity();
+
+		Activity(const Activity &) = delete;
+		Activity &operator=(const Activity &) = delete;
+
+	private:
+		gint64 recordedAt; // 0 if not recorded
+		uint32_t recordedPlugin;
+		bool active;
+		char previousPlugin[64];
+		char previousCallback[128];
+	};
+
+	StallWatchdog();
+
+	/**
+	 * Stops the helper thread and restores the main context poll function.
+	 */
+	~StallWatchdog();
+
+	StallWatchdog(const StallWatchdog &) = delete;
+	StallWatchdog &operator=(const StallWatchdog &) = delete;
+
+	/**
+	 * Start watching the default main context. Call from the main thread.
+	 * @param thresholdMs - iterations taking longer are stalls.
+	 * @param captureStacks - log the main thread stack of each stall.
+	 */
+	bool start(unsigned int thresholdMs, bool captureStacks);
+
+	pbnjson::JValue getStats();
+
+private:
+	class StallRecord
+	{
+	public:
+		std::string plugin; // empty if no plugin callback was running
+		std::string callback;
+		gint64 detectedAt; // real time
+		gint64 durationUs;
+		std::vector<std::string> stack;
+	};
+
+	static gint poll(GPollFD *fds, guint nfds, gint timeout);
+	static gpointer run(gpointer userData);
+	static void stackSignal(int signal);
+	void check();
+	void finishStall(gint64 woke, gint64 busyUs);
+	void captureStack(StallRecord &record);
+
+private:
+	static StallWatchdog *instance;
+
+	GPollFunc originalPoll;
+	GThread *thread;
+	pthread_t mainThread;
+	gint64 thresholdUs;
+	bool captureStacks;
+
+	// Written by the main loop.
+	std::atomic<gint64> wokeAt; // 0 while polling
+	std::atomic<bool> stalled;
+
+	// Current plugin callback, see Activity.
+	std::mutex activityMutex;
+	char plugin[64];
+	char callback[128];
+
+	// Helper thread state.
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	bool stopping;
+	gint64 pendingWokeAt;
+	StallRecord pending;
+
+	// Statistics, under mutex.
+	unsigned int stallCount;
+	gint64 totalUs;
+	gint64 maxUs;
+	std::unordered_map<std::string, unsigned int> pluginStalls;
+	std::deque<StallRecord> recent;
+};
@@ -0,0 +1,297 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+
+#include "startupscheduler.h"
+#include "logging.h"
+
+using namespace pbnjson;
+
+static const unsigned int PROBE_INTERVAL_MS = 10;
+// Upper bounds of latency histogram buckets, last bucket is everything above.
+static const gint64 LATENCY_BUCKETS_US[] = {1000, 5000, 20000, 50000};
+static const char *LATENCY_BUCKET_NAMES[] = {"<1ms", "<5ms", "<20ms", "<50ms", ">=50ms"};
+
+StartupScheduler::StartupScheduler(StartCallback _start):
+	start(_start),
+	budgetMs(0),
+	slotSource(0),
+	probeSource(0),
+	probeExpectedAt(0),
+	slots(0),
+	startedNow(0),
+	startedDeferred(0),
+	longestSlotUs(0),
+	latencySamples(0),
+	latencyTotalUs(0),
+	latencyMaxUs(0),
+	latencyBuckets{0, 0, 0, 0, 0}
+{
+}
+
+StartupScheduler::~StartupScheduler()
+{
+	this->clear();
+}
+
+void StartupScheduler::setSlotBudget(unsigned int _budgetMs)
+{
+	this->budgetMs = _budgetMs;
+}
+
+void StartupScheduler::schedule(size_t pluginIndex, BootClass bootClass)
+{
+	if (bootClass == BOOT_CRITICAL || this->budgetMs == 0)
+	{
+		this->startedNow += 1;
+		this->start(pluginIndex);
+		return;
+	}
+
+	(void) this->dequeue(pluginIndex);
+	this->queues[bootClass].push_back(pluginIndex);
+
+	if (this->slotSource == 0 && this->opening.empty())
+	{
+		this->slotSource = g_idle_add(StartupScheduler::slotCallback, this);
+	}
+
+	if (this->probeSource == 0)
+	{
+		this->probeExpectedAt = g_get_monotonic_time() + PROBE_INTERVAL_MS * 1000;
+		this->probeSource = g_timeout_add(PROBE_INTERVAL_MS,
+		                                  StartupScheduler::probeCallback, this);
+	}
+}
+
+void StartupScheduler::opened(size_t pluginIndex)
+{
+	if (this->opening.erase(pluginIndex) > 0)
+	{
+		this->resume();
+	}
+}
+
+bool StartupScheduler::cancel(size_t pluginIndex)
+{
+	bool queued = this->dequeue(pluginIndex);
+
+	if (this->opening.erase(pluginIndex) > 0)
+	{
+		this->resume();
+	}
+
+	return queued;
+}
+
+bool StartupScheduler::dequeue(size_t pluginIndex)
+{
+	for (auto &queue : this->queues)
+	{
+		auto iter = std::find(queue.begin(), queue.end(), pluginIndex);
+
+		if (iter != queue.end())
+		{
+			queue.erase(iter);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Start the next slot once no plugin is being opened any more.
+ */
+void StartupScheduler::resume()
+{
+	if (this->slotSource != 0 || !this->opening.empty())
+	{
+		return;
+	}
+
+	for (const auto &queue : this->queues)
+	{
+		if (!queue.empty())
+		{
+			this->slotSource = g_idle_add(StartupScheduler::slotCallback, this);
+			return;
+		}
+	}
+
+	LOG_INFO(MSGID_STARTUP_TIMELINE, 0,
+	         "Deferred plugins started in %llu slots, longest slot %lld us, max main loop latency %lld us",
+	         this->slots, static_cast<long long>(this->longestSlotUs),
+	         static_cast<long long>(this->latencyMaxUs));
+}
+
+void StartupScheduler::clear()
+{
+	for (auto &queue : this->queues)
+	{
+		queue.clear();
+	}
+
+	this->opening.clear();
+
+	if (this->slotSource != 0)
+	{
+		g_source_remove(this->slotSource);
+		this->slotSource = 0;
+	}
+
+	if (this->probeSource != 0)
+	{
+		g_source_remove(this->probeSource);
+		this->probeSource = 0;
+	}
+}
+
+gboolean StartupScheduler::slotCallback(gpointer userData)
+{
+	auto scheduler = reinterpret_cast<StartupScheduler *>(userData);
+	scheduler->runSlot();
+
+	if (scheduler->opening.empty())
+	{
+		for (const auto &queue : scheduler->queues)
+		{
+			if (!queue.empty())
+			{
+				return G_SOURCE_CONTINUE;
+			}
+		}
+	}
+
+	// Otherwise opened() starts the next slot.
+	scheduler->slotSource = 0;
+	scheduler->resume();
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * Start queued plugins by boot class until the budget is used up or a
+ * plugin library is being opened. At least one plugin is started per slot.
+ */
+void StartupScheduler::runSlot()
+{
+	gint64 slotStart = g_get_monotonic_time();
+	gint64 budgetUs = static_cast<gint64>(this->budgetMs) * 1000;
+
+	this->slots += 1;
+
+	for (auto &queue : this->queues)
+	{
+		while (!queue.empty())
+		{
+			size_t pluginIndex = queue.front();
+			queue.pop_front();
+
+			this->startedDeferred += 1;
+
+			if (this->start(pluginIndex))
+			{
+				// Instantiated from the main loop when the open is done.
+				this->opening.insert(pluginIndex);
+			}
+
+			if (!this->opening.empty() || g_get_monotonic_time() - slotStart >= budgetUs)
+			{
+				this->longestSlotUs = std::max(this->longestSlotUs,
+				                               g_get_monotonic_time() - slotStart);
+				return;
+			}
+		}
+	}
+
+	this->longestSlotUs = std::max(this->longestSlotUs,
+	                               g_get_monotonic_time() - slotStart);
+}
+
+gboolean StartupScheduler::probeCallback(gpointer userData)
+{
+	auto scheduler = reinterpret_cast<StartupScheduler *>(userData);
+	scheduler->sampleLatency();
+
+	// One more sample after the last slot and open, then stop.
+	if (scheduler->slotSource == 0 && scheduler->opening.empty())
+	{
+		scheduler->probeSource = 0;
+		return G_SOURCE_REMOVE;
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Latency is how late the probe timer fired, the time the main loop
+ * was busy with other sources.
+ */
+void StartupScheduler::sampleLatency()
+{
+	gint64 now = g_get_monotonic_time();
+	gint64 latency = std::max<gint64>(now - this->probeExpectedAt, 0);
+	size_t bucket = 0;
+
+	while (bucket < G_N_ELEMENTS(LATENCY_BUCKETS_US) && latency >= LATENCY_BUCKETS_US[bucket])
+	{
+		bucket++;
+	}
+
+	this->latencySamples += 1;
+	this->latencyTotalUs += latency;
+	this->latencyMaxUs = std::max(this->latencyMaxUs, latency);
+	this->latencyBuckets[bucket] += 1;
+
+	// Timeout is rearmed from the time of dispatch.
+	this->probeExpectedAt = now + PROBE_INTERVAL_MS * 1000;
+}
+
+JValue StartupScheduler::getStats()
+{
+	size_t queued = 0;
+
+	for (const auto &queue : this->queues)
+	{
+		queued += queue.size();
+	}
+
+	JValue histogram = JObject();
+
+	for (size_t i = 0; i < G_N_ELEMENTS(LATENCY_BUCKET_NAMES); i++)
+	{
+		histogram.put(LATENCY_BUCKET_NAMES[i],
+		              JValue(static_cast<int64_t>(this->latencyBuckets[i])));
+	}
+
+	gint64 average = this->latencySamples ?
+	                 this->latencyTotalUs / static_cast<gint64>(this->latencySamples) : 0;
+
+	return JObject{
+		{"slotBudgetMs", JValue(static_cast<int64_t>(this->budgetMs))},
+		{"queued", JValue(static_cast<int64_t>(queued))},
+		{"opening", JValue(static_cast<int64_t>(this->opening.size()))},
+		{"startedImmediately", JValue(static_cast<int64_t>(this->startedNow))},
+		{"startedDeferred", JValue(static_cast<int64_t>(this->startedDeferred))},
+		{"slots", JValue(static_cast<int64_t>(this->slots))},
+		{"longestSlotUs", JValue(static_cast<int64_t>(this->longestSlotUs))},
+		{"mainLoopLatency", JObject{
+			{"samples", JValue(static_cast<int64_t>(this->latencySamples))},
+			{"averageUs", JValue(static_cast<int64_t>(average))},
+			{"maxUs", JValue(static_cast<int64_t>(this->latencyMaxUs))},
+			{"histogram", histogram}}}};
+}
@@ -0,0 +1,104 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <set>
+#include <glib.h>
+#include <pbnjson.hpp>
+
+#include "plugininfo.h"
+
+/**
+ * Spreads plugin startup over idle main loop iterations.
+ * Critical plugins are started right away, the rest are started by boot
+ * class from idle callbacks, each limited to a time budget, so that luna
+ * traffic and timers are not held back by a burst of startMonitoring calls.
+ * A plugin whose library is opened on a worker thread is instantiated when
+ * the open is handed back, no further plugin is started until then.
+ * While plugins are queued or opening, main loop latency is sampled with
+ * a timer.
+ */
+class StartupScheduler
+{
+public:
+	/**
+	 * @return true if the plugin library is still being opened,
+	 *         opened() is called once it was handed back.
+	 */
+	typedef std::function<bool(size_t pluginIndex)> StartCallback;
+
+	StartupScheduler(StartCallback start);
+	~StartupScheduler();
+
+	StartupScheduler(const StartupScheduler &) = delete;
+	StartupScheduler &operator=(const StartupScheduler &) = delete;
+
+	/**
+	 * @param budgetMs - time to spend starting plugins per idle callback,
+	 *                   0 to start all plugins right away.
+	 */
+	void setSlotBudget(unsigned int budgetMs);
+
+	void schedule(size_t pluginIndex, BootClass bootClass);
+
+	/**
+	 * Plugin library opened on a worker thread was handed back to the
+	 * main loop and the plugin instantiated, or not.
+	 */
+	void opened(size_t pluginIndex);
+
+	/**
+	 * Remove plugin from the queue, stop waiting for it to be opened.
+	 * @return true if the plugin was queued.
+	 */
+	bool cancel(size_t pluginIndex);
+
+	void clear();
+
+	pbnjson::JValue getStats();
+
+private:
+	bool dequeue(size_t pluginIndex);
+	void resume();
+	void runSlot();
+	void sampleLatency();
+	static gboolean slotCallback(gpointer userData);
+	static gboolean probeCallback(gpointer userData);
+
+private:
+	StartCallback start;
+	unsigned int budgetMs;
+	std::deque<size_t> queues[BOOT_CLASS_COUNT];
+	// Started plugins waiting for their library to be opened.
+	std::set<size_t> opening;
+	guint slotSource;
+	guint probeSource;
+	gint64 probeExpectedAt;
+
+	unsigned long long slots;
+	unsigned long long startedNow;
+	unsigned long long startedDeferred;
+	gint64 longestSlotUs;
+
+	// Main loop latency while plugins are queued or opening, us.
+	unsigned long long latencySamples;
+	gint64 latencyTotalUs;
+	gint64 latencyMaxUs;
+	unsigned long long latencyBuckets[5];
+};
@@ -0,0 +1,185 @@
+// Copyright (c) 2015-2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <glib.h>
+
+#include "statussnapshot.h"
+#include "logging.h"
+
+using namespace pbnjson;
+
+static const uint32_t SNAPSHOT_MAGIC = 0x454d5353; // "EMSS"
+static const uint32_t SNAPSHOT_VERSION = 1;
+static const size_t SLOT_SIZE = 32 * 1024;
+
+struct SnapshotSlot
+{
+	uint32_t generation; // 0 = empty
+	uint32_t length;
+	uint32_t checksum;
+	char data[SLOT_SIZE];
+};
+
+struct SnapshotFile
+{
+	uint32_t magic;
+	uint32_t version;
+	SnapshotSlot slots[2];
+};
+
+static uint32_t checksum(const char *data, size_t length)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		hash ^= static_cast<unsigned char>(data[i]);
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static bool isSlotValid(const SnapshotSlot &slot)
+{
+	return slot.generation != 0 && slot.length <= SLOT_SIZE &&
+	       slot.checksum == checksum(slot.data, slot.length);
+}
+
+StatusSnapshot::StatusSnapshot(const std::string &_path):
+	path(_path),
+	mapping(nullptr)
+{
+	gchar *dir = g_path_get_dirname(this->path.c_str());
+	g_mkdir_with_parents(dir, 0755);
+	g_free(dir);
+
+	int fd = open(this->path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+	if (fd < 0)
+	{
+		LOG_WARNING(MSGID_STATUS_SNAPSHOT, 0, "Failed to open snapshot %s",
+		            this->path.c_str());
+		return;
+	}
+
+	if (ftruncate(fd, sizeof(SnapshotFile)) != 0)
+	{
+		LOG_WARNING(MSGID_STATUS_SNAPSHOT, 0, "Failed to resize snapshot %s",
+		            this->path.c_str());
+		close(fd);
+		return;
+	}
+
+	void *address = mmap(nullptr, sizeof(SnapshotFile), PROT_READ | PROT_WRITE,
+	                     MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (address == MAP_FAILED)
+	{
+		LOG_WARNING(MSGID_STATUS_SNAPSHOT, 0, "Failed to map snapshot %s",
+		            this->path.c_str());
+		return;
+	}
+
+	this->mapping = address;
+	auto file = reinterpret_cast<SnapshotFile *>(this->mapping);
+
+	if (file->magic != SNAPSHOT_MAGIC || file->version != SNAPSHOT_VERSION)
+	{
+		// New or incompatible file
+		memset(file, 0, sizeof(SnapshotFile));
+		file->magic = SNAPSHOT_MAGIC;
+		file->version = SNAPSHOT_VERSION;
+	}
+}
+
+StatusSnapshot::~StatusSnapshot()
+{
+	if (this->mapping)
+	{
+		munmap(this->mapping, sizeof(SnapshotFile));
+	}
+}
+
+JValue StatusSnapshot::read()
+{
+	if (!this->mapping)
+	{
+		return JValue();
+	}
+
+	auto file = reinterpret_cast<SnapshotFile *>(this->mapping);
+	const SnapshotSlot *latest = nullptr;
+
+	for (const SnapshotSlot &slot : file->slots)
+	{
+		if (isSlotValid(slot) && (!latest || slot.generation > latest->generation))
+		{
+			latest = &slot;
+		}
+	}
+
+	if (!latest)
+	{
+		return JValue();
+	}
+
+	JValue snapshot = JDomParser::fromString(std::string(latest->data, latest->length),
+	                  JSchema::AllSchema());
+
+	if (!snapshot.isObject() || !snapshot["locale"].isObject() ||
+	        !snapshot["services"].isObject())
+	{
+		return JValue();
+	}
+
+	return snapshot;
+}
+
+void StatusSnapshot::write(const JValue &snapshot)
+{
+	if (!this->mapping)
+	{
+		return;
+	}
+
+	std::string data = snapshot.stringify("");
+
+	if (data.length() > SLOT_SIZE)
+	{
+		LOG_WARNING(MSGID_STATUS_SNAPSHOT, 0, "Snapshot too large: %zu bytes",
+		            data.length());
+		return;
+	}
+
+	auto file = reinterpret_cast<SnapshotFile *>(this->mapping);
+	SnapshotSlot &current = file->slots[0].generation >= file->slots[1].generation ?
+	                        file->slots[0] : file->slots[1];
+	SnapshotSlot &next = &current == &file->slots[0] ? file->slots[1] : file->slots[0];
+
+	// Invalidate the slot first, then publish it with the new generation.
+	next.generation = 0;
+	memcpy(next.data, data.c_str(), data.length());
+	next.length = static_cast<uint32_t>(data.length());
+	next.checksum = checksum(next.data, next.length);
+	__sync_synchronize();
+	next.generation = current.generation + 1;
+}
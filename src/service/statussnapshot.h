@@ -0,0 +1,50 @@
+// Copyright (c) 2015-2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <string>
+#include <pbnjson.hpp>
+
+/**
+ * Last known locale and service status, kept in a memory mapped file
+ * so that a respawned service can start plugins without waiting for
+ * the bus replies.
+ * The file has two slots, written alternately, so a crash while writing
+ * leaves the previous snapshot intact.
+ */
+class StatusSnapshot
+{
+public:
+	StatusSnapshot(const std::string &path);
+	~StatusSnapshot();
+
+	StatusSnapshot(const StatusSnapshot &) = delete;
+	StatusSnapshot &operator=(const StatusSnapshot &) = delete;
+
+	/**
+	 * Read the last written snapshot.
+	 * @returns - null JValue if there is no valid snapshot.
+	 *            Otherwise {"locale": {...}, "services": {"name": true}}
+	 */
+	pbnjson::JValue read();
+
+	void write(const pbnjson::JValue &snapshot);
+
+private:
+	const std::string path;
+	void *mapping;
+};
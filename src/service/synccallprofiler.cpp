@@ -0,0 +1,146 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+#include <vector>
+
+#include "synccallprofiler.h"
+#include "logging.h"
+
+using namespace pbnjson;
+
+void SyncCallProfiler::CallStats::add(gint64 blockedUs, bool timedOut, bool over)
+{
+	this->count++;
+	this->totalUs += blockedUs;
+	this->maxUs = std::max(this->maxUs, blockedUs);
+
+	if (timedOut)
+	{
+		this->timeouts++;
+	}
+
+	if (over)
+	{
+		this->overBudget++;
+	}
+}
+
+JValue SyncCallProfiler::CallStats::toJson() const
+{
+	return JObject{{"count", JValue(static_cast<int64_t>(this->count))},
+	               {"timeouts", JValue(static_cast<int64_t>(this->timeouts))},
+	               {"overBudget", JValue(static_cast<int64_t>(this->overBudget))},
+	               {"blockedMs", JValue(static_cast<int64_t>(this->totalUs / 1000))},
+	               {"maxMs", JValue(static_cast<int64_t>(this->maxUs / 1000))}};
+}
+
+void SyncCallProfiler::setBudget(unsigned int budgetMs, bool _reject)
+{
+	this->budgetUs = static_cast<gint64>(budgetMs) * 1000;
+	this->reject = _reject && budgetMs > 0;
+}
+
+unsigned long SyncCallProfiler::limitTimeout(unsigned long timeoutMs)
+{
+	if (!this->reject)
+	{
+		return timeoutMs;
+	}
+
+	return std::min(timeoutMs, static_cast<unsigned long>(this->budgetUs / 1000));
+}
+
+void SyncCallProfiler::record(const std::string &caller, const std::string &serviceUrl,
+                              gint64 blockedUs, bool timedOut)
+{
+	bool over = this->budgetUs > 0 && blockedUs > this->budgetUs;
+
+	this->calls[caller][serviceUrl].add(blockedUs, timedOut, over);
+
+	if (over)
+	{
+		LOG_WARNING(MSGID_LS2_SYNC_CALL, 0,
+		            "Synchronous call %s from %s blocked %lld ms, budget %lld ms%s",
+		            serviceUrl.c_str(),
+		            caller.empty() ? "event monitor" : caller.c_str(),
+		            static_cast<long long>(blockedUs / 1000),
+		            static_cast<long long>(this->budgetUs / 1000),
+		            this->reject ? ", rejected" : "");
+	}
+}
+
+JValue SyncCallProfiler::getReport(unsigned int limit)
+{
+	struct Ranked
+	{
+		const std::string *caller;
+		const std::string *serviceUrl; // null for caller totals
+		CallStats stats;
+	};
+
+	std::vector<Ranked> callers;
+	std::vector<Ranked> targets;
+
+	for (const auto &caller : this->calls)
+	{
+		CallStats total;
+
+		for (const auto &target : caller.second)
+		{
+			const CallStats &stats = target.second;
+			total.count += stats.count;
+			total.timeouts += stats.timeouts;
+			total.overBudget += stats.overBudget;
+			total.totalUs += stats.totalUs;
+			total.maxUs = std::max(total.maxUs, stats.maxUs);
+			targets.push_back(Ranked{&caller.first, &target.first, stats});
+		}
+
+		callers.push_back(Ranked{&caller.first, nullptr, total});
+	}
+
+	auto worstFirst = [](const Ranked &a, const Ranked &b)
+	{
+		return a.stats.totalUs > b.stats.totalUs;
+	};
+
+	std::sort(callers.begin(), callers.end(), worstFirst);
+	std::sort(targets.begin(), targets.end(), worstFirst);
+
+	JValue callerList = JArray();
+	JValue targetList = JArray();
+
+	for (const Ranked &caller : callers)
+	{
+		JValue entry = caller.stats.toJson();
+		entry.put("caller", *caller.caller);
+		callerList.append(entry);
+	}
+
+	for (size_t i = 0; i < targets.size() && i < limit; i++)
+	{
+		JValue entry = targets[i].stats.toJson();
+		entry.put("caller", *targets[i].caller);
+		entry.put("serviceUrl", *targets[i].serviceUrl);
+		targetList.append(entry);
+	}
+
+	return JObject{{"budgetMs", JValue(static_cast<int64_t>(this->budgetUs / 1000))},
+	               {"reject", this->reject},
+	               {"callers", callerList},
+	               {"calls", targetList}};
+}
@@ -0,0 +1,87 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <glib.h>
+#include <pbnjson.hpp>
+
+/**
+ * Time the main loop spent blocked in synchronous luna calls, by caller
+ * and target, see LunaService::call. Main thread only.
+ */
+class SyncCallProfiler
+{
+public:
+	SyncCallProfiler():
+		budgetUs(0),
+		reject(false)
+	{};
+
+	/**
+	 * Calls blocking longer than the budget are logged. With reject the
+	 * call timeout is cut to the budget, so slower calls fail.
+	 * @param budgetMs - 0 for no budget.
+	 */
+	void setBudget(unsigned int budgetMs, bool reject);
+
+	/**
+	 * Timeout to use for a call, shortened to the budget when rejecting.
+	 */
+	unsigned long limitTimeout(unsigned long timeoutMs);
+
+	/**
+	 * @param caller - plugin name, empty for the event monitor itself.
+	 */
+	void record(const std::string &caller, const std::string &serviceUrl,
+	            gint64 blockedUs, bool timedOut);
+
+	/**
+	 * Callers and call targets ranked by the time they blocked, worst first.
+	 * @param limit - maximum number of call targets listed.
+	 */
+	pbnjson::JValue getReport(unsigned int limit);
+
+private:
+	class CallStats
+	{
+	public:
+		CallStats():
+			count(0),
+			timeouts(0),
+			overBudget(0),
+			totalUs(0),
+			maxUs(0)
+		{};
+
+		void add(gint64 blockedUs, bool timedOut, bool over);
+		pbnjson::JValue toJson() const;
+
+		unsigned int count;
+		unsigned int timeouts;
+		unsigned int overBudget;
+		gint64 totalUs;
+		gint64 maxUs;
+	};
+
+	gint64 budgetUs;
+	bool reject;
+
+	// Map caller to service url to stats.
+	std::unordered_map<std::string, std::unordered_map<std::string, CallStats>> calls;
+};
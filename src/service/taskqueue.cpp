@@ -0,0 +1,149 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "taskqueue.h"
+#include "logging.h"
+#include "utils.h"
+
+TaskQueue::TaskQueue(GMainContext *context):
+	head(&stub),
+	tail(&stub),
+	eventFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+	source(nullptr)
+{
+	this->stub.next.store(nullptr, std::memory_order_relaxed);
+
+	if (this->eventFd < 0)
+	{
+		LOG_CRITICAL(MSGID_ERROR_INTERNAL, 0, "Failed to create task queue eventfd");
+		return;
+	}
+
+	GIOChannel *channel = g_io_channel_unix_new(this->eventFd);
+	g_io_channel_set_encoding(channel, NULL, NULL);
+	g_io_channel_set_buffered(channel, FALSE);
+
+	this->source = g_io_create_watch(channel, G_IO_IN);
+	g_source_set_callback(this->source, reinterpret_cast<GSourceFunc>(TaskQueue::dispatch),
+	                      this, nullptr);
+	(void) g_source_attach(this->source, context);
+	g_io_channel_unref(channel);
+}
+
+TaskQueue::~TaskQueue()
+{
+	if (this->source)
+	{
+		g_source_destroy(this->source);
+		g_source_unref(this->source);
+	}
+
+	// Tasks that never ran.
+	while (Node *node = this->pop())
+	{
+		delete node;
+	}
+
+	if (this->eventFd >= 0)
+	{
+		close(this->eventFd);
+	}
+}
+
+void TaskQueue::post(Task task)
+{
+	Node *node = new Node();
+	node->task = std::move(task);
+	this->push(node);
+
+	uint64_t one = 1;
+	(void) write(this->eventFd, &one, sizeof(one));
+}
+
+void TaskQueue::runPending()
+{
+	uint64_t count;
+	(void) read(this->eventFd, &count, sizeof(count));
+
+	while (Node *node = this->pop())
+	{
+		Task task = std::move(node->task);
+		delete node;
+		task();
+	}
+}
+
+gboolean TaskQueue::dispatch(GIOChannel *channel UNUSED_VAR,
+                             GIOCondition condition UNUSED_VAR,
+                             gpointer userData)
+{
+	reinterpret_cast<TaskQueue *>(userData)->runPending();
+	return G_SOURCE_CONTINUE;
+}
+
+void TaskQueue::push(Node *node)
+{
+	node->next.store(nullptr, std::memory_order_relaxed);
+	Node *previous = this->head.exchange(node, std::memory_order_acq_rel);
+	previous->next.store(node, std::memory_order_release);
+}
+
+/**
+ * Vyukov's intrusive MPSC queue. Returns nullptr if empty, or if a producer
+ * is between exchanging head and linking its node, it signals afterwards.
+ */
+TaskQueue::Node *TaskQueue::pop()
+{
+	Node *first = this->tail;
+	Node *next = first->next.load(std::memory_order_acquire);
+
+	if (first == &this->stub)
+	{
+		if (!next)
+		{
+			return nullptr;
+		}
+
+		this->tail = next;
+		first = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+
+	if (next)
+	{
+		this->tail = next;
+		return first;
+	}
+
+	if (first != this->head.load(std::memory_order_acquire))
+	{
+		return nullptr;
+	}
+
+	this->push(&this->stub);
+	next = first->next.load(std::memory_order_acquire);
+
+	if (next)
+	{
+		this->tail = next;
+		return first;
+	}
+
+	return nullptr;
+}
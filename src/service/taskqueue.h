@@ -0,0 +1,76 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <glib.h>
+
+/**
+ * Tasks posted from any thread and run on one GMainContext.
+ * Lock-free multi-producer single-consumer linked list, the consumer is
+ * woken up through an eventfd watched by a source on the context.
+ */
+class TaskQueue
+{
+public:
+	typedef std::function<void()> Task;
+
+	TaskQueue(GMainContext *context);
+	~TaskQueue();
+
+	TaskQueue(const TaskQueue &) = delete;
+	TaskQueue &operator=(const TaskQueue &) = delete;
+
+	/**
+	 * Thread safe.
+	 */
+	void post(Task task);
+
+	/**
+	 * Run tasks posted so far. Only from the thread that owns the context,
+	 * normally called by the queue's source.
+	 */
+	void runPending();
+
+	/**
+	 * Readable while tasks are pending, to wait outside of the main loop.
+	 */
+	int getFd() const
+	{
+		return this->eventFd;
+	}
+
+private:
+	struct Node
+	{
+		std::atomic<Node *> next;
+		Task task;
+	};
+
+	void push(Node *node);
+	Node *pop();
+	static gboolean dispatch(GIOChannel *channel, GIOCondition condition,
+	                         gpointer userData);
+
+private:
+	std::atomic<Node *> head; // producers
+	Node *tail; // consumer
+	Node stub;
+	int eventFd;
+	GSource *source;
+};
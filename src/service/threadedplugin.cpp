@@ -0,0 +1,642 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <exception>
+#include <future>
+
+#include "threadedplugin.h"
+#include "pluginadapter.h"
+#include "pluginmanager.h"
+#include "eventlatency.h"
+#include "logging.h"
+
+using namespace pbnjson;
+
+ThreadedPlugin::ThreadedPlugin(PluginAdapter *_adapter, PluginThread *_thread):
+	adapter(_adapter),
+	thread(_thread),
+	plugin(nullptr),
+	alive(std::make_shared<std::atomic<bool>>(true)),
+	unloadSource(0)
+{
+}
+
+ThreadedPlugin::~ThreadedPlugin()
+{
+	this->alive->store(false);
+
+	if (this->unloadSource)
+	{
+		g_source_remove(this->unloadSource);
+		this->unloadSource = 0;
+	}
+
+	// Let a callback the plugin is running now finish, its calls to the
+	// Manager fail from here on.
+	this->thread->call([]()
+	{
+	});
+
+	delete this->plugin;
+
+	// Drop what the plugin's own threads posted until they were joined,
+	// while the plugin library is still loaded.
+	this->thread->call([]()
+	{
+	});
+}
+
+void ThreadedPlugin::setPlugin(Plugin *_plugin)
+{
+	this->plugin = _plugin;
+}
+
+void ThreadedPlugin::startMonitoring()
+{
+	this->postToThread("startMonitoring", [this]()
+	{
+		this->plugin->startMonitoring();
+	});
+}
+
+UnloadResult ThreadedPlugin::stopMonitoring(const std::string &service)
+{
+	UnloadResult result = UNLOAD_OK;
+
+	this->callOnThread([this, &service, &result]()
+	{
+		result = this->plugin->stopMonitoring(service);
+	});
+
+	return result;
+}
+
+void ThreadedPlugin::uiLocaleChanged(const std::string &uiLocale)
+{
+	this->postToThread("uiLocaleChanged", [this, uiLocale]()
+	{
+		this->plugin->uiLocaleChanged(uiLocale);
+	});
+}
+
+void ThreadedPlugin::servicePaused(const std::string &service)
+{
+	this->postToThread("servicePaused", [this, service]()
+	{
+		this->plugin->servicePaused(service);
+	});
+}
+
+void ThreadedPlugin::serviceResumed(const std::string &service)
+{
+	this->postToThread("serviceResumed", [this, service]()
+	{
+		this->plugin->serviceResumed(service);
+	});
+}
+
+void ThreadedPlugin::trimMemory()
+{
+	this->postToThread("trimMemory", [this]()
+	{
+		this->plugin->trimMemory();
+	});
+}
+
+void ThreadedPlugin::setupLogging(PmLogContext *context)
+{
+	this->adapter->setupLogging(context);
+}
+
+void ThreadedPlugin::unloadPlugin()
+{
+	this->callOnMain([this]()
+	{
+		this->adapter->unloadPlugin();
+	});
+}
+
+const std::string ThreadedPlugin::getUILocale()
+{
+	std::string locale;
+
+	this->callOnMain([this, &locale]()
+	{
+		locale = this->adapter->getUILocale();
+	});
+
+	return locale;
+}
+
+const JValue &ThreadedPlugin::getLocaleInfo()
+{
+	this->callOnMain([this]()
+	{
+		this->localeInfo = this->adapter->getLocaleInfo().duplicate();
+	});
+
+	return this->localeInfo;
+}
+
+JValue ThreadedPlugin::lunaCall(const std::string &serviceUrl,
+                                JValue &params,
+                                unsigned long timeout)
+{
+	JValue result;
+
+	this->callOnMain([this, &serviceUrl, &params, timeout, &result]()
+	{
+		JValue mainParams = params.duplicate();
+		result = this->adapter->lunaCall(serviceUrl, mainParams, timeout).duplicate();
+	});
+
+	return result;
+}
+
+void ThreadedPlugin::lunaCallAsync(const std::string &serviceUrl,
+                                   JValue &params,
+                                   LunaCallback callback)
+{
+	this->callOnMain([this, &serviceUrl, &params, &callback]()
+	{
+		JValue mainParams = params.duplicate();
+		this->adapter->lunaCallAsync(serviceUrl, mainParams,
+		                             callback ? this->wrapCall(callback) : nullptr);
+	});
+}
+
+void ThreadedPlugin::subscribeToMethod(const std::string &subscriptionId,
+                                       const std::string &methodPath,
+                                       JValue &params,
+                                       SubscribeCallback callback,
+                                       const JSchema &schema)
+{
+	this->callOnMain([&]()
+	{
+		JValue mainParams = params.duplicate();
+		this->adapter->subscribeToMethod(subscriptionId, methodPath, mainParams,
+		                                 this->wrapSubscribe(callback), schema);
+	});
+}
+
+bool ThreadedPlugin::unsubscribeFromMethod(const std::string &subscriptionId)
+{
+	bool result = false;
+
+	this->callOnMain([this, &subscriptionId, &result]()
+	{
+		result = this->adapter->unsubscribeFromMethod(subscriptionId);
+	});
+
+	return result;
+}
+
+void ThreadedPlugin::subscribeToSignal(const std::string &subscriptionId,
+                                       const std::string &category,
+                                       const std::string &method,
+                                       SubscribeCallback callback,
+                                       const JSchema &schema)
+{
+	this->callOnMain([&]()
+	{
+		this->adapter->subscribeToSignal(subscriptionId, category, method,
+		                                 this->wrapSubscribe(callback), schema);
+	});
+}
+
+bool ThreadedPlugin::unsubscribeFromSignal(const std::string &subscriptionId)
+{
+	bool result = false;
+
+	this->callOnMain([this, &subscriptionId, &result]()
+	{
+		result = this->adapter->unsubscribeFromSignal(subscriptionId);
+	});
+
+	return result;
+}
+
+void ThreadedPlugin::setTimeout(const std::string &timeoutId,
+                                unsigned int timeMs,
+                                bool repeat,
+                                TimeoutCallback callback)
+{
+	this->callOnMain([&]()
+	{
+		this->adapter->setTimeout(timeoutId, timeMs, repeat, this->wrapTimeout(callback));
+	});
+}
+
+bool ThreadedPlugin::cancelTimeout(const std::string &timeoutId)
+{
+	bool result = false;
+
+	this->callOnMain([this, &timeoutId, &result]()
+	{
+		result = this->adapter->cancelTimeout(timeoutId);
+	});
+
+	return result;
+}
+
+void ThreadedPlugin::debounce(const std::string &debounceId,
+                              unsigned int delayMs,
+                              TimeoutCallback callback)
+{
+	this->callOnMain([&]()
+	{
+		this->adapter->debounce(debounceId, delayMs, this->wrapTimeout(callback));
+	});
+}
+
+bool ThreadedPlugin::cancelDebounce(const std::string &debounceId)
+{
+	bool result = false;
+
+	this->callOnMain([this, &debounceId, &result]()
+	{
+		result = this->adapter->cancelDebounce(debounceId);
+	});
+
+	return result;
+}
+
+void ThreadedPlugin::throttle(const std::string &throttleId,
+                              unsigned int intervalMs,
+                              TimeoutCallback callback)
+{
+	this->callOnMain([&]()
+	{
+		this->adapter->throttle(throttleId, intervalMs, this->wrapTimeout(callback));
+	});
+}
+
+bool ThreadedPlugin::cancelThrottle(const std::string &throttleId)
+{
+	bool result = false;
+
+	this->callOnMain([this, &throttleId, &result]()
+	{
+		result = this->adapter->cancelThrottle(throttleId);
+	});
+
+	return result;
+}
+
+void ThreadedPlugin::startPolling(const std::string &pollId,
+                                  const std::string &serviceUrl,
+                                  JValue &params,
+                                  unsigned int minIntervalMs,
+                                  unsigned int maxIntervalMs,
+                                  SubscribeCallback callback)
+{
+	this->callOnMain([&]()
+	{
+		JValue mainParams = params.duplicate();
+		this->adapter->startPolling(pollId, serviceUrl, mainParams,
+		                            minIntervalMs, maxIntervalMs,
+		                            this->wrapSubscribe(callback));
+	});
+}
+
+bool ThreadedPlugin::stopPolling(const std::string &pollId)
+{
+	bool result = false;
+
+	this->callOnMain([this, &pollId, &result]()
+	{
+		result = this->adapter->stopPolling(pollId);
+	});
+
+	return result;
+}
+
+bool ThreadedPlugin::runInBackground(BackgroundTask task, BackgroundCallback completion)
+{
+	bool queued = false;
+
+	this->callOnMain([&]()
+	{
+		BackgroundCallback threadCompletion;
+
+		if (completion)
+		{
+			threadCompletion = [this, completion]()
+			{
+				this->postToThread("background completion", completion);
+			};
+		}
+
+		queued = this->adapter->runInBackground(task, threadCompletion);
+	});
+
+	return queued;
+}
+
+void ThreadedPlugin::post(PostCallback callback)
+{
+	// The adapter outlives this object and the tasks that get to run.
+	PostStats *stats = &this->adapter->getPostStats();
+	std::shared_ptr<std::atomic<bool>> pluginAlive = this->alive;
+
+	// Stopping, not queued, so not counted.
+	if (!*pluginAlive)
+	{
+		return;
+	}
+
+	gint64 postedAt = stats->notePosted();
+
+	this->postToThread("posted function", [stats, callback, postedAt]()
+	{
+		stats->noteRun(postedAt);
+		callback();
+	}, [stats]()
+	{
+		stats->noteDropped();
+	});
+}
+
+std::string ThreadedPlugin::registerMethod(const std::string &categoryName,
+                                           const std::string &methodName,
+                                           LunaCallHandler handler,
+                                           const JSchema &schema)
+{
+	std::string methodUrl;
+	std::shared_ptr<std::atomic<bool>> pluginAlive = this->alive;
+
+	// Runs on the main loop while the bus call waits.
+	LunaCallHandler mainHandler = [this, pluginAlive, handler](const JValue &params) -> JValue
+	{
+		if (*pluginAlive)
+		{
+			JValue threadParams = params.duplicate();
+			JValue result;
+
+			try
+			{
+				this->callOnThread([&handler, &threadParams, &result]()
+				{
+					result = handler(threadParams).duplicate();
+				});
+
+				return result;
+			}
+			catch (const std::exception &e)
+			{
+				LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0, "Exception in plugin %s method, message: %s",
+				          this->adapter->getInfo()->name.c_str(), e.what());
+				this->adapter->unloadPlugin();
+			}
+			catch (...)
+			{
+				LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0, "Exception in plugin %s method",
+				          this->adapter->getInfo()->name.c_str());
+				this->adapter->unloadPlugin();
+			}
+		}
+
+		return JObject{{"returnValue", false},
+		               {"errorCode", 3},
+		               {"errorMessage", "Plugin method failed."}};
+	};
+
+	this->callOnMain([&]()
+	{
+		methodUrl = this->adapter->registerMethod(categoryName, methodName, mainHandler, schema);
+	});
+
+	return methodUrl;
+}
+
+void ThreadedPlugin::createToast(const std::string &message,
+                                 const std::string &iconUrl,
+                                 const JValue &onClickAction)
+{
+	this->callOnMain([&]()
+	{
+		this->adapter->createToast(message, iconUrl, onClickAction.duplicate());
+	});
+}
+
+void ThreadedPlugin::createAlert(const std::string &alertId,
+                                 const std::string &title,
+                                 const std::string &message,
+                                 bool modal,
+                                 const std::string &iconUrl,
+                                 const JValue &buttons,
+                                 const JValue &onClose)
+{
+	this->callOnMain([&]()
+	{
+		this->adapter->createAlert(alertId, title, message, modal, iconUrl,
+		                           buttons.duplicate(), onClose.duplicate());
+	});
+}
+
+bool ThreadedPlugin::closeAlert(const std::string &alertId)
+{
+	bool result = false;
+
+	this->callOnMain([this, &alertId, &result]()
+	{
+		result = this->adapter->closeAlert(alertId);
+	});
+
+	return result;
+}
+
+void ThreadedPlugin::callOnMain(const std::function<void()> &call)
+{
+	if (!this->thread->isCurrent())
+	{
+		call();
+		return;
+	}
+
+	std::promise<void> done;
+	std::future<void> result = done.get_future();
+	std::shared_ptr<std::atomic<bool>> pluginAlive = this->alive;
+	// Notifications the call creates are attributed to the event the
+	// plugin thread is handling, and traced in its flow.
+	EventOrigin origin = EventOrigin::capture();
+
+	this->thread->postToMain([this, pluginAlive, &call, &done, &origin]()
+	{
+		// Nothing of this object may be touched once it is being deleted.
+		if (!*pluginAlive)
+		{
+			done.set_exception(std::make_exception_ptr(Error("Plugin is being unloaded")));
+			return;
+		}
+
+		try
+		{
+			EventOrigin::Scope originScope(origin);
+			call();
+			done.set_value();
+		}
+		catch (...)
+		{
+			done.set_exception(std::current_exception());
+		}
+
+		if (this->adapter->needUnload)
+		{
+			this->scheduleUnload();
+		}
+	});
+
+	result.get();
+}
+
+void ThreadedPlugin::callOnThread(const std::function<void()> &call)
+{
+	std::exception_ptr error;
+	EventOrigin origin = EventOrigin::capture();
+
+	this->thread->call([&call, &error, &origin]()
+	{
+		try
+		{
+			EventOrigin::Scope originScope(origin);
+			call();
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+	});
+
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+}
+
+void ThreadedPlugin::postToThread(const char *what, const std::function<void()> &call,
+                                  const std::function<void()> &dropped)
+{
+	std::shared_ptr<std::atomic<bool>> pluginAlive = this->alive;
+	std::string callName = what;
+	EventOrigin origin = EventOrigin::capture();
+
+	this->thread->post([this, pluginAlive, callName, call, dropped, origin]()
+	{
+		if (!*pluginAlive)
+		{
+			if (dropped)
+			{
+				dropped();
+			}
+
+			return;
+		}
+
+		try
+		{
+			EventOrigin::Scope originScope(origin);
+			call();
+		}
+		catch (const std::exception &e)
+		{
+			this->reportException(callName + ", message: " + e.what());
+		}
+		catch (...)
+		{
+			this->reportException(callName);
+		}
+	});
+}
+
+SubscribeCallback ThreadedPlugin::wrapSubscribe(SubscribeCallback callback)
+{
+	return [this, callback](JValue &previousValue, JValue &value)
+	{
+		JValue threadPrevious = previousValue.duplicate();
+		JValue threadValue = value.duplicate();
+
+		this->postToThread("subscription callback", [callback, threadPrevious, threadValue]()
+		{
+			JValue previous = threadPrevious;
+			JValue current = threadValue;
+			callback(previous, current);
+		});
+	};
+}
+
+TimeoutCallback ThreadedPlugin::wrapTimeout(TimeoutCallback callback)
+{
+	return [this, callback](const std::string &timeoutId)
+	{
+		this->postToThread("timeout callback", [callback, timeoutId]()
+		{
+			callback(timeoutId);
+		});
+	};
+}
+
+LunaCallback ThreadedPlugin::wrapCall(LunaCallback callback)
+{
+	return [this, callback](JValue &response)
+	{
+		JValue threadResponse = response.duplicate();
+
+		this->postToThread("call callback", [callback, threadResponse]()
+		{
+			JValue current = threadResponse;
+			callback(current);
+		});
+	};
+}
+
+void ThreadedPlugin::reportException(const std::string &message)
+{
+	std::shared_ptr<std::atomic<bool>> pluginAlive = this->alive;
+
+	this->thread->postToMain([this, pluginAlive, message]()
+	{
+		if (!*pluginAlive)
+		{
+			return;
+		}
+
+		LOG_ERROR(MSGID_PLUGIN_EXCEPTION, 0, "Exception in plugin %s thread, in %s",
+		          this->adapter->getInfo()->name.c_str(), message.c_str());
+		this->adapter->unloadPlugin();
+		this->scheduleUnload();
+	});
+}
+
+void ThreadedPlugin::scheduleUnload()
+{
+	if (!this->unloadSource)
+	{
+		this->unloadSource = g_idle_add(ThreadedPlugin::unloadCallback, this);
+	}
+}
+
+gboolean ThreadedPlugin::unloadCallback(gpointer userData)
+{
+	auto threaded = reinterpret_cast<ThreadedPlugin *>(userData);
+	PluginAdapter *adapter = threaded->adapter;
+
+	threaded->unloadSource = 0;
+
+	// Deletes threaded.
+	adapter->manager->processUnload(adapter);
+	return G_SOURCE_REMOVE;
+}
@@ -0,0 +1,192 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <glib.h>
+#include <pbnjson.hpp>
+
+#include <event-monitor-api/api.h>
+
+#include "pluginthread.h"
+
+using namespace EventMonitor;
+
+class PluginAdapter;
+
+/**
+ * Runs a plugin on a PluginThread instead of the main loop.
+ *
+ * As Plugin it stands in for the plugin towards its adapter and posts the
+ * calls to the thread. As Manager it is what the plugin gets: calls made on
+ * the plugin thread are run on the main loop while the thread waits, and
+ * the plugin's callbacks are posted back to the thread when they fire.
+ * JSON values are copied whenever they cross, they are not thread safe.
+ *
+ * The plugin is constructed and destroyed on the main thread.
+ * stopMonitoring and luna method handlers are waited for.
+ */
+class ThreadedPlugin: public Plugin, public Manager
+{
+public:
+	ThreadedPlugin(PluginAdapter *adapter, PluginThread *thread);
+
+	/**
+	 * Waits for the plugin's running callback, then deletes the plugin.
+	 */
+	virtual ~ThreadedPlugin();
+
+	ThreadedPlugin(const ThreadedPlugin &) = delete;
+	ThreadedPlugin &operator=(const ThreadedPlugin &) = delete;
+
+	void setPlugin(Plugin *plugin);
+
+	// Plugin methods - called from adapter
+	void startMonitoring();
+	UnloadResult stopMonitoring(const std::string &service);
+	void uiLocaleChanged(const std::string &uiLocale);
+	void servicePaused(const std::string &service);
+	void serviceResumed(const std::string &service);
+	void trimMemory();
+
+	// Manager methods - called from plugin
+	void setupLogging(PmLogContext *context);
+	void unloadPlugin();
+	const std::string getUILocale();
+	const pbnjson::JValue &getLocaleInfo();
+
+	pbnjson::JValue lunaCall(const std::string &serviceUrl,
+	                         pbnjson::JValue &params,
+	                         unsigned long timeout = 1000);
+
+	void lunaCallAsync(const std::string &serviceUrl,
+	                   pbnjson::JValue &params,
+	                   LunaCallback callback);
+
+	void subscribeToMethod(const std::string &subscriptionId,
+	                       const std::string &methodPath,
+	                       pbnjson::JValue &params,
+	                       SubscribeCallback callback,
+	                       const pbnjson::JSchema &schema = pbnjson::JSchema::AllSchema());
+
+	bool unsubscribeFromMethod(const std::string &subscriptionId);
+
+	void subscribeToSignal(const std::string &subscriptionId,
+	                       const std::string &category,
+	                       const std::string &method,
+	                       SubscribeCallback callback,
+	                       const pbnjson::JSchema &schema = pbnjson::JSchema::AllSchema());
+
+	bool unsubscribeFromSignal(const std::string &subscriptionId);
+
+	void setTimeout(const std::string &timeoutId,
+	                unsigned int timeMs,
+	                bool repeat,
+	                TimeoutCallback callback);
+
+	bool cancelTimeout(const std::string &timeoutId);
+
+	void debounce(const std::string &debounceId,
+	              unsigned int delayMs,
+	              TimeoutCallback callback);
+
+	bool cancelDebounce(const std::string &debounceId);
+
+	void throttle(const std::string &throttleId,
+	              unsigned int intervalMs,
+	              TimeoutCallback callback);
+
+	bool cancelThrottle(const std::string &throttleId);
+
+	void startPolling(const std::string &pollId,
+	                  const std::string &serviceUrl,
+	                  pbnjson::JValue &params,
+	                  unsigned int minIntervalMs,
+	                  unsigned int maxIntervalMs,
+	                  SubscribeCallback callback);
+
+	bool stopPolling(const std::string &pollId);
+
+	bool runInBackground(BackgroundTask task, BackgroundCallback completion);
+
+	/**
+	 * Thread safe, the function runs on the plugin thread.
+	 */
+	void post(PostCallback callback);
+
+	std::string registerMethod(const std::string &categoryName,
+	                           const std::string &methodName,
+	                           LunaCallHandler handler,
+	                           const pbnjson::JSchema &schema = pbnjson::JSchema::AllSchema());
+
+	void createToast(const std::string &message,
+	                 const std::string &iconUrl = "",
+	                 const pbnjson::JValue &onClickAction = pbnjson::JValue());
+
+	void createAlert(const std::string &alertId,
+	                 const std::string &title,
+	                 const std::string &message,
+	                 bool modal,
+	                 const std::string &iconUrl,
+	                 const pbnjson::JValue &buttons,
+	                 const pbnjson::JValue &onClose);
+
+	bool closeAlert(const std::string &alertId);
+
+private:
+	/**
+	 * Run on the main thread and wait, or run right away if not called from
+	 * the plugin thread. Rethrows exceptions.
+	 */
+	void callOnMain(const std::function<void()> &call);
+
+	/**
+	 * Run on the plugin thread and wait, see PluginThread::call.
+	 * Rethrows exceptions.
+	 */
+	void callOnThread(const std::function<void()> &call);
+
+	/**
+	 * Run on the plugin thread without waiting, exceptions unload the plugin.
+	 * @param dropped - called on the plugin thread instead of call if the
+	 * plugin stopped meanwhile.
+	 */
+	void postToThread(const char *what, const std::function<void()> &call,
+	                  const std::function<void()> &dropped = nullptr);
+
+	SubscribeCallback wrapSubscribe(SubscribeCallback callback);
+	TimeoutCallback wrapTimeout(TimeoutCallback callback);
+	LunaCallback wrapCall(LunaCallback callback);
+
+	void reportException(const std::string &message);
+	void scheduleUnload();
+	static gboolean unloadCallback(gpointer userData);
+
+private:
+	PluginAdapter *adapter;
+	PluginThread *thread;
+	Plugin *plugin;
+
+	// Cleared before the plugin is deleted, tasks still queued skip.
+	std::shared_ptr<std::atomic<bool>> alive;
+
+	guint unloadSource;
+
+	pbnjson::JValue localeInfo; // plugin thread copy
+};
@@ -0,0 +1,232 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <cerrno>
+#include <cstring>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "tracer.h"
+#include "logging.h"
+#include "config.h"
+
+using namespace pbnjson;
+
+std::atomic<bool> Tracer::tracing(false);
+std::atomic<unsigned long long> Tracer::nextFlow(1);
+Tracer *Tracer::instance = nullptr;
+
+static thread_local unsigned long long threadFlow = 0;
+
+static int64_t threadId()
+{
+	static thread_local int64_t id = static_cast<int64_t>(syscall(SYS_gettid));
+	return id;
+}
+
+Tracer::Span::Span(const char *_category, const char *_name, const std::string &_detail,
+                   unsigned long long _flow, bool _startsFlow):
+	start(0),
+	category(_category),
+	name(_name),
+	flow(_flow),
+	startsFlow(_startsFlow)
+{
+	if (Tracer::isTracing())
+	{
+		this->start = g_get_monotonic_time();
+		this->detail = _detail;
+	}
+}
+
+Tracer::Span::~Span()
+{
+	if (this->start && Tracer::isTracing())
+	{
+		Tracer::instance->writeSpan(this->category, this->name, this->detail, this->start,
+		                            g_get_monotonic_time(), this->flow, this->startsFlow);
+	}
+}
+
+Tracer::FlowScope::FlowScope(unsigned long long flow):
+	previous(threadFlow)
+{
+	threadFlow = flow;
+}
+
+Tracer::FlowScope::~FlowScope()
+{
+	threadFlow = this->previous;
+}
+
+Tracer::Tracer():
+	file(nullptr),
+	events(0),
+	maxEvents(0)
+{
+	Tracer::instance = this;
+}
+
+Tracer::~Tracer()
+{
+	(void) this->stopTrace();
+	Tracer::instance = nullptr;
+}
+
+bool Tracer::startTrace(const std::string &_path, unsigned int _maxEvents)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	this->closeFile();
+	this->file = fopen(_path.c_str(), "we");
+
+	if (!this->file)
+	{
+		LOG_ERROR(MSGID_TRACE, 0, "Failed to create trace file %s: %s", _path.c_str(),
+		          strerror(errno));
+		return false;
+	}
+
+	// JSON array format, viewers accept it without the closing bracket,
+	// so a trace cut short by a crash still loads.
+	fputs("[\n", this->file);
+	this->path = _path;
+	this->events = 0;
+	this->maxEvents = _maxEvents;
+
+	this->writeEvent(JObject{{"name", "process_name"},
+	                         {"ph", "M"},
+	                         {"pid", JValue(static_cast<int64_t>(getpid()))},
+	                         {"args", JObject{{"name", COMPONENT_NAME}}}});
+
+	Tracer::tracing = true;
+	LOG_INFO(MSGID_TRACE, 0, "Tracing to %s", _path.c_str());
+	return true;
+}
+
+unsigned int Tracer::stopTrace()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	unsigned int written = this->events;
+
+	this->closeFile();
+	return written;
+}
+
+JValue Tracer::getStatus()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	return JObject{{"tracing", this->file != nullptr},
+	               {"path", this->path},
+	               {"events", JValue(static_cast<int64_t>(this->events))},
+	               {"maxEvents", JValue(static_cast<int64_t>(this->maxEvents))}};
+}
+
+unsigned long long Tracer::newFlow()
+{
+	if (!Tracer::isTracing())
+	{
+		return 0;
+	}
+
+	return Tracer::nextFlow.fetch_add(1, std::memory_order_relaxed);
+}
+
+unsigned long long Tracer::currentFlow()
+{
+	return threadFlow;
+}
+
+void Tracer::writeSpan(const char *category, const char *name, const std::string &detail,
+                       gint64 start, gint64 end, unsigned long long flow, bool startsFlow)
+{
+	JValue pid = JValue(static_cast<int64_t>(getpid()));
+	JValue tid = JValue(threadId());
+	JValue span = JObject{{"name", name},
+	                      {"cat", category},
+	                      {"ph", "X"},
+	                      {"ts", JValue(static_cast<int64_t>(start))},
+	                      {"dur", JValue(static_cast<int64_t>(end - start))},
+	                      {"pid", pid},
+	                      {"tid", tid}};
+
+	if (!detail.empty())
+	{
+		span.put("args", JObject{{"detail", detail}});
+	}
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	if (!this->file)
+	{
+		return;
+	}
+
+	this->writeEvent(span);
+
+	if (flow)
+	{
+		// Binds to the span above, same thread and timestamp.
+		this->writeEvent(JObject{{"name", "event"},
+		                         {"cat", "flow"},
+		                         {"ph", startsFlow ? "s" : "t"},
+		                         {"id", JValue(static_cast<int64_t>(flow))},
+		                         {"ts", JValue(static_cast<int64_t>(start))},
+		                         {"pid", pid},
+		                         {"tid", tid},
+		                         {"bp", "e"}});
+	}
+}
+
+void Tracer::writeEvent(const JValue &event)
+{
+	// Closed by the previous event reaching the limit.
+	if (!this->file)
+	{
+		return;
+	}
+
+	if (this->events > 0)
+	{
+		fputs(",\n", this->file);
+	}
+
+	fputs(event.stringify().c_str(), this->file);
+	this->events++;
+
+	if (this->maxEvents && this->events >= this->maxEvents)
+	{
+		LOG_WARNING(MSGID_TRACE, 0, "Trace reached %u events, stopped", this->events);
+		this->closeFile();
+	}
+}
+
+void Tracer::closeFile()
+{
+	Tracer::tracing = false;
+
+	if (!this->file)
+	{
+		return;
+	}
+
+	fputs("\n]\n", this->file);
+	fclose(this->file);
+	this->file = nullptr;
+
+	LOG_INFO(MSGID_TRACE, 0, "Trace %s closed, %u events", this->path.c_str(), this->events);
+}
@@ -0,0 +1,139 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <glib.h>
+#include <pbnjson.hpp>
+
+// Tracing stops by itself after this many events.
+const unsigned int DEFAULT_TRACE_EVENTS = 1000000;
+
+/**
+ * Writes spans of event handling to a file in Chrome trace event format,
+ * for viewing in Perfetto or chrome://tracing.
+ * Spans handling the same bus reply share a flow id, from the reply
+ * arriving to the calls the plugin made in response.
+ * Spans cost a relaxed atomic load while not tracing.
+ * Only one tracer can exist at a time.
+ */
+class Tracer
+{
+public:
+	/**
+	 * Span of the life of the object, written when it ends.
+	 */
+	class Span
+	{
+	public:
+		/**
+		 * @param name - must be a string literal.
+		 * @param flow - flow id, 0 for none.
+		 * @param startsFlow - first span of the flow.
+		 */
+		Span(const char *category, const char *name,
+		     const std::string &detail = std::string(),
+		     unsigned long long flow = 0, bool startsFlow = false);
+		~Span();
+
+		Span(const Span &) = delete;
+		Span &operator=(const Span &) = delete;
+
+	private:
+		gint64 start; // 0 if not tracing
+		const char *category;
+		const char *name;
+		std::string detail;
+		unsigned long long flow;
+		bool startsFlow;
+	};
+
+	/**
+	 * Spans created on this thread while the scope lives continue the flow,
+	 * see currentFlow.
+	 */
+	class FlowScope
+	{
+	public:
+		FlowScope(unsigned long long flow);
+		~FlowScope();
+
+		FlowScope(const FlowScope &) = delete;
+		FlowScope &operator=(const FlowScope &) = delete;
+
+	private:
+		unsigned long long previous;
+	};
+
+	Tracer();
+
+	/**
+	 * Stops tracing and closes the file.
+	 */
+	~Tracer();
+
+	Tracer(const Tracer &) = delete;
+	Tracer &operator=(const Tracer &) = delete;
+
+	/**
+	 * Start writing spans to path, replacing the file.
+	 */
+	bool startTrace(const std::string &path, unsigned int maxEvents);
+
+	/**
+	 * @return number of events written.
+	 */
+	unsigned int stopTrace();
+
+	pbnjson::JValue getStatus();
+
+	static inline bool isTracing()
+	{
+		return Tracer::tracing.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * New flow id, 0 if not tracing.
+	 */
+	static unsigned long long newFlow();
+
+	/**
+	 * Flow of the FlowScope on this thread, 0 if none.
+	 */
+	static unsigned long long currentFlow();
+
+private:
+	void writeSpan(const char *category, const char *name,
+	               const std::string &detail, gint64 start, gint64 end,
+	               unsigned long long flow, bool startsFlow);
+	void writeEvent(const pbnjson::JValue &event);
+	void closeFile();
+
+private:
+	static std::atomic<bool> tracing;
+	static std::atomic<unsigned long long> nextFlow;
+	static Tracer *instance;
+
+	std::mutex mutex;
+	FILE *file;
+	std::string path;
+	unsigned int events;
+	unsigned int maxEvents;
+};
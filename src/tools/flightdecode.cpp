@@ -0,0 +1,189 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+// Prints a flight recorder dump written by the event monitor, oldest
+// event first.
+// Usage: event-monitor-flightdecode FILE
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "flightrecord.h"
+
+static const char *eventName(uint16_t event)
+{
+	switch (event)
+	{
+		case FLIGHT_REPLY:
+			return "reply";
+		case FLIGHT_CALLBACK_START:
+			return "callback-start";
+		case FLIGHT_CALLBACK_END:
+			return "callback-end";
+		case FLIGHT_TIMER:
+			return "timer";
+		case FLIGHT_PLUGIN_LOAD:
+			return "plugin-load";
+		case FLIGHT_PLUGIN_UNLOAD:
+			return "plugin-unload";
+		default:
+			return "unknown";
+	}
+}
+
+static std::string lookup(const std::vector<char> &strings, uint32_t id)
+{
+	uint16_t length;
+
+	if (id == FLIGHT_NO_STRING)
+	{
+		return "-";
+	}
+
+	if (id & FLIGHT_HASHED_STRING)
+	{
+		char hashed[16];
+		snprintf(hashed, sizeof(hashed), "#%08x", id & ~FLIGHT_HASHED_STRING);
+		return hashed;
+	}
+
+	if (id + sizeof(length) > strings.size())
+	{
+		return "-";
+	}
+
+	memcpy(&length, strings.data() + id, sizeof(length));
+
+	if (id + sizeof(length) + length > strings.size())
+	{
+		return "-";
+	}
+
+	return std::string(strings.data() + id + sizeof(length), length);
+}
+
+static std::string formatTime(uint64_t realTimeUs)
+{
+	time_t seconds = static_cast<time_t>(realTimeUs / 1000000);
+	struct tm local;
+	char buffer[64];
+
+	localtime_r(&seconds, &local);
+	size_t length = strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &local);
+	snprintf(buffer + length, sizeof(buffer) - length, ".%06llu",
+	         static_cast<unsigned long long>(realTimeUs % 1000000));
+	return buffer;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2)
+	{
+		fprintf(stderr, "Usage: %s FILE\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::ifstream file(argv[1], std::ios::binary);
+
+	if (!file)
+	{
+		fprintf(stderr, "Failed to open %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	std::vector<char> data((std::istreambuf_iterator<char>(file)),
+	                       std::istreambuf_iterator<char>());
+	FlightDumpHeader header;
+
+	if (data.size() < sizeof(header))
+	{
+		fprintf(stderr, "%s: not a flight recorder dump\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	memcpy(&header, data.data(), sizeof(header));
+
+	if (memcmp(header.magic, FLIGHT_DUMP_MAGIC, sizeof(header.magic)) != 0 ||
+	        header.version != FLIGHT_DUMP_VERSION ||
+	        header.recordSize != sizeof(FlightRecord) ||
+	        data.size() < sizeof(header) + header.stringBytes +
+	        static_cast<uint64_t>(header.capacity) * header.recordSize)
+	{
+		fprintf(stderr, "%s: not a flight recorder dump or unsupported version\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	std::vector<char> strings(data.begin() + sizeof(header),
+	                          data.begin() + sizeof(header) + header.stringBytes);
+	const char *records = data.data() + sizeof(header) + header.stringBytes;
+
+	std::string cause = header.signal ? "on signal " + std::to_string(header.signal) : "on request";
+
+	printf("Dumped %s %s, %llu events recorded, last %u kept\n",
+	       formatTime(header.realTime).c_str(), cause.c_str(),
+	       static_cast<unsigned long long>(header.head), header.capacity);
+
+	uint64_t first = header.head > header.capacity ? header.head - header.capacity : 0;
+	unsigned int skipped = 0;
+
+	for (uint64_t number = first; number < header.head; number++)
+	{
+		FlightRecord record;
+		memcpy(&record, records + (number % header.capacity) * sizeof(record), sizeof(record));
+
+		// Being written or already overwritten when dumped.
+		if (record.sequence != static_cast<uint32_t>(number + 1))
+		{
+			skipped++;
+			continue;
+		}
+
+		uint64_t realTime = header.realTime - (header.monotonicTime - record.time);
+		std::string value;
+
+		if (record.event == FLIGHT_CALLBACK_START)
+		{
+			value = lookup(strings, static_cast<uint32_t>(record.value));
+		}
+		else if (record.event == FLIGHT_CALLBACK_END)
+		{
+			value = std::to_string(record.value) + " us";
+		}
+		else if (record.event == FLIGHT_REPLY)
+		{
+			value = std::to_string(record.value) + " bytes";
+		}
+
+		printf("%s %-14s %-24s %s %s\n", formatTime(realTime).c_str(),
+		       eventName(record.event),
+		       lookup(strings, record.plugin).c_str(),
+		       lookup(strings, record.detail).c_str(),
+		       value.c_str());
+	}
+
+	if (skipped)
+	{
+		printf("%u events skipped, being written while dumped\n", skipped);
+	}
+
+	return EXIT_SUCCESS;
+}
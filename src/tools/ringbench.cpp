@@ -0,0 +1,264 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+// Compares delivering subscription events to a plugin in process with
+// delivering them to a plugin host over a ShmChannel.
+// Usage: event-monitor-ringbench [EVENTS]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+#include <glib.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <pbnjson.hpp>
+
+#include "shmring.h"
+
+using namespace pbnjson;
+
+typedef std::function<void(JValue &previousValue, JValue &value)> EventCallback;
+
+static JValue makeEvent(int64_t seq)
+{
+	return JObject{{"op", "subscription"},
+	               {"id", "batteryStatus"},
+	               {"seq", JValue(seq)},
+	               {"previous", JObject{{"percent", 41}, {"charging", false}}},
+	               {"value", JObject{{"percent", 42}, {"charging", true},
+	                                 {"temperature", 31.5}, {"returnValue", true}}}};
+}
+
+static void report(const char *name, std::vector<gint64> &samples, gint64 totalUs)
+{
+	if (samples.empty())
+	{
+		printf("%-22s no events\n", name);
+		return;
+	}
+
+	std::sort(samples.begin(), samples.end());
+	size_t count = samples.size();
+
+	printf("%-22s %8zu events %10.0f events/s  p50 %6lld ns  p99 %6lld ns  max %8lld ns\n",
+	       name, count, count * 1e6 / std::max<gint64>(totalUs, 1),
+	       static_cast<long long>(samples[count / 2]),
+	       static_cast<long long>(samples[count * 99 / 100]),
+	       static_cast<long long>(samples[count - 1]));
+}
+
+static gint64 nowNs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return static_cast<gint64>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+static void waitReadable(int fd)
+{
+	struct pollfd pfd = {fd, POLLIN, 0};
+	(void) poll(&pfd, 1, -1);
+}
+
+/**
+ * Plugin host side: echo sequence numbers of "ping" events and count
+ * everything else until "done".
+ */
+static int runHost()
+{
+	ShmChannel *channel = ShmChannel::attach(HOST_CHANNEL_CAPACITY);
+
+	if (!channel)
+	{
+		return EXIT_FAILURE;
+	}
+
+	int64_t received = 0;
+	std::string text;
+
+	for (;;)
+	{
+		waitReadable(channel->getReceiveFd());
+		channel->clearSignal();
+
+		while (channel->receive(text))
+		{
+			JValue event = JDomParser::fromString(text, JSchema::AllSchema());
+			std::string op;
+			(void) event["op"].asString(op);
+
+			if (op == "done")
+			{
+				(void) channel->send(JObject{{"received", JValue(received)}}.stringify(""));
+				delete channel;
+				return EXIT_SUCCESS;
+			}
+
+			if (op == "ping")
+			{
+				while (!channel->send(JObject{{"seq", event["seq"]}}.stringify("")))
+				{
+					g_usleep(10);
+				}
+
+				continue;
+			}
+
+			received += 1;
+		}
+	}
+}
+
+static void benchInProcess(int events)
+{
+	int64_t sum = 0;
+	EventCallback callback = [&sum](JValue & previousValue, JValue & value)
+	{
+		int percent = 0;
+		(void) value["percent"].asNumber(percent);
+		sum += percent;
+	};
+
+	std::vector<gint64> samples;
+	samples.reserve(events);
+	gint64 start = g_get_monotonic_time();
+
+	for (int i = 0; i < events; i++)
+	{
+		gint64 begin = nowNs();
+		JValue event = makeEvent(i);
+		JValue previousValue = event["previous"];
+		JValue value = event["value"];
+		callback(previousValue, value);
+		samples.push_back(nowNs() - begin);
+	}
+
+	report("in-process", samples, g_get_monotonic_time() - start);
+}
+
+static void benchRoundTrip(ShmChannel *channel, int events)
+{
+	std::vector<gint64> samples;
+	samples.reserve(events);
+	gint64 start = g_get_monotonic_time();
+	std::string text;
+
+	for (int i = 0; i < events; i++)
+	{
+		gint64 begin = nowNs();
+		JValue event = makeEvent(i);
+		event.put("op", "ping");
+		(void) channel->send(event.stringify(""));
+
+		for (bool replied = false; !replied;)
+		{
+			channel->clearSignal();
+
+			if (channel->receive(text))
+			{
+				(void) JDomParser::fromString(text, JSchema::AllSchema());
+				replied = true;
+			}
+			else
+			{
+				waitReadable(channel->getReceiveFd());
+			}
+		}
+
+		samples.push_back(nowNs() - begin);
+	}
+
+	report("ring round trip", samples, g_get_monotonic_time() - start);
+}
+
+static void benchStream(ShmChannel *channel, int events)
+{
+	std::vector<gint64> samples;
+	samples.reserve(events);
+	gint64 start = g_get_monotonic_time();
+	int full = 0;
+
+	for (int i = 0; i < events; i++)
+	{
+		gint64 begin = nowNs();
+		std::string text = makeEvent(i).stringify("");
+
+		while (!channel->send(text))
+		{
+			full += 1;
+			g_usleep(10);
+		}
+
+		samples.push_back(nowNs() - begin);
+	}
+
+	(void) channel->send(JObject{{"op", "done"}}.stringify(""));
+
+	std::string text;
+
+	for (;;)
+	{
+		waitReadable(channel->getReceiveFd());
+		channel->clearSignal();
+
+		if (channel->receive(text))
+		{
+			break;
+		}
+	}
+
+	report("ring stream", samples, g_get_monotonic_time() - start);
+	printf("%-22s %s, ring full %d times\n", "", text.c_str(), full);
+}
+
+int main(int argc, char **argv)
+{
+	int events = argc > 1 ? atoi(argv[1]) : 100000;
+
+	if (events <= 0)
+	{
+		fprintf(stderr, "Usage: %s [EVENTS]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	benchInProcess(events);
+
+	ShmChannel *channel = ShmChannel::create(HOST_CHANNEL_CAPACITY);
+
+	if (!channel)
+	{
+		perror("Failed to create channel");
+		return EXIT_FAILURE;
+	}
+
+	pid_t pid = fork();
+
+	if (pid == 0)
+	{
+		_exit(channel->prepareChild() ? runHost() : EXIT_FAILURE);
+	}
+
+	benchRoundTrip(channel, events);
+	benchStream(channel, events);
+
+	(void) waitpid(pid, nullptr, 0);
+	delete channel;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,464 @@
+// Copyright (c) 2015-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+// Drives ServiceMonitor with service status changes and checks what it
+// asks of the plugin manager. PluginManager, PluginLoader and LunaService
+// are replaced by the fakes below, this file is linked instead of their
+// sources.
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "servicemonitor.h"
+
+using namespace pbnjson;
+using namespace EventMonitor;
+
+/**
+ * What a plugin would see through the Manager API.
+ */
+class FakePlugin
+{
+public:
+	FakePlugin():
+		loaded(false),
+		subscribed(false)
+	{};
+
+	bool loaded;
+	bool subscribed; // to its required services, receives their events
+};
+
+PmLogContext logContext;
+
+static std::map<std::string, FakePlugin> fakePlugins;
+static std::vector<std::string> managerCalls;
+static SubscribeCallback localeCallback;
+static std::map<std::string, SubscribeCallback> statusCallbacks;
+
+/******** Fakes ********/
+
+PluginLoader::PluginLoader(const std::string &_pluginPath, const std::string &cacheFile):
+	pluginPath(_pluginPath)
+{
+}
+
+PluginLoader::~PluginLoader()
+{
+}
+
+LunaService::LunaService(std::string _servicePath, GMainLoop *mainLoop,
+                         const char *identifier):
+	servicePath(_servicePath),
+	nextSerial(0),
+	replyParser(nullptr)
+{
+}
+
+LunaService::~LunaService()
+{
+}
+
+SubscribeHandle LunaService::subscribeToMethod(const std::string &serviceUrl,
+                                               JValue &params,
+                                               SubscribeCallback callback,
+                                               const JSchema &schema,
+                                               PluginAdapter *plugin,
+                                               bool checkFirstResponse)
+{
+	std::string serviceName;
+
+	if (params["serviceName"].asString(serviceName))
+	{
+		localeCallback = callback;
+	}
+	else
+	{
+		statusCallbacks[serviceName] = callback;
+	}
+
+	return nullptr;
+}
+
+PluginManager::PluginManager(PluginLoader &_loader, LunaService &service, GMainLoop *_mainLoop):
+	lunaService(service),
+	mainLoop(_mainLoop),
+	backgroundPool(1, 1),
+	loader(_loader),
+	idleTimeoutSeconds(0),
+	idleTimer(0),
+	isolateAll(false)
+{
+}
+
+PluginManager::~PluginManager()
+{
+}
+
+void PluginManager::setLoadListener(std::function<void(const PluginInfo *)> listener)
+{
+}
+
+void PluginManager::setOpenListener(std::function<void(const PluginInfo *)> listener)
+{
+}
+
+void PluginManager::loadPlugin(const PluginInfo *info, const std::string &service)
+{
+	// Loaded plugin gets startMonitoring again.
+	managerCalls.push_back("load " + info->name);
+	fakePlugins[info->name].loaded = true;
+	fakePlugins[info->name].subscribed = true;
+}
+
+bool PluginManager::isPluginLoaded(const PluginInfo *info)
+{
+	return fakePlugins[info->name].loaded;
+}
+
+bool PluginManager::isPluginOpening(const PluginInfo *info)
+{
+	// Fake plugins are loaded right away.
+	return false;
+}
+
+void PluginManager::removePlugin(const PluginInfo *info)
+{
+	managerCalls.push_back("remove " + info->name);
+	fakePlugins[info->name] = FakePlugin();
+}
+
+void PluginManager::notifyPluginShouldUnload(const PluginInfo *info,
+                                             const std::string &serviceName)
+{
+	if (!fakePlugins[info->name].loaded)
+	{
+		return;
+	}
+
+	// Plugin returns UNLOAD_OK.
+	managerCalls.push_back("unload " + info->name);
+	fakePlugins[info->name] = FakePlugin();
+}
+
+void PluginManager::notifyServicePaused(const PluginInfo *info,
+                                        const std::string &serviceName)
+{
+	managerCalls.push_back("pause " + info->name);
+}
+
+void PluginManager::notifyServiceResumed(const PluginInfo *info,
+                                         const std::string &serviceName)
+{
+	managerCalls.push_back("resume " + info->name);
+
+	// Plugin declared it renews its subscriptions.
+	if (info->handlesResume)
+	{
+		fakePlugins[info->name].subscribed = true;
+	}
+}
+
+void PluginManager::notifyLocaleChanged(const JValue &_locale)
+{
+	this->locale = _locale;
+}
+
+/******** Helpers ********/
+
+static int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+static void check(bool passed, const char *condition, int line)
+{
+	if (!passed)
+	{
+		fprintf(stderr, "line %d: check failed: %s\n", line, condition);
+		failures += 1;
+	}
+}
+
+static PluginInfo makePlugin(const std::string &name,
+                             const std::vector<std::string> &requiredServices,
+                             bool handlesResume = false)
+{
+	PluginInfo info;
+	info.name = name;
+	info.path = "/plugins/" + name + ".so";
+	info.requiredServices = requiredServices;
+	info.handlesResume = handlesResume;
+	return info;
+}
+
+/**
+ * Dispatch everything pending on the main context, including the
+ * reconcile idle callback.
+ */
+static void runPending()
+{
+	while (g_main_context_iteration(nullptr, FALSE))
+	{
+	}
+}
+
+static gboolean quitCallback(gpointer userData)
+{
+	g_main_loop_quit(reinterpret_cast<GMainLoop *>(userData));
+	return G_SOURCE_REMOVE;
+}
+
+static void runFor(unsigned int ms)
+{
+	GMainLoop *loop = g_main_loop_new(nullptr, FALSE);
+	g_timeout_add(ms, quitCallback, loop);
+	g_main_loop_run(loop);
+	g_main_loop_unref(loop);
+	runPending();
+}
+
+static std::vector<std::string> takeCalls()
+{
+	std::vector<std::string> calls;
+	calls.swap(managerCalls);
+	return calls;
+}
+
+static void sendLocale()
+{
+	JValue previous;
+	JValue value = JObject{{"settings", JObject{{"localeInfo",
+	                        JObject{{"locales", JObject{{"UI", "en-US"}}}}}}}};
+	localeCallback(previous, value);
+	runPending();
+}
+
+static void sendStatus(const std::string &service, bool connected)
+{
+	if (!connected)
+	{
+		// Hub error cancels the subscriptions to the service.
+		for (auto &plugin : fakePlugins)
+		{
+			plugin.second.subscribed = false;
+		}
+	}
+
+	JValue previous;
+	JValue value = JObject{{"serviceName", service}, {"connected", connected}};
+	statusCallbacks[service](previous, value);
+	runPending();
+}
+
+static void reset()
+{
+	fakePlugins.clear();
+	managerCalls.clear();
+	localeCallback = nullptr;
+	statusCallbacks.clear();
+}
+
+class Fixture
+{
+public:
+	Fixture():
+		loader("", ""),
+		service("com.webos.service.eventmonitor.test", nullptr, nullptr),
+		manager(loader, service, nullptr),
+		monitor(manager, service)
+	{
+		reset();
+	};
+
+	PluginLoader loader;
+	LunaService service;
+	PluginManager manager;
+	ServiceMonitor monitor;
+	PluginList plugins;
+};
+
+/******** Tests ********/
+
+static void testResumeRestartsPlugin()
+{
+	Fixture fixture;
+	fixture.plugins.push_back(makePlugin("plain", {"com.example.service"}));
+	fixture.plugins.push_back(makePlugin("resuming", {"com.example.service"}, true));
+	fixture.monitor.setFlapDamping(200, 0, 60000);
+	fixture.monitor.startMonitor(&fixture.plugins);
+	sendLocale();
+
+	sendStatus("com.example.service", true);
+	CHECK((takeCalls() == std::vector<std::string> {"load plain", "load resuming"}));
+
+	// Restarted within the unload delay.
+	sendStatus("com.example.service", false);
+	CHECK((takeCalls() == std::vector<std::string> {"pause plain", "pause resuming"}));
+	sendStatus("com.example.service", true);
+	CHECK((takeCalls() == std::vector<std::string> {"unload plain", "load plain",
+	                                                "resume resuming"}));
+	CHECK(fakePlugins["plain"].subscribed);
+	CHECK(fakePlugins["resuming"].subscribed);
+
+	// Paused plugins are not unloaded once back.
+	runFor(300);
+	CHECK(takeCalls().empty());
+	CHECK(fakePlugins["plain"].subscribed);
+}
+
+static void testResumeAfterFlapping()
+{
+	Fixture fixture;
+	fixture.plugins.push_back(makePlugin("plain", {"com.example.service"}));
+	fixture.monitor.setFlapDamping(100, 2, 60000);
+	fixture.monitor.startMonitor(&fixture.plugins);
+	sendLocale();
+	sendStatus("com.example.service", true);
+	(void) takeCalls();
+
+	sendStatus("com.example.service", false);
+	sendStatus("com.example.service", true);
+	sendStatus("com.example.service", false);
+	(void) takeCalls();
+
+	// Flapping, stays paused past the unload delay.
+	runFor(200);
+	CHECK(takeCalls().empty());
+	CHECK(fakePlugins["plain"].loaded);
+
+	sendStatus("com.example.service", true);
+	CHECK((takeCalls() == std::vector<std::string> {"unload plain", "load plain"}));
+	CHECK(fakePlugins["plain"].subscribed);
+}
+
+static void testUnloadAfterDelay()
+{
+	Fixture fixture;
+	fixture.plugins.push_back(makePlugin("plain", {"com.example.service"}));
+	fixture.monitor.setFlapDamping(100, 0, 60000);
+	fixture.monitor.startMonitor(&fixture.plugins);
+	sendLocale();
+	sendStatus("com.example.service", true);
+	sendStatus("com.example.service", false);
+	(void) takeCalls();
+
+	runFor(200);
+	CHECK((takeCalls() == std::vector<std::string> {"unload plain"}));
+
+	sendStatus("com.example.service", true);
+	CHECK((takeCalls() == std::vector<std::string> {"load plain"}));
+	CHECK(fakePlugins["plain"].subscribed);
+}
+
+static void testPluginWithoutServices()
+{
+	Fixture fixture;
+	fixture.plugins.push_back(makePlugin("standalone", {}));
+	fixture.plugins.push_back(makePlugin("plain", {"com.example.service"}));
+	fixture.monitor.startMonitor(&fixture.plugins);
+	runPending();
+
+	// Waits for the locale like any other plugin, not for service status.
+	CHECK(takeCalls().empty());
+	sendLocale();
+	CHECK((takeCalls() == std::vector<std::string> {"load standalone"}));
+
+	// Not touched by status changes of other plugins' services.
+	sendStatus("com.example.service", true);
+	sendStatus("com.example.service", false);
+	CHECK((takeCalls() == std::vector<std::string> {"load plain", "unload plain"}));
+	CHECK(fakePlugins["standalone"].loaded);
+
+	// Added while running.
+	fixture.plugins.push_back(makePlugin("added", {}));
+	fixture.monitor.pluginChanged(fixture.plugins.size() - 1, PLUGIN_ADDED);
+	runPending();
+	CHECK((takeCalls() == std::vector<std::string> {"load added"}));
+}
+
+static int64_t outagesOf(ServiceMonitor &monitor, const std::string &service)
+{
+	for (const JValue &stats : monitor.getServiceStats()["services"].items())
+	{
+		int64_t outages = -1;
+
+		if (stats["service"] == service)
+		{
+			(void) stats["outages"].asNumber(outages);
+			return outages;
+		}
+	}
+
+	return -1;
+}
+
+static void testStaleSnapshotIsNotAnOutage()
+{
+	gchar *path = g_build_filename(g_get_tmp_dir(), "servicemonitortest.snapshot", nullptr);
+	StatusSnapshot snapshot(path);
+	snapshot.write(JObject{{"locale", JObject()},
+	                       {"services", JObject{{"com.example.service", true}}}});
+
+	Fixture fixture;
+	fixture.plugins.push_back(makePlugin("plain", {"com.example.service"}));
+	fixture.monitor.setFlapDamping(100, 0, 60000);
+	fixture.monitor.setSnapshot(&snapshot, true);
+	fixture.monitor.startMonitor(&fixture.plugins);
+	runPending();
+	CHECK((takeCalls() == std::vector<std::string> {"load plain"}));
+
+	// Not really online, stopped without waiting and not an outage.
+	sendStatus("com.example.service", false);
+	CHECK((takeCalls() == std::vector<std::string> {"unload plain"}));
+	CHECK(outagesOf(fixture.monitor, "com.example.service") == 0);
+
+	// Outages count once it was seen online.
+	sendStatus("com.example.service", true);
+	sendStatus("com.example.service", false);
+	CHECK((takeCalls() == std::vector<std::string> {"load plain", "pause plain"}));
+	CHECK(outagesOf(fixture.monitor, "com.example.service") == 1);
+
+	(void) unlink(path);
+	g_free(path);
+}
+
+int main(int argc, char **argv)
+{
+	if (PmLogGetContext("event-monitor-test", &logContext) != kPmLogErr_None)
+	{
+		fprintf(stderr, "Failed to set up log context\n");
+		return EXIT_FAILURE;
+	}
+
+	testResumeRestartsPlugin();
+	testResumeAfterFlapping();
+	testUnloadAfterDelay();
+	testPluginWithoutServices();
+	testStaleSnapshotIsNotAnOutage();
+
+	if (failures > 0)
+	{
+		fprintf(stderr, "%d checks failed\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("All checks passed\n");
+	return EXIT_SUCCESS;
+}